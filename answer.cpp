@@ -8,10 +8,11 @@
 *  to answer one query, but currently there is only one
 *  answer section for each query.
 *
-*  A future improvement of the system will be to have
-*  the authority and additional sections filled at some
-*  point. For simple queries, it is not necessary to have
-*  them filled up.
+*  The authority section is only filled for negative
+*  answers, with the SOA record of the database, so the
+*  resolvers can cache them (RFC 2308). The additional
+*  section only carries the OPT record (EDNS0, RFC 6891)
+*  when the query had one.
 *
 *  \version 0.1
 *  \date    11-September-2006
@@ -22,6 +23,7 @@
 
 #include "answer.h"
 #include <iostream>
+#include <cstring>
 
 /////////////////
 // Class CAnswer
@@ -30,7 +32,10 @@
 /*! Constructor
  */
 CAnswer::CAnswer()
-        : m_RR() {
+        : m_RR(),
+          m_Data(NULL),
+          m_Length(0),
+          m_First(0) {
 }
 
 /*! Destructor
@@ -38,39 +43,53 @@ CAnswer::CAnswer()
 CAnswer::~CAnswer() {
 }
 
-/*! The calling class sets most of the fields, the rest are decided here.
- * As only internet addresses are taking into account, the length is
- * 4 by definition.
+/*! Clears the resource records to process a new query
  */
-void CAnswer::setAnswerSection(string &name, string &rType, string &rClass, unsigned long addr) {
-    string addr_str;
+void CAnswer::reset() {
+    m_RR.reset();
+    m_Data = NULL;
+    m_Length = 0;
+    m_First = 0;
+}
 
-    m_RR.setName(name);
+/*! The calling class sets all the fields, the RData is an address
+ * in network order (4 bytes for A, 16 bytes for AAAA).
+ */
+void CAnswer::setAnswerSection(const unsigned char *name, unsigned int nameLength,
+                               unsigned int rType, unsigned int rClass, unsigned int ttl,
+                               const unsigned char *rData, unsigned int rdLength) {
+    m_RR.setName(name, nameLength);
     m_RR.setType(rType);
     m_RR.setClass(rClass);
-    // Set to 0
-    m_RR.setTTL(0);
-    m_RR.setRdLength(4);
+    // Given by the database ($TTL or ttl=)
+    m_RR.setTTL(ttl);
+    m_RR.setRdLength(rdLength);
+    m_RR.setRData(rData, rdLength);
+}
 
-    addr_str = (addr >> 24) & 0xff;
-    addr_str += (addr >> 16) & 0xff;
-    addr_str += (addr >> 8) & 0xff;
-    addr_str += addr & 0xff;
-    m_RR.setRData(addr_str);
+/*! Sets an answer section already built in wire format (see
+ *  CDnsDb), with count resource records of the same size. The
+ *  data is not copied until the response is built, starting by
+ *  the record first (round robin) and going on cyclically.
+ */
+void CAnswer::setAnswerSection(const unsigned char *answer, unsigned int length,
+                               unsigned int count, unsigned int first) {
+    m_Data = answer;
+    m_Length = length;
+    m_First = count > 1 ? (first % count) * (length / count) : 0;
 }
 
-/*! Returns values requested by the calling class
+/*! Writes the answer section inside the buffer. It returns the
+ *  number of bytes written or 0 if it does not fit.
  */
-string &CAnswer::getAnswerSection() {
-    m_RRString.erase(0, m_RRString.size());
-    m_RRString = m_RR.getName();
-    m_RRString += m_RR.getType();
-    m_RRString += m_RR.getClass();
-    m_RRString += m_RR.getTTL();
-    m_RRString += m_RR.getRdLength();
-    m_RRString += m_RR.getRData();
+unsigned int CAnswer::getAnswerSection(unsigned char *buffer, unsigned int size) {
+    if (m_Data == NULL) return m_RR.write(buffer, size);
 
-    return m_RRString;
+    // one bounded copy, two if the records are rotated
+    if (m_Length > size) return 0;
+    memcpy(buffer, m_Data + m_First, m_Length - m_First);
+    memcpy(buffer + m_Length - m_First, m_Data, m_First);
+    return m_Length;
 }
 
 // ////////////////////
@@ -79,22 +98,204 @@ string &CAnswer::getAnswerSection() {
 
 // constructor
 CAuthority::CAuthority()
-        : m_Name() {
+        : m_RR(),
+          m_Data(NULL),
+          m_Length(0) {
 }
 
 // destructor
 CAuthority::~CAuthority() {
 }
 
+/*! Clears the resource records to process a new query
+ */
+void CAuthority::reset() {
+    m_RR.reset();
+    m_Data = NULL;
+    m_Length = 0;
+}
+
+/*! Writes a 32-bit field in network order
+ */
+static unsigned char *put32(unsigned char *buffer, unsigned int value) {
+    buffer[0] = (unsigned char) ((value >> 24) & 0xff);
+    buffer[1] = (unsigned char) ((value >> 16) & 0xff);
+    buffer[2] = (unsigned char) ((value >> 8) & 0xff);
+    buffer[3] = (unsigned char) (value & 0xff);
+    return buffer + 4;
+}
+
+/*! Builds the SOA record of a zone. The names are in wire
+ *  format, the owner name is not copied until the record is written.
+ *  The TTL of the record is the minimum field, the time a
+ *  negative answer can be cached (RFC 2308).
+ */
+void CAuthority::setAuthoritySection(const unsigned char *name, unsigned int nameLength,
+                                     const unsigned char *mName, unsigned int mNameLength,
+                                     const unsigned char *rName, unsigned int rNameLength,
+                                     unsigned int serial, unsigned int refresh, unsigned int retry,
+                                     unsigned int expire, unsigned int minimum) {
+    unsigned char rData[CResourceRecord::MAX_RDATA_SIZE];
+    unsigned char *p = rData;
+
+    // MNAME, RNAME and five 32-bit fields (RFC 1035)
+    memcpy(p, mName, mNameLength);
+    p += mNameLength;
+    memcpy(p, rName, rNameLength);
+    p += rNameLength;
+    p = put32(p, serial);
+    p = put32(p, refresh);
+    p = put32(p, retry);
+    p = put32(p, expire);
+    p = put32(p, minimum);
+
+    m_RR.setName(name, nameLength);
+    m_RR.setType(CResourceRecord::SOA);
+    m_RR.setClass(CResourceRecord::IN);
+    m_RR.setTTL(minimum);
+    m_RR.setRdLength((unsigned int) (p - rData));
+    m_RR.setRData(rData, (unsigned int) (p - rData));
+}
+
+/*! Sets an authority section already built in wire format (see
+ *  CDnsDb). The data is not copied until the response is built.
+ */
+void CAuthority::setAuthoritySection(const unsigned char *authority, unsigned int length) {
+    m_Data = authority;
+    m_Length = length;
+}
+
+/*! Writes the authority section inside the buffer. It returns the
+ *  number of bytes written or 0 if it does not fit.
+ */
+unsigned int CAuthority::getAuthoritySection(unsigned char *buffer, unsigned int size) {
+    if (m_Data == NULL) return m_RR.write(buffer, size);
+
+    if (m_Length > size) return 0;
+    memcpy(buffer, m_Data, m_Length);
+    return m_Length;
+}
+
+/*! Writes the authority section inside the message at the given
+ *  offset, with its names compressed against the ones already
+ *  written. It returns the number of bytes written or 0 if it
+ *  does not fit in size bytes.
+ */
+unsigned int CAuthority::getAuthoritySection(unsigned char *message, unsigned int offset, unsigned int size,
+                                             CNameCompressor &names) {
+    unsigned char buffer[CResourceRecord::MAX_NAME_SIZE + 10 + CResourceRecord::MAX_RDATA_SIZE];
+    const unsigned char *data = m_Data;
+    unsigned int index = 0;
+    unsigned int length = 0;
+    unsigned int rdStart;
+    unsigned int n;
+
+    if (data == NULL) {
+        if (m_RR.write(buffer, sizeof(buffer)) == 0) return 0;
+        data = buffer;
+    }
+
+    // Owner
+    n = names.write(offset, size, data);
+    if (n == 0) return 0;
+    length += n;
+    index += wireLength(data);
+
+    // Type, class and TTL, the RdLength changes
+    if (length + 10 > size) return 0;
+    memcpy(message + offset + length, data + index, 8);
+    length += 10;
+    index += 10;
+    rdStart = length;
+
+    // MName and RName
+    for (int i = 0; i < 2; i++) {
+        n = names.write(offset + length, size - length, data + index);
+        if (n == 0) return 0;
+        length += n;
+        index += wireLength(data + index);
+    }
+
+    // Serial, refresh, retry, expire and minimum
+    if (length + 20 > size) return 0;
+    memcpy(message + offset + length, data + index, 20);
+    length += 20;
+
+    message[offset + rdStart - 2] = (unsigned char) (((length - rdStart) >> 8) & 0xff);
+    message[offset + rdStart - 1] = (unsigned char) ((length - rdStart) & 0xff);
+    return length;
+}
+
+/*! Length of an uncompressed wire name, including the 0 label
+ */
+unsigned int CAuthority::wireLength(const unsigned char *name) {
+    unsigned int length = 0;
+
+    while (name[length] != 0) {
+        length += name[length] + 1;
+    }
+    return length + 1;
+}
+
 /////////////////////
 // Class CAdditional
 /////////////////////
 
 // constructor
 CAdditional::CAdditional()
-        : m_Name() {
+        : m_RR(),
+          m_HasOpt(false),
+          m_ExtendedRCode(0) {
 }
 
 // destructor
 CAdditional::~CAdditional() {
 }
+
+/*! Clears the OPT record to process a new query
+ */
+void CAdditional::reset() {
+    m_HasOpt = false;
+    m_ExtendedRCode = 0;
+}
+
+/*! Sets the OPT record of the response: the UDP payload size
+ *  of this server, the upper 8 bits of the response code and the
+ *  DO flag of the query, which is echoed (RFC 3225)
+ */
+void CAdditional::setOpt(unsigned int payloadSize, unsigned int extendedRCode, bool dnssecOk) {
+    static const unsigned char root = 0;
+
+    // The owner is the root, the version is 0
+    // and there are no options
+    m_RR.setName(&root, 1);
+    m_RR.setType(CResourceRecord::OPT);
+    m_RR.setClass(payloadSize);
+    m_RR.setTTL(((extendedRCode & 0xff) << 24) | (dnssecOk ? 0x8000 : 0));
+    m_RR.setRdLength(0);
+    m_HasOpt = true;
+    m_ExtendedRCode = extendedRCode & 0xff;
+}
+
+/*! Returns the length of the additional section, 0 if it is empty
+ */
+unsigned int CAdditional::getLength() {
+    if (!m_HasOpt) return 0;
+
+    return m_RR.getNameLength() + 10 + m_RR.getRdLength();
+}
+
+/*! Writes the additional section inside the buffer. It returns the
+ *  number of bytes written or 0 if it is empty or it does not fit.
+ */
+unsigned int CAdditional::getAdditionalSection(unsigned char *buffer, unsigned int size) {
+    if (!m_HasOpt) return 0;
+
+    return m_RR.write(buffer, size);
+}
+
+/*! Returns the upper 8 bits of the response code, 0 without OPT record
+ */
+unsigned int CAdditional::getExtendedRCode() {
+    return m_HasOpt ? m_ExtendedRCode : 0;
+}
@@ -8,10 +8,11 @@
 *  to answer one query, but currently there is only one
 *  answer section for each query.
 *
-*  A future improvement of the system will be to have
-*  the authority and additional sections filled at some
-*  point. For simple queries, it is not necessary to have
-*  them filled up.
+*  The authority section is only filled for negative
+*  answers, with the SOA record of the database, so the
+*  resolvers can cache them (RFC 2308). The additional
+*  section only carries the OPT record (EDNS0, RFC 6891)
+*  when the query had one.
 *
 *  \version 0.1
 *  \date    11-September-2006
@@ -48,20 +49,36 @@ public:
      */
     ~CAnswer();
 
-    /*! The calling class sets most of the fields, the rest are decided here.
-     * As only internet addresses are taking into account, the length is
-     * 4 by definition.
+    /*! Clears the resource records to process a new query
      */
-    void setAnswerSection(string &name, string &rType, string &rClass, unsigned long addr);
+    void reset();
 
-    /*! Returns values requested by the calling class
+    /*! The calling class sets all the fields, the RData is an address
+     * in network order (4 bytes for A, 16 bytes for AAAA).
      */
-    string &getAnswerSection();
+    void setAnswerSection(const unsigned char *name, unsigned int nameLength,
+                          unsigned int rType, unsigned int rClass, unsigned int ttl,
+                          const unsigned char *rData, unsigned int rdLength);
+
+    /*! Sets an answer section already built in wire format (see
+     *  CDnsDb), with count resource records of the same size. The
+     *  data is not copied until the response is built, starting by
+     *  the record first (round robin) and going on cyclically.
+     */
+    void setAnswerSection(const unsigned char *answer, unsigned int length,
+                          unsigned int count, unsigned int first);
+
+    /*! Writes the answer section inside the buffer. It returns the
+     *  number of bytes written or 0 if it does not fit.
+     */
+    unsigned int getAnswerSection(unsigned char *buffer, unsigned int size);
 
 private:
     // For now, I'll have only one RR
     CResourceRecord m_RR;       /**< Resource Record for the current answer */
-    string m_RRString; /**< String to be returned to upper levels */
+    const unsigned char *m_Data; /**< Answer section already in wire format, NULL if not used */
+    unsigned int m_Length;       /**< Length of the answer section in wire format */
+    unsigned int m_First;        /**< Offset of the first resource record to be written */
 };
 
 
@@ -84,8 +101,47 @@ public:
     // destructor
     ~CAuthority();
 
+    /*! Clears the resource records to process a new query
+     */
+    void reset();
+
+    /*! Builds the SOA record of a zone. The names are in wire
+     *  format, the owner name is not copied until the record is written.
+     *  The TTL of the record is the minimum field, the time a
+     *  negative answer can be cached (RFC 2308).
+     */
+    void setAuthoritySection(const unsigned char *name, unsigned int nameLength,
+                             const unsigned char *mName, unsigned int mNameLength,
+                             const unsigned char *rName, unsigned int rNameLength,
+                             unsigned int serial, unsigned int refresh, unsigned int retry,
+                             unsigned int expire, unsigned int minimum);
+
+    /*! Sets an authority section already built in wire format (see
+     *  CDnsDb). The data is not copied until the response is built.
+     */
+    void setAuthoritySection(const unsigned char *authority, unsigned int length);
+
+    /*! Writes the authority section inside the buffer. It returns the
+     *  number of bytes written or 0 if it does not fit.
+     */
+    unsigned int getAuthoritySection(unsigned char *buffer, unsigned int size);
+
+    /*! Writes the authority section inside the message at the given
+     *  offset, with its names compressed against the ones already
+     *  written. It returns the number of bytes written or 0 if it
+     *  does not fit in size bytes.
+     */
+    unsigned int getAuthoritySection(unsigned char *message, unsigned int offset, unsigned int size,
+                                     CNameCompressor &names);
+
 private:
-    string m_Name;
+    /*! Length of an uncompressed wire name, including the 0 label
+     */
+    static unsigned int wireLength(const unsigned char *name);
+
+    CResourceRecord m_RR;       /**< SOA record being built */
+    const unsigned char *m_Data; /**< Authority section already in wire format, NULL if not used */
+    unsigned int m_Length;       /**< Length of the authority section in wire format */
 };
 
 /////////////////////
@@ -95,7 +151,10 @@ private:
 /*! \class CAdditional
  *  \brief It takes care of all related to additional section handling
  *
- *   Description
+ *   The additional section of a response only carries the OPT
+ *   pseudo record (EDNS0, RFC 6891) when the query had one. Its class
+ *   is the UDP payload size of this server and its TTL carries the
+ *   upper bits of the response code, the version and the flags.
  *
  */
 class CAdditional {
@@ -107,8 +166,35 @@ public:
     // destructor
     ~CAdditional();
 
+    /*! Clears the OPT record to process a new query
+     */
+    void reset();
+
+    /*! Sets the OPT record of the response: the UDP payload size
+     *  of this server, the upper 8 bits of the response code and the
+     *  DO flag of the query, which is echoed (RFC 3225)
+     */
+    void setOpt(unsigned int payloadSize, unsigned int extendedRCode, bool dnssecOk);
+
+    /*! Returns the length of the additional section, 0 if it is empty
+     */
+    unsigned int getLength();
+
+    /*! Writes the additional section inside the buffer. It returns the
+     *  number of bytes written or 0 if it is empty or it does not fit.
+     */
+    unsigned int getAdditionalSection(unsigned char *buffer, unsigned int size);
+
+    /*! Returns the upper 8 bits of the response code, 0 without OPT record
+     */
+    unsigned int getExtendedRCode();
+
+    static const unsigned int MIN_PAYLOAD_SIZE = 512; /**< UDP payload without EDNS0 (RFC 1035) */
+
 private:
-    string m_Name;
+    CResourceRecord m_RR;       /**< OPT record */
+    bool m_HasOpt;              /**< The OPT record is written */
+    unsigned int m_ExtendedRCode; /**< Upper 8 bits of the response code */
 };
 
 #endif
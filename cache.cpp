@@ -0,0 +1,775 @@
+/*!
+*****************************************************************************
+*  \file cache.cpp
+*
+*  \brief   Cache of the responses of the upstream servers
+*
+*  The entries are allocated by the forwarder before taking the lock of
+*  the shard, so the lock is only held to link them. A lookup does not
+*  allocate memory: the records are copied to the buffer of the worker
+*  and the TTLs are fixed there.
+*
+*  A snapshot is a TSnapshotHeader followed by the entries, each one a
+*  TSnapshotEntry followed by its TTL offsets, QName and records, in
+*  the byte order of the machine. It is written one shard at a time,
+*  holding only the lock of that shard while it is copied to a buffer,
+*  to a temporary file that replaces the previous one once complete.
+*  The header has the offset and the number of entries of every shard,
+*  so it is read with mmap by several threads, each one with its own
+*  shards: their entries are linked as they are walked, without any
+*  other copy, and the buckets are sized once for all of them.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#include "cache.h"
+#include "dnsDb.h"
+#include "message.h"
+#include "rr.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <new>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <string>
+
+/*! Lowercase of an ascii character, the rest are not changed
+ */
+static inline unsigned char lower(unsigned char c) {
+    return (unsigned char) ((unsigned char) (c - 'A') < 26 ? c + ('a' - 'A') : c);
+}
+
+/*! Reads a 16-bit field in network order
+ */
+static inline unsigned int get16(const unsigned char *buffer) {
+    return (unsigned int) ((buffer[0] << 8) | buffer[1]);
+}
+
+/*! Reads a 32-bit field in network order
+ */
+static inline unsigned int get32(const unsigned char *buffer) {
+    return ((unsigned int) buffer[0] << 24) | ((unsigned int) buffer[1] << 16) |
+           ((unsigned int) buffer[2] << 8) | (unsigned int) buffer[3];
+}
+
+/*! Writes a 32-bit field in network order
+ */
+static inline void put32(unsigned char *buffer, unsigned int value) {
+    buffer[0] = (unsigned char) (value >> 24);
+    buffer[1] = (unsigned char) (value >> 16);
+    buffer[2] = (unsigned char) (value >> 8);
+    buffer[3] = (unsigned char) value;
+}
+
+const char CCache::SNAPSHOT_MAGIC[8] = {'D', 'N', 'S', 'D', 'C', 'A', 'C', 'H'};
+
+/*! Writes a whole buffer to a file. It returns true on error
+ */
+static bool writeAll(int fd, const unsigned char *buffer, unsigned long length) {
+    while (length > 0) {
+        ssize_t n = write(fd, buffer, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return true;
+        }
+        buffer += n;
+        length -= (unsigned long) n;
+    }
+    return false;
+}
+
+/*! Constructor. The entries use up to maxBytes of memory
+ */
+CCache::CCache(unsigned long maxBytes)
+        : m_ShardBytes(maxBytes / SHARDS),
+          m_Prefetch(0),
+          m_ServeStale(0) {
+    for (unsigned int i = 0; i < SHARDS; i++) {
+        TShard *shard = new TShard();
+
+        pthread_mutex_init(&shard->m_Lock, NULL);
+        shard->m_Buckets.assign(MIN_BUCKETS, (TEntry *) NULL);
+        shard->m_Hand = 0;
+        shard->m_Bytes = 0;
+        memset(&shard->m_Counters, 0, sizeof(shard->m_Counters));
+        m_Shards[i] = shard;
+    }
+}
+
+/*! Destructor
+ */
+CCache::~CCache() {
+    for (unsigned int i = 0; i < SHARDS; i++) {
+        TShard *shard = m_Shards[i];
+
+        while (!shard->m_Clock.empty()) {
+            remove(*shard, shard->m_Clock.back());
+        }
+        pthread_mutex_destroy(&shard->m_Lock);
+        delete shard;
+    }
+}
+
+/*! A hit in the last percent of the TTL of an entry asks for
+ *  its refresh. 0 (by default) disables it
+ */
+void CCache::setPrefetch(unsigned int percent) {
+    m_Prefetch = percent;
+}
+
+/*! The entries are served for seconds more after they expire,
+ *  while they are refreshed. 0 (by default) disables it
+ */
+void CCache::setServeStale(unsigned int seconds) {
+    m_ServeStale = seconds;
+}
+
+/*! Parses a response of an upstream server: the records after the
+ *  question, their counters, the response code and the time they
+ *  can be kept (0 if they cannot). The OPT record is left out. It
+ *  returns true if the response is not valid
+ */
+bool CCache::parseResponse(const unsigned char *response, unsigned long length, TAnswer &answer) {
+    unsigned long offset = CMessage::HEADER_SIZE;
+    unsigned long start;
+    unsigned int total;
+    unsigned int minTtl = MAX_TTL;
+    unsigned int negativeTtl = 0;
+    bool hasSoa = false;
+
+    answer.m_TtlOffsets.clear();
+    if (length < CMessage::HEADER_SIZE) return true;
+
+    // a whole response to a standard query, with one question
+    if ((response[2] & 0x80) == 0 || (response[2] & 0x78) != 0) return true;
+    if (response[2] & 0x02) return true;
+    if (get16(response + 4) != 1) return true;
+
+    answer.m_RCode = response[3] & 0x0f;
+    answer.m_AnCount = get16(response + 6);
+    answer.m_NsCount = get16(response + 8);
+    answer.m_ArCount = get16(response + 10);
+    total = answer.m_AnCount + answer.m_NsCount + answer.m_ArCount;
+
+    // the question, its name is never compressed
+    while (offset < length && response[offset] != 0) {
+        if (response[offset] & 0xc0) return true;
+        offset += response[offset] + 1;
+    }
+    offset += 1 + 4;
+    if (offset > length) return true;
+    start = offset;
+
+    for (unsigned int i = 0; i < total; i++) {
+        unsigned long record = offset;
+        unsigned int type;
+        unsigned int ttl;
+        unsigned int rdLength;
+
+        // owner, the pointers only go backwards
+        while (1) {
+            if (offset >= length) return true;
+            unsigned char c = response[offset];
+            if ((c & 0xc0) == 0xc0) {
+                if (offset + 2 > length) return true;
+                if ((((c & 0x3f) << 8) | response[offset + 1]) >= record) return true;
+                offset += 2;
+                break;
+            }
+            if (c & 0xc0) return true;
+            offset += c + 1;
+            if (c == 0) break;
+        }
+
+        // type, class, TTL and RData
+        if (offset + 10 > length) return true;
+        type = get16(response + offset);
+        ttl = get32(response + offset + 4);
+        rdLength = get16(response + offset + 8);
+        if (offset + 10 + rdLength > length) return true;
+
+        if (type == CResourceRecord::OPT) {
+            // only the last one of the additional section, which
+            // is written again for the client. The upper bits of
+            // the response code must be 0
+            if (i != total - 1 || i < answer.m_AnCount + answer.m_NsCount) return true;
+            if ((ttl >> 24) != 0) return true;
+            answer.m_ArCount--;
+            offset = record;
+            break;
+        }
+
+        // a TTL with the upper bit set is 0 (RFC 2181)
+        if (ttl > 0x7fffffff) ttl = 0;
+        if (ttl < minTtl) minTtl = ttl;
+        if (offset + 4 - start > 0xffff) return true;
+        answer.m_TtlOffsets.push_back((uint16_t) (offset + 4 - start));
+
+        // the SOA of a negative answer: its minimum field
+        // limits the time it can be kept (RFC 2308)
+        if (type == CResourceRecord::SOA && i >= answer.m_AnCount && i < answer.m_AnCount + answer.m_NsCount &&
+            rdLength >= 20) {
+            unsigned int minimum = get32(response + offset + 10 + rdLength - 4);
+            unsigned int soaTtl = ttl < minimum ? ttl : minimum;
+            if (!hasSoa || soaTtl < negativeTtl) negativeTtl = soaTtl;
+            hasSoa = true;
+        }
+        offset += 10 + rdLength;
+    }
+    if (offset - start > MAX_RECORDS_SIZE) return true;
+
+    answer.m_Records = response + start;
+    answer.m_Length = (unsigned int) (offset - start);
+
+    // only the positive answers and the negative ones with
+    // a SOA can be kept, the errors are asked again
+    answer.m_Ttl = 0;
+    if (answer.m_RCode == CHeader::NO_ERROR && answer.m_AnCount > 0) {
+        answer.m_Ttl = minTtl;
+    } else if ((answer.m_RCode == CHeader::NO_ERROR || answer.m_RCode == CHeader::NAME_ERROR) && hasSoa) {
+        answer.m_Ttl = negativeTtl < minTtl ? negativeTtl : minTtl;
+        if (answer.m_Ttl > MAX_NEGATIVE_TTL) answer.m_Ttl = MAX_NEGATIVE_TTL;
+    }
+    return false;
+}
+
+/*! Keeps the records of a response, parsed by parseResponse, for
+ *  the given question (QName in wire format, type and class). It
+ *  replaces the previous entry of the question, if any
+ */
+void CCache::insert(const unsigned char *qname, unsigned int length, unsigned int qtype, unsigned int qclass,
+                    const TAnswer &answer) {
+    unsigned int ttlCount = (unsigned int) answer.m_TtlOffsets.size();
+    time_t current = now();
+
+    if (answer.m_Ttl == 0 || answer.m_Length > MAX_RECORDS_SIZE) return;
+
+    // the entry is built before taking the lock
+    TEntry *entry = createEntry(qname, length, qtype, qclass,
+                                ttlCount > 0 ? (const unsigned char *) &answer.m_TtlOffsets[0] : NULL, ttlCount,
+                                answer.m_Records, answer.m_Length, NULL);
+    if (entry == NULL) return;
+    entry->m_Inserted = current;
+    entry->m_Expire = current + (answer.m_Ttl < MAX_TTL ? answer.m_Ttl : MAX_TTL);
+    entry->m_AnCount = answer.m_AnCount;
+    entry->m_NsCount = answer.m_NsCount;
+    entry->m_ArCount = answer.m_ArCount;
+    entry->m_RCode = answer.m_RCode;
+
+    TShard &shard = getShard(entry->m_Hash);
+    pthread_mutex_lock(&shard.m_Lock);
+    link(shard, entry, current, true);
+    pthread_mutex_unlock(&shard.m_Lock);
+}
+
+/*! Looks for the records of a question. If they are found and
+ *  they have not expired (or are inside the stale window), they are
+ *  copied inside the buffer (size bytes) with their TTLs decreased,
+ *  and the answer points to them. It returns REFRESH if the question
+ *  must be asked again to the upstream servers too
+ */
+CCache::TLookup CCache::lookup(const unsigned char *qname, unsigned int length, unsigned int qtype,
+                               unsigned int qclass, unsigned char *buffer, unsigned int size, TAnswer &answer) {
+    uint64_t hash = hashQuestion(qname, length, qtype, qclass);
+    TShard &shard = getShard(hash);
+    time_t current = now();
+    TLookup result = HIT;
+
+    pthread_mutex_lock(&shard.m_Lock);
+    TEntry *entry = find(shard, hash, qname, length, qtype, qclass);
+    if (entry == NULL || entry->m_Expire + m_ServeStale <= current || entry->m_Length > size) {
+        shard.m_Counters.m_Misses++;
+        pthread_mutex_unlock(&shard.m_Lock);
+        return MISS;
+    }
+
+    // the records as they came, with the time they have been here
+    // taken from their TTLs (all of them are longer than that). A
+    // stale answer is only good for a short while (RFC 8767)
+    bool stale = entry->m_Expire <= current;
+    unsigned int elapsed = (unsigned int) (current - entry->m_Inserted);
+    memcpy(buffer, entry->m_Records, entry->m_Length);
+    for (unsigned int i = 0; i < entry->m_TtlCount; i++) {
+        unsigned char *ttl = buffer + entry->m_TtlOffsets[i];
+        unsigned int value = get32(ttl);
+        put32(ttl, stale ? STALE_TTL : (value > elapsed ? value - elapsed : 0));
+    }
+    entry->m_Referenced = true;
+
+    // a stale entry, or one in the last part of its TTL, is asked
+    // again by the first client; the next ones do not wait for it
+    time_t window = (entry->m_Expire - entry->m_Inserted) * m_Prefetch / 100;
+    if ((stale || (window > 0 && entry->m_Expire - window <= current)) && entry->m_RefreshAfter <= current) {
+        entry->m_RefreshAfter = current + REFRESH_HOLD;
+        result = REFRESH;
+        if (!stale) shard.m_Counters.m_Prefetches++;
+    }
+    if (stale) {
+        shard.m_Counters.m_StaleHits++;
+    } else {
+        shard.m_Counters.m_Hits++;
+    }
+
+    answer.m_Records = buffer;
+    answer.m_Length = entry->m_Length;
+    answer.m_AnCount = entry->m_AnCount;
+    answer.m_NsCount = entry->m_NsCount;
+    answer.m_ArCount = entry->m_ArCount;
+    answer.m_RCode = entry->m_RCode;
+    answer.m_Ttl = stale ? STALE_TTL : (unsigned int) (entry->m_Expire - current);
+    pthread_mutex_unlock(&shard.m_Lock);
+    return result;
+}
+
+/*! Writes all the entries, but the expired ones, to a snapshot
+ *  file. It returns true on error
+ */
+bool CCache::save(const char *file) const {
+    string temporary = string(file) + ".tmp";
+    vector<unsigned char> buffer;
+    TSnapshotHeader header;
+    bool error = false;
+    time_t current = now();
+
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return true;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.m_Magic, SNAPSHOT_MAGIC, sizeof(header.m_Magic));
+    header.m_Version = SNAPSHOT_VERSION;
+    header.m_Time = (int64_t) time(NULL);
+    buffer.insert(buffer.end(), (unsigned char *) &header, (unsigned char *) &header + sizeof(header));
+    uint64_t offset = 0;
+
+    for (unsigned int i = 0; i < SHARDS && !error; i++) {
+        TShard &shard = *m_Shards[i];
+
+        // the shard is copied, and written without its lock
+        header.m_ShardOffsets[i] = offset + buffer.size();
+        pthread_mutex_lock(&shard.m_Lock);
+        for (unsigned long j = 0; j < shard.m_Clock.size(); j++) {
+            const TEntry *entry = shard.m_Clock[j];
+            TSnapshotEntry record;
+
+            if (entry->m_Expire + m_ServeStale <= current) continue;
+            memset(&record, 0, sizeof(record));
+            record.m_Expire = (int32_t) (entry->m_Expire - current);
+            record.m_Age = (uint32_t) (current - entry->m_Inserted);
+            record.m_Length = entry->m_Length;
+            record.m_QType = (uint16_t) entry->m_QType;
+            record.m_QClass = (uint16_t) entry->m_QClass;
+            record.m_AnCount = (uint16_t) entry->m_AnCount;
+            record.m_NsCount = (uint16_t) entry->m_NsCount;
+            record.m_ArCount = (uint16_t) entry->m_ArCount;
+            record.m_TtlCount = (uint16_t) entry->m_TtlCount;
+            record.m_RCode = (uint8_t) entry->m_RCode;
+            record.m_NameLength = (uint8_t) entry->m_NameLength;
+            buffer.insert(buffer.end(), (unsigned char *) &record, (unsigned char *) &record + sizeof(record));
+            // TTL offsets, QName and records are together
+            buffer.insert(buffer.end(), entry->m_Data, entry->m_Records + entry->m_Length);
+            header.m_ShardEntries[i]++;
+        }
+        pthread_mutex_unlock(&shard.m_Lock);
+
+        if (!buffer.empty()) error = writeAll(fd, &buffer[0], buffer.size());
+        offset += buffer.size();
+        buffer.clear();
+    }
+
+    // the entries of every shard are only known at the end
+    if (!error) {
+        error = pwrite(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) || fsync(fd) < 0;
+    }
+    if (close(fd) < 0) error = true;
+    if (!error) error = rename(temporary.c_str(), file) < 0;
+    if (error) unlink(temporary.c_str());
+    return error;
+}
+
+/*! Reads the entries of a snapshot file written by save. Their
+ *  times go on from the time of the snapshot, the ones that have
+ *  expired meanwhile are left out. A missing file is not an error,
+ *  it returns true if the file is not valid
+ */
+bool CCache::load(const char *file) {
+    struct stat st;
+    TSnapshotHeader header;
+    bool error = false;
+
+    int fd = ::open(file, O_RDONLY);
+    if (fd < 0) return errno != ENOENT;
+    if (fstat(fd, &st) < 0 || (unsigned long) st.st_size < sizeof(header)) {
+        close(fd);
+        return true;
+    }
+    unsigned long size = (unsigned long) st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return true;
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.m_Magic, SNAPSHOT_MAGIC, sizeof(header.m_Magic)) != 0 ||
+        header.m_Version != SNAPSHOT_VERSION) {
+        munmap(map, size);
+        return true;
+    }
+
+    // the shards are loaded in parallel, every loader takes
+    // its own ones and never waits for the lock of a shard
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int loaders = processors < 1 ? 1 : (processors < LOADERS ? (unsigned int) processors : LOADERS);
+    vector<TLoader> loader(loaders);
+    vector<pthread_t> threads(loaders);
+    int64_t stopped = (int64_t) time(NULL) - header.m_Time;
+
+    for (unsigned int i = 0; i < loaders; i++) {
+        loader[i].m_Cache = this;
+        loader[i].m_Data = (const unsigned char *) map;
+        loader[i].m_Size = size;
+        loader[i].m_Header = &header;
+        // the time the daemon has been stopped
+        loader[i].m_Stopped = stopped > 0 ? stopped : 0;
+        loader[i].m_Current = now();
+        loader[i].m_First = i;
+        loader[i].m_Step = loaders;
+        loader[i].m_Error = false;
+        if (i > 0 && pthread_create(&threads[i], NULL, loaderThread, &loader[i]) != 0) {
+            // this thread does its part
+            loaderThread(&loader[i]);
+            threads[i] = 0;
+        }
+    }
+    loaderThread(&loader[0]);
+    for (unsigned int i = 0; i < loaders; i++) {
+        if (i > 0 && threads[i] != 0) pthread_join(threads[i], NULL);
+        error = error || loader[i].m_Error;
+    }
+
+    munmap(map, size);
+    return error;
+}
+
+/*! Returns the counters of all the shards added together
+ */
+void CCache::getCounters(TCounters &counters) const {
+    memset(&counters, 0, sizeof(counters));
+    for (unsigned int i = 0; i < SHARDS; i++) {
+        TShard &shard = *m_Shards[i];
+
+        pthread_mutex_lock(&shard.m_Lock);
+        counters.m_Entries += shard.m_Clock.size();
+        counters.m_Bytes += shard.m_Bytes;
+        counters.m_Hits += shard.m_Counters.m_Hits;
+        counters.m_Misses += shard.m_Counters.m_Misses;
+        counters.m_Inserts += shard.m_Counters.m_Inserts;
+        counters.m_Evictions += shard.m_Counters.m_Evictions;
+        counters.m_Prefetches += shard.m_Counters.m_Prefetches;
+        counters.m_StaleHits += shard.m_Counters.m_StaleHits;
+        pthread_mutex_unlock(&shard.m_Lock);
+    }
+}
+
+/*! Hash of a question
+ */
+uint64_t CCache::hashQuestion(const unsigned char *qname, unsigned int length, unsigned int qtype,
+                              unsigned int qclass) {
+    uint64_t hash = CDnsDb::hashName(qname, length);
+
+    hash ^= ((uint64_t) qtype << 16) | qclass;
+    hash *= 1099511628211ULL;
+    // the upper bits choose the shard, they must depend on everything
+    return hash ^ (hash >> 29);
+}
+
+/*! Returns the shard of a hash
+ */
+CCache::TShard &CCache::getShard(uint64_t hash) const {
+    return *m_Shards[hash >> 58];
+}
+
+/*! Memory of an entry with its data
+ */
+unsigned long CCache::entrySize(unsigned int length, unsigned int ttlCount, unsigned int recordsLength) {
+    unsigned long size = sizeof(TEntry) + ttlCount * sizeof(uint16_t) + length + recordsLength;
+
+    // the next entry of a block is aligned too
+    return (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+}
+
+/*! Allocates an entry with a copy of its question, TTL offsets
+ *  (in the byte order of the machine) and records, alone or inside
+ *  a block if it is not NULL. The rest of its members are set by
+ *  the caller. NULL if it does not fit in a shard
+ */
+CCache::TEntry *CCache::createEntry(const unsigned char *qname, unsigned int length, unsigned int qtype,
+                                    unsigned int qclass, const unsigned char *ttlOffsets, unsigned int ttlCount,
+                                    const unsigned char *records, unsigned int recordsLength, TBlock *block) const {
+    unsigned long size = entrySize(length, ttlCount, recordsLength);
+    unsigned char *memory;
+
+    if (size > m_ShardBytes) return NULL;
+
+    // one piece of memory: the entry and then its data
+    if (block != NULL) {
+        memory = (unsigned char *) block + block->m_Used;
+        block->m_Used += size;
+        block->m_Entries++;
+    } else {
+        memory = new unsigned char[size];
+    }
+    TEntry *entry = new (memory) TEntry();
+    entry->m_Next = NULL;
+    entry->m_Hash = hashQuestion(qname, length, qtype, qclass);
+    entry->m_RefreshAfter = 0;
+    entry->m_Data = memory + sizeof(TEntry);
+    entry->m_TtlOffsets = (uint16_t *) entry->m_Data;
+    entry->m_QName = entry->m_Data + ttlCount * sizeof(uint16_t);
+    entry->m_Records = entry->m_QName + length;
+    entry->m_TtlCount = ttlCount;
+    entry->m_NameLength = length;
+    entry->m_Length = recordsLength;
+    entry->m_QType = qtype;
+    entry->m_QClass = qclass;
+    entry->m_Size = size;
+    entry->m_Slot = 0;
+    entry->m_Block = block;
+    entry->m_Referenced = false;
+    if (ttlCount > 0) memcpy(entry->m_TtlOffsets, ttlOffsets, ttlCount * sizeof(uint16_t));
+    for (unsigned int i = 0; i < length; i++) {
+        entry->m_QName[i] = lower(qname[i]);
+    }
+    memcpy(entry->m_Records, records, recordsLength);
+    return entry;
+}
+
+/*! Links a new entry in its shard, whose lock is held, in place of
+ *  the previous entry of its question if replace is set
+ */
+void CCache::link(TShard &shard, TEntry *entry, time_t current, bool replace) {
+    if (replace) {
+        TEntry *old = find(shard, entry->m_Hash, entry->m_QName, entry->m_NameLength, entry->m_QType,
+                           entry->m_QClass);
+        if (old != NULL) remove(shard, old);
+    }
+    makeRoom(shard, entry->m_Size, current);
+
+    TEntry *&bucket = shard.m_Buckets[entry->m_Hash & (shard.m_Buckets.size() - 1)];
+    entry->m_Next = bucket;
+    bucket = entry;
+    entry->m_Slot = shard.m_Clock.size();
+    shard.m_Clock.push_back(entry);
+    shard.m_Bytes += entry->m_Size;
+    shard.m_Counters.m_Inserts++;
+    if (shard.m_Clock.size() > shard.m_Buckets.size()) grow(shard);
+}
+
+/*! Thread entry point of a loader of a snapshot
+ */
+void *CCache::loaderThread(void *arg) {
+    TLoader *loader = (TLoader *) arg;
+
+    for (unsigned int i = loader->m_First; i < SHARDS && !loader->m_Error; i += loader->m_Step) {
+        loader->m_Error = loader->m_Cache->loadShard(*loader, i);
+    }
+    return NULL;
+}
+
+/*! Links the entries of a shard of a snapshot. It returns true if
+ *  they are not valid
+ */
+bool CCache::loadShard(const TLoader &loader, unsigned int index) {
+    const unsigned char *data = loader.m_Data;
+    unsigned long size = loader.m_Size;
+    unsigned long start = loader.m_Header->m_ShardOffsets[index];
+    uint64_t entries = loader.m_Header->m_ShardEntries[index];
+    TShard &shard = *m_Shards[index];
+    unsigned long blockSize = sizeof(TBlock);
+    unsigned long offset = start;
+    TSnapshotEntry record;
+
+    if (entries == 0) return false;
+    if (start < sizeof(TSnapshotHeader) || start > size) return true;
+    // checked before the buckets are sized for them: a corrupted
+    // count must not become a huge allocation
+    if (entries > (size - start) / sizeof(TSnapshotEntry)) return true;
+
+    // every record is checked first, without the lock, and the
+    // memory of the ones still valid is added up for one block
+    for (uint64_t i = 0; i < entries; i++) {
+        if (size - offset < sizeof(record)) return true;
+        memcpy(&record, data + offset, sizeof(record));
+        offset += sizeof(record);
+
+        unsigned long offsets = record.m_TtlCount * sizeof(uint16_t);
+        if (record.m_NameLength == 0 || record.m_Length > MAX_RECORDS_SIZE ||
+            size - offset < offsets + record.m_NameLength + record.m_Length) {
+            return true;
+        }
+        // every TTL must be inside the records
+        for (unsigned int j = 0; j < record.m_TtlCount; j++) {
+            uint16_t ttl;
+            memcpy(&ttl, data + offset + j * sizeof(uint16_t), sizeof(ttl));
+            if ((unsigned long) ttl + 4 > record.m_Length) return true;
+        }
+        offset += offsets + record.m_NameLength + record.m_Length;
+
+        if ((int64_t) record.m_Expire - loader.m_Stopped + (int64_t) m_ServeStale > 0) {
+            blockSize += entrySize(record.m_NameLength, record.m_TtlCount, record.m_Length);
+        }
+    }
+
+    // all the entries in one mapping, with huge pages where the
+    // kernel gives them: no allocation and few page faults per
+    // entry. Without it they are allocated one by one
+    TBlock *block = (TBlock *) mmap(NULL, blockSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) {
+        block = NULL;
+    } else {
+        madvise(block, blockSize, MADV_HUGEPAGE);
+        block->m_Size = blockSize;
+        block->m_Used = sizeof(TBlock);
+        // the loader keeps it until the end
+        block->m_Entries = 1;
+    }
+
+    // room for all of them at once, the buckets are not doubled
+    // again and again. An empty shard has no entries to replace
+    pthread_mutex_lock(&shard.m_Lock);
+    while (shard.m_Buckets.size() < entries) grow(shard);
+    shard.m_Clock.reserve(shard.m_Clock.size() + entries);
+    bool replace = !shard.m_Clock.empty();
+
+    offset = start;
+    for (uint64_t i = 0; i < entries; i++) {
+        memcpy(&record, data + offset, sizeof(record));
+        offset += sizeof(record);
+
+        const unsigned char *ttlOffsets = data + offset;
+        const unsigned char *qname = ttlOffsets + record.m_TtlCount * sizeof(uint16_t);
+        const unsigned char *records = qname + record.m_NameLength;
+        offset += record.m_TtlCount * sizeof(uint16_t) + record.m_NameLength + record.m_Length;
+
+        int64_t left = (int64_t) record.m_Expire - loader.m_Stopped;
+        if (left + (int64_t) m_ServeStale <= 0) continue;
+
+        TEntry *entry = createEntry(qname, record.m_NameLength, record.m_QType, record.m_QClass, ttlOffsets,
+                                    record.m_TtlCount, records, record.m_Length, block);
+        if (entry == NULL) continue;
+        entry->m_Inserted = loader.m_Current - (time_t) (record.m_Age + loader.m_Stopped);
+        entry->m_Expire = loader.m_Current + (time_t) left;
+        entry->m_AnCount = record.m_AnCount;
+        entry->m_NsCount = record.m_NsCount;
+        entry->m_ArCount = record.m_ArCount;
+        entry->m_RCode = record.m_RCode;
+        // another shard if the hash has changed since the snapshot
+        if (&getShard(entry->m_Hash) == &shard) {
+            link(shard, entry, loader.m_Current, replace);
+        } else {
+            freeEntry(entry);
+        }
+    }
+    if (block != NULL && --block->m_Entries == 0) munmap(block, blockSize);
+    pthread_mutex_unlock(&shard.m_Lock);
+    return false;
+}
+
+/*! Finds the entry of a question inside a shard, NULL if it is not there
+ */
+CCache::TEntry *CCache::find(TShard &shard, uint64_t hash, const unsigned char *qname, unsigned int length,
+                             unsigned int qtype, unsigned int qclass) {
+    TEntry *entry = shard.m_Buckets[hash & (shard.m_Buckets.size() - 1)];
+
+    for (; entry != NULL; entry = entry->m_Next) {
+        if (entry->m_Hash != hash || entry->m_QType != qtype || entry->m_QClass != qclass ||
+            entry->m_NameLength != length) {
+            continue;
+        }
+        unsigned int i = 0;
+        while (i < length && entry->m_QName[i] == lower(qname[i])) i++;
+        if (i == length) return entry;
+    }
+    return NULL;
+}
+
+/*! Takes an entry out of its shard and frees it
+ */
+void CCache::remove(TShard &shard, TEntry *entry) {
+    TEntry **link = &shard.m_Buckets[entry->m_Hash & (shard.m_Buckets.size() - 1)];
+
+    while (*link != entry) link = &(*link)->m_Next;
+    *link = entry->m_Next;
+
+    // the last one of the clock takes its place
+    TEntry *last = shard.m_Clock.back();
+    shard.m_Clock[entry->m_Slot] = last;
+    last->m_Slot = entry->m_Slot;
+    shard.m_Clock.pop_back();
+    if (shard.m_Hand >= shard.m_Clock.size()) shard.m_Hand = 0;
+
+    shard.m_Bytes -= entry->m_Size;
+    freeEntry(entry);
+}
+
+/*! Frees an entry, and its block with the last entry of the
+ *  block. The lock of its shard must be held
+ */
+void CCache::freeEntry(TEntry *entry) {
+    TBlock *block = entry->m_Block;
+
+    if (block == NULL) {
+        delete[] (unsigned char *) entry;
+    } else if (--block->m_Entries == 0) {
+        munmap(block, block->m_Size);
+    }
+}
+
+/*! Evicts entries until there is room for size more bytes
+ */
+void CCache::makeRoom(TShard &shard, unsigned long size, time_t now) {
+    while (shard.m_Bytes + size > m_ShardBytes && !shard.m_Clock.empty()) {
+        TEntry *entry = shard.m_Clock[shard.m_Hand];
+
+        // a second chance for the entries hit since the last pass
+        if (entry->m_Referenced && entry->m_Expire + m_ServeStale > now) {
+            entry->m_Referenced = false;
+            shard.m_Hand = (shard.m_Hand + 1) % shard.m_Clock.size();
+            continue;
+        }
+        remove(shard, entry);
+        shard.m_Counters.m_Evictions++;
+    }
+}
+
+/*! Doubles the buckets of a shard
+ */
+void CCache::grow(TShard &shard) {
+    vector<TEntry *> buckets(shard.m_Buckets.size() * 2, (TEntry *) NULL);
+
+    for (unsigned long i = 0; i < shard.m_Clock.size(); i++) {
+        TEntry *entry = shard.m_Clock[i];
+        TEntry *&bucket = buckets[entry->m_Hash & (buckets.size() - 1)];
+
+        entry->m_Next = bucket;
+        bucket = entry;
+    }
+    shard.m_Buckets.swap(buckets);
+}
+
+/*! Current time in seconds (monotonic)
+ */
+time_t CCache::now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
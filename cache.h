@@ -0,0 +1,334 @@
+/*!
+*****************************************************************************
+*  \file cache.h
+*
+*  \brief   Cache of the responses of the upstream servers
+*
+*  The names that are not in the database are asked to the upstream
+*  servers (see CForwarder), and their responses are kept here, so the
+*  next queries of the same name, type and class are answered from
+*  memory by the workers.
+*
+*  An entry keeps the resource records of a response (answer, authority
+*  and additional sections, without the OPT record) as they came, in
+*  wire format. Their names can be compressed against the question: a
+*  response built from the entry has the same question, so the pointers
+*  are still right. The TTLs are decreased by the time the entry has
+*  been in the cache when it is read.
+*
+*  An entry expires with the smallest TTL of its records, or with the
+*  SOA of a negative answer (RFC 2308). The TTLs are limited to MAX_TTL
+*  (MAX_NEGATIVE_TTL for the negative answers), and a response with a
+*  TTL of 0 is not kept.
+*
+*  The cache is split in SHARDS shards by the hash of the key, every
+*  one with its own lock, hash table and share of the memory, so the
+*  workers seldom wait for each other. When a shard is full, the
+*  entries are evicted with the CLOCK algorithm: a hit marks the entry,
+*  and the hand spares the marked entries once (clearing the mark) and
+*  evicts the first one that is not marked, or that has expired.
+*
+*  A popular entry is refreshed before it expires: a hit in the last
+*  part of its TTL (setPrefetch) tells the worker to answer from the
+*  cache and to forward the query too, without a client, so the new
+*  response replaces the entry before anyone misses it. With a stale
+*  window (setServeStale, RFC 8767) an expired entry is kept for that
+*  long: it is served at once with a TTL of STALE_TTL and refreshed the
+*  same way. A refresh is asked once every REFRESH_HOLD seconds at most,
+*  so an upstream that fails is not flooded while the entry is served.
+*
+*  The entries can be saved to a snapshot file and loaded when the
+*  daemon starts again, so a restart does not begin with a cold cache
+*  that sends every query to the upstream servers. The time the daemon
+*  has been stopped is taken from the TTLs, as if it had kept running.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <vector>
+#include <ctime>
+#include <stdint.h>
+#include <pthread.h>
+
+/*! \class CCache
+ *  \brief It keeps the responses of the upstream servers
+ *
+ *   CCache is shared by all the workers and the forwarder. The
+ *   forwarder inserts the responses, parsed by parseResponse, and
+ *   the workers look them up with the QName of their queries.
+ *
+ */
+using namespace std;
+
+class CCache {
+public:
+    /*! Resource records of a response, in wire format
+     */
+    struct TAnswer {
+        const unsigned char *m_Records; /**< Records after the question */
+        unsigned int m_Length;          /**< Bytes of the records */
+        unsigned int m_AnCount;         /**< Records of the answer section */
+        unsigned int m_NsCount;         /**< Records of the authority section */
+        unsigned int m_ArCount;         /**< Records of the additional section */
+        unsigned int m_RCode;           /**< Response code */
+        unsigned int m_Ttl;             /**< Seconds it can be kept */
+        vector<uint16_t> m_TtlOffsets;  /**< Offset of the TTL of every record */
+    };
+
+    /*! Result of a lookup
+     */
+    enum TLookup {
+        MISS,     /**< not found, or expired */
+        HIT,      /**< found */
+        REFRESH   /**< found, but it must be asked again (prefetch or stale) */
+    };
+
+    /*! Counters of the cache
+     */
+    struct TCounters {
+        uint64_t m_Entries;    /**< Entries kept */
+        uint64_t m_Bytes;      /**< Memory used by the entries */
+        uint64_t m_Hits;       /**< Lookups answered */
+        uint64_t m_Misses;     /**< Lookups not found or expired */
+        uint64_t m_Inserts;    /**< Entries inserted */
+        uint64_t m_Evictions;  /**< Entries evicted to make room */
+        uint64_t m_Prefetches; /**< Hits that asked for a refresh before the expiration */
+        uint64_t m_StaleHits;  /**< Lookups answered with an expired entry */
+    };
+
+    /*! Constructor. The entries use up to maxBytes of memory
+     */
+    CCache(unsigned long maxBytes);
+
+    /*! Destructor
+     */
+    ~CCache();
+
+    /*! A hit in the last percent of the TTL of an entry asks for
+     *  its refresh. 0 (by default) disables it
+     */
+    void setPrefetch(unsigned int percent);
+
+    /*! The entries are served for seconds more after they expire,
+     *  while they are refreshed. 0 (by default) disables it
+     */
+    void setServeStale(unsigned int seconds);
+
+    /*! Parses a response of an upstream server: the records after the
+     *  question, their counters, the response code and the time they
+     *  can be kept (0 if they cannot). The OPT record is left out. It
+     *  returns true if the response is not valid
+     */
+    static bool parseResponse(const unsigned char *response, unsigned long length, TAnswer &answer);
+
+    /*! Keeps the records of a response, parsed by parseResponse, for
+     *  the given question (QName in wire format, type and class). It
+     *  replaces the previous entry of the question, if any
+     */
+    void insert(const unsigned char *qname, unsigned int length, unsigned int qtype, unsigned int qclass,
+                const TAnswer &answer);
+
+    /*! Looks for the records of a question. If they are found and
+     *  they have not expired (or are inside the stale window), they are
+     *  copied inside the buffer (size bytes) with their TTLs decreased,
+     *  and the answer points to them. It returns REFRESH if the question
+     *  must be asked again to the upstream servers too
+     */
+    TLookup lookup(const unsigned char *qname, unsigned int length, unsigned int qtype, unsigned int qclass,
+                unsigned char *buffer, unsigned int size, TAnswer &answer);
+
+    /*! Writes all the entries, but the expired ones, to a snapshot
+     *  file. It returns true on error
+     */
+    bool save(const char *file) const;
+
+    /*! Reads the entries of a snapshot file written by save. Their
+     *  times go on from the time of the snapshot, the ones that have
+     *  expired meanwhile are left out. A missing file is not an error,
+     *  it returns true if the file is not valid
+     */
+    bool load(const char *file);
+
+    /*! Returns the counters of all the shards added together
+     */
+    void getCounters(TCounters &counters) const;
+
+    static const unsigned int SHARDS = 64;            /**< Number of shards, a power of 2 */
+    static const unsigned int MAX_TTL = 86400;        /**< Max time an entry is kept */
+    static const unsigned int MAX_NEGATIVE_TTL = 10800; /**< Max time a negative answer is kept (RFC 2308) */
+    static const unsigned int MAX_RECORDS_SIZE = 65535; /**< Max bytes of the records of an entry */
+    static const unsigned int STALE_TTL = 30;         /**< TTL of the records of a stale answer (RFC 8767) */
+    static const unsigned int REFRESH_HOLD = 30;      /**< Min seconds between the refreshes of an entry */
+
+private:
+    /*! Memory of the entries of a shard loaded from a snapshot, all of
+     *  them inside one mapping that is unmapped with the last one
+     */
+    struct TBlock {
+        unsigned long m_Size;     /**< Bytes of the mapping */
+        unsigned long m_Used;     /**< Bytes taken, this header included */
+        unsigned long m_Entries;  /**< Entries still inside, one more while it is loaded */
+    };
+
+    /*! Entry of the cache
+     */
+    struct TEntry {
+        TEntry *m_Next;           /**< Next entry of the same bucket */
+        uint64_t m_Hash;          /**< Hash of the question */
+        time_t m_Inserted;        /**< Time of the insertion (seconds, monotonic) */
+        time_t m_Expire;          /**< Time it expires (seconds, monotonic) */
+        time_t m_RefreshAfter;    /**< Time another refresh can be asked (seconds, monotonic) */
+        unsigned char *m_Data;    /**< TTL offsets, QName and records */
+        uint16_t *m_TtlOffsets;   /**< Offset of the TTL of every record */
+        unsigned char *m_QName;   /**< QName in lowercase wire format */
+        unsigned char *m_Records; /**< Records after the question */
+        unsigned int m_TtlCount;  /**< Number of records */
+        unsigned int m_NameLength; /**< Length of the QName */
+        unsigned int m_Length;    /**< Bytes of the records */
+        unsigned int m_QType;     /**< Type of the question */
+        unsigned int m_QClass;    /**< Class of the question */
+        unsigned int m_AnCount;   /**< Records of the answer section */
+        unsigned int m_NsCount;   /**< Records of the authority section */
+        unsigned int m_ArCount;   /**< Records of the additional section */
+        unsigned int m_RCode;     /**< Response code */
+        unsigned long m_Size;     /**< Memory used by the entry */
+        unsigned long m_Slot;     /**< Position inside the clock of its shard */
+        TBlock *m_Block;          /**< Block it was loaded into, NULL if it was allocated alone */
+        bool m_Referenced;        /**< It has been hit since the hand passed */
+    };
+
+    /*! A part of the cache with its own lock
+     */
+    struct TShard {
+        pthread_mutex_t m_Lock;   /**< Lock of the shard */
+        vector<TEntry *> m_Buckets; /**< Hash table, chained entries */
+        vector<TEntry *> m_Clock; /**< All the entries, in the order of the hand */
+        unsigned long m_Hand;     /**< Next entry of the clock to be checked */
+        unsigned long m_Bytes;    /**< Memory used by the entries */
+        TCounters m_Counters;     /**< Counters of the shard */
+    };
+
+    /*! Header of a snapshot file
+     */
+    struct TSnapshotHeader {
+        char m_Magic[8];          /**< SNAPSHOT_MAGIC */
+        uint32_t m_Version;       /**< SNAPSHOT_VERSION, it also tells the byte order */
+        uint32_t m_Reserved;      /**< 0 */
+        int64_t m_Time;           /**< Time of the snapshot (seconds since the epoch) */
+        uint64_t m_ShardOffsets[SHARDS]; /**< Offset of the first entry of every shard */
+        uint64_t m_ShardEntries[SHARDS]; /**< Number of entries of every shard */
+    };
+
+    /*! Entry of a snapshot file, followed by its TTL offsets, QName
+     *  and records
+     */
+    struct TSnapshotEntry {
+        int32_t m_Expire;         /**< Seconds until it expires, negative if it is stale */
+        uint32_t m_Age;           /**< Seconds since it was inserted */
+        uint32_t m_Length;        /**< Bytes of the records */
+        uint16_t m_QType;         /**< Type of the question */
+        uint16_t m_QClass;        /**< Class of the question */
+        uint16_t m_AnCount;       /**< Records of the answer section */
+        uint16_t m_NsCount;       /**< Records of the authority section */
+        uint16_t m_ArCount;       /**< Records of the additional section */
+        uint16_t m_TtlCount;      /**< Number of records */
+        uint8_t m_RCode;          /**< Response code */
+        uint8_t m_NameLength;     /**< Length of the QName */
+        uint16_t m_Reserved;      /**< 0 */
+    };
+
+    /*! Part of a snapshot read by a thread
+     */
+    struct TLoader {
+        CCache *m_Cache;          /**< Cache loaded */
+        const unsigned char *m_Data; /**< Snapshot file */
+        unsigned long m_Size;     /**< Size of the file */
+        const TSnapshotHeader *m_Header; /**< Header of the file */
+        int64_t m_Stopped;        /**< Seconds since the snapshot */
+        time_t m_Current;         /**< Current time (seconds, monotonic) */
+        unsigned int m_First;     /**< First shard of this thread */
+        unsigned int m_Step;      /**< Distance to its next shard */
+        bool m_Error;             /**< The file is not valid */
+    };
+
+    /*! Hash of a question
+     */
+    static uint64_t hashQuestion(const unsigned char *qname, unsigned int length, unsigned int qtype,
+                                 unsigned int qclass);
+
+    /*! Returns the shard of a hash
+     */
+    TShard &getShard(uint64_t hash) const;
+
+    /*! Memory of an entry with its data
+     */
+    static unsigned long entrySize(unsigned int length, unsigned int ttlCount, unsigned int recordsLength);
+
+    /*! Allocates an entry with a copy of its question, TTL offsets
+     *  (in the byte order of the machine) and records, alone or inside
+     *  a block if it is not NULL. The rest of its members are set by
+     *  the caller. NULL if it does not fit in a shard
+     */
+    TEntry *createEntry(const unsigned char *qname, unsigned int length, unsigned int qtype, unsigned int qclass,
+                        const unsigned char *ttlOffsets, unsigned int ttlCount, const unsigned char *records,
+                        unsigned int recordsLength, TBlock *block) const;
+
+    /*! Frees an entry, and its block with the last entry of the
+     *  block. The lock of its shard must be held
+     */
+    static void freeEntry(TEntry *entry);
+
+    /*! Links a new entry in its shard, whose lock is held, in place of
+     *  the previous entry of its question if replace is set
+     */
+    void link(TShard &shard, TEntry *entry, time_t current, bool replace);
+
+    /*! Thread entry point of a loader of a snapshot
+     */
+    static void *loaderThread(void *arg);
+
+    /*! Links the entries of a shard of a snapshot. It returns true if
+     *  they are not valid
+     */
+    bool loadShard(const TLoader &loader, unsigned int index);
+
+    /*! Finds the entry of a question inside a shard, NULL if it is not there
+     */
+    static TEntry *find(TShard &shard, uint64_t hash, const unsigned char *qname, unsigned int length,
+                        unsigned int qtype, unsigned int qclass);
+
+    /*! Takes an entry out of its shard and frees it
+     */
+    static void remove(TShard &shard, TEntry *entry);
+
+    /*! Evicts entries until there is room for size more bytes
+     */
+    void makeRoom(TShard &shard, unsigned long size, time_t now);
+
+    /*! Doubles the buckets of a shard
+     */
+    static void grow(TShard &shard);
+
+    /*! Current time in seconds (monotonic)
+     */
+    static time_t now();
+
+    static const unsigned long MIN_BUCKETS = 64; /**< Initial buckets of a shard */
+    static const uint32_t SNAPSHOT_VERSION = 1;  /**< Version of the snapshot files */
+    static const unsigned int LOADERS = 8;       /**< Max threads that load a snapshot */
+    static const char SNAPSHOT_MAGIC[8];         /**< First bytes of a snapshot file */
+
+    TShard *m_Shards[SHARDS];   /**< Shards */
+    unsigned long m_ShardBytes; /**< Memory of every shard */
+    unsigned int m_Prefetch;    /**< Last percent of the TTL that asks for a refresh, 0 never */
+    unsigned int m_ServeStale;  /**< Seconds an entry is served after it expires */
+};
+
+#endif
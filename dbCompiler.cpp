@@ -0,0 +1,76 @@
+/*!
+*****************************************************************************
+*  \file dbCompiler.cpp
+*
+*  \brief   Compiler of the dns database (dnsd-compile)
+*
+*  It reads a hosts file, exactly as dnsd does, and saves the resulting
+*  hash table and arenas as a binary image. dnsd maps the image read-only
+*  instead of parsing the file, so it starts at once whatever the number
+*  of names is.
+*
+*  The image is written under a temporary name and renamed at the end.
+*  A running server keeps serving the previous image (its mapping is not
+*  affected by the rename) until it is reloaded.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#include "dnsDb.h"
+
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+using namespace std;
+
+/*! Prints the usage and leaves
+ */
+static void usage() {
+    cerr << "Usage: dnsd-compile <hosts_file> <image_file>" << endl;
+    exit(1);
+}
+
+/*! Current time in seconds (monotonic)
+ */
+static double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// Main function
+int main(int argc, char **argv) {
+    CDnsDb db;
+    double start;
+
+    if (argc != 3) usage();
+    string image(argv[2]);
+    string temporary(image + ".tmp");
+
+    start = now();
+    if (db.readConfigFile(argv[1])) {
+        cerr << "Error reading <" << argv[1] << "> hosts file" << endl;
+        return 1;
+    }
+    if (db.writeImage(temporary.c_str())) {
+        cerr << "Error writing <" << temporary << "> image file" << endl;
+        remove(temporary.c_str());
+        return 1;
+    }
+    if (rename(temporary.c_str(), image.c_str()) != 0) {
+        cerr << "Error renaming <" << temporary << "> to <" << image << ">" << endl;
+        remove(temporary.c_str());
+        return 1;
+    }
+    cout << db.getSize() << " hosts compiled into <" << image << "> in "
+         << now() - start << " s" << endl;
+    return 0;
+}
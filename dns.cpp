@@ -7,10 +7,32 @@
 *  Message handling that includes the reception of a packet, the management
 *  of that packet and the transmission of a response packet.
 *
-*  Right now it is single thread, meaning that it is only possible to 
-*  handle one request, process it and reply at a time. In future releases,
-*  to have a more eficient name server, a pool of threads will handle
-*  a queue of requests.
+*  Every CDns object is one worker: it owns its socket, its message state
+*  and its log file, and handles one request at a time. Several workers
+*  can run in parallel (see CWorkerPool), each one with its own socket
+*  bound to the same port through SO_REUSEPORT, sharing the database.
+*
+*  The database can be reloaded while the workers are running. A worker
+*  takes the current one after a message (or a batch) has been received
+*  and releases it before waiting for more (see CDnsDbManager).
+*
+*  The socket of a worker is an ipv6 one that also receives the ipv4
+*  queries (IPV6_V6ONLY disabled). If the system has no ipv6, it is an
+*  ipv4 socket.
+*
+*  The queries can carry an OPT record (EDNS0): the responses over UDP
+*  can then be as big as the payload size given by the client, instead
+*  of 512 bytes. A response that does not fit is truncated (TC bit).
+*
+*  A worker can also read the requests in batches: up to batchSize
+*  datagrams are received with one recvmmsg call, every one of them is
+*  processed, and all the responses are sent together with one sendmmsg.
+*
+*  With upstream servers, a name that is not in the database is looked
+*  up in the response cache, and then handed to the forwarder, which
+*  calls replayMessage() with the answer of the upstream servers: the
+*  query goes through the same path again and the answer comes out of
+*  upstreamLookup() instead of the cache.
 *
 *  \version 0.1
 *  \date    11-September-2006
@@ -25,17 +47,72 @@
 #include <iostream>
 #include <arpa/inet.h>
 #include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
 
 using namespace std;
 
-/*! Constructor
+/*! Constructor. The database is shared with other workers
+ *  and it must be already loaded. It can be replaced at any time,
+ *  the worker takes the current one for every batch of requests.
+ *  With a batchSize bigger than 1 the requests are read and replied
+ *  in batches.
  */
-CDns::CDns(char *outFile)
+CDns::CDns(char *outFile, CDnsDbManager &dnsDb, unsigned int batchSize)
         : m_Socket(0),
           m_Error(false),
+          m_AddrLength(sizeof(struct sockaddr_in6)),
           m_ClientAddr(),
-          m_DnsDb(),
-          m_Log(outFile) {
+          m_DbManager(dnsDb),
+          m_Reader(dnsDb.registerReader()),
+          m_DnsDb(NULL),
+          m_Log(outFile),
+          m_Message(m_Log),
+          m_Banner(),
+          m_QueryLog(NULL),
+          m_RxTime(),
+          m_RxTimestamp(0),
+          m_RxLength(0),
+          m_Stats(),
+          m_Timing(false),
+          m_StageStart(0),
+          m_Forwarder(NULL),
+          m_Cache(NULL),
+          m_CacheBuffer(),
+          m_CacheAnswer(),
+          m_Request(),
+          m_Forwarded(false),
+          m_Replaying(false),
+          m_ReplayAnswer(NULL),
+          m_TcpServer(NULL),
+          m_Connection(0),
+          m_BatchSize(batchSize > 0 ? batchSize : 1),
+          m_Batching(false),
+          m_Capturing(false),
+          m_Stream(false),
+          m_ResponseLength(0),
+          m_RxBuffers(m_BatchSize * MAX_RESPONSE_SIZE),
+          m_RxAddrs(m_BatchSize),
+          m_RxIov(m_BatchSize),
+          m_RxMsgs(m_BatchSize),
+          m_TxAddrs(m_BatchSize),
+          m_TxIov(m_BatchSize),
+          m_TxMsgs(m_BatchSize),
+          m_TxCount(0) {
+    // Conversion of string to be logged in a file, it
+    // is done only once
+    ostringstream s;
+    s << "\n----- Message received from socket (port " << DNS_PORT << ") -----";
+    m_Banner = s.str();
+
+    // The reception vectors always point to the same buffers,
+    // that also keep room for the response
+    for (unsigned int i = 0; i < m_BatchSize; i++) {
+        m_RxIov[i].iov_base = &m_RxBuffers[i * MAX_RESPONSE_SIZE];
+        m_RxIov[i].iov_len = MAX_MESSAGE_SIZE;
+    }
 }
 
 /*! Destructor
@@ -43,72 +120,196 @@ CDns::CDns(char *outFile)
 CDns::~CDns() {
 }
 
-/*! Starts communication with the resolver
-*/
-void CDns::openCommunication() {
-    struct sockaddr_in server;
-    int length;
+/*! Starts communication with the resolver on the given port
+ *  (DNS_PORT usually). If reusePort is set, the socket is opened
+ *  with SO_REUSEPORT so other workers can bind the same port. The
+ *  socket is dual stack (ipv6 and ipv4 mapped addresses) unless
+ *  the system has no ipv6.
+ */
+void CDns::openCommunication(bool reusePort, unsigned short port) {
+    struct sockaddr_in6 server;
+    int off = 0;
+
+    // the banner shows the port really used
+    ostringstream s;
+    s << "\n----- Message received from socket (port " << port << ") -----";
+    m_Banner = s.str();
 
-    // creates a socket
-    m_Socket = socket(AF_INET, SOCK_DGRAM, 0);
+    // creates a socket, the same one receives ipv6 queries
+    // and ipv4 queries (with mapped addresses)
+    m_Socket = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (m_Socket >= 0 && setsockopt(m_Socket, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) < 0) {
+        close(m_Socket);
+        m_Socket = -1;
+    }
+    if (m_Socket < 0) {
+        // no ipv6 support
+        m_Socket = socket(AF_INET, SOCK_DGRAM, 0);
+        m_AddrLength = sizeof(struct sockaddr_in);
+    }
     if (m_Socket < 0) {
         cerr << "Error opening socket" << endl;
         exit(0);
     }
 
-    // binds it to listen to the DNS_PORT
-    length = sizeof(server);
-    memset(&server, 0, (size_t) length);
-    server.sin_family = AF_INET;
-    server.sin_addr.s_addr = htonl(INADDR_ANY);
-    server.sin_port = htons(DNS_PORT);
+    // every worker has its own socket on the same port, the
+    // kernel spreads the incoming queries among them
+    if (reusePort) {
+        int on = 1;
+        if (setsockopt(m_Socket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            cerr << "Error setting SO_REUSEPORT on socket" << endl;
+            exit(0);
+        }
+    }
 
-    if (::bind(m_Socket, (struct sockaddr *) &server, length) < 0) {
-        cerr << "Error binding socket" << endl;
-        exit(0);
+    // binds it to listen to the port
+    memset(&server, 0, sizeof(server));
+    if (m_AddrLength == sizeof(struct sockaddr_in6)) {
+        server.sin6_family = AF_INET6;
+        server.sin6_addr = in6addr_any;
+        server.sin6_port = htons(port);
+    } else {
+        struct sockaddr_in *server4 = (struct sockaddr_in *) &server;
+        server4->sin_family = AF_INET;
+        server4->sin_addr.s_addr = htonl(INADDR_ANY);
+        server4->sin_port = htons(port);
     }
 
-    // Prepare Dns db class to process file
-    bool error = m_DnsDb.readConfigFile("ip_hosts");
-    if (error) {
-        cerr << "Error reading <ip_hosts> config file. It does not exist" << endl;
+    if (::bind(m_Socket, (struct sockaddr *) &server, m_AddrLength) < 0) {
+        cerr << "Error binding socket" << endl;
         exit(0);
     }
     m_Log.printString("Starting name server...");
 }
 
+/*! Every query is stored in the binary query log, shared
+ *  with other workers. It can be NULL
+ */
+void CDns::setQueryLog(CQueryLog *queryLog) {
+    m_QueryLog = queryLog;
+}
+
+/*! The addresses of every answer are rotated (round robin)
+ */
+void CDns::setRotation(bool rotate) {
+    m_Message.setRotation(rotate);
+}
+
+/*! Serves requests forever
+ */
+void CDns::run() {
+    while (1) {
+        if (m_BatchSize > 1) {
+            readBatch();
+        } else {
+            readMessage();
+        }
+    }
+}
+
 /*! Reads message from client
  */
 void CDns::readMessage() {
-    socklen_t fromlen = sizeof(struct sockaddr_in);
+    socklen_t fromlen = m_AddrLength;
     ssize_t n;
-    char buffer[1024];
+    unsigned char *buffer = &m_RxBuffers[0];
 
     // receives a new message
-    n = recvfrom(m_Socket, (void *) buffer, 1024, 0, (struct sockaddr *) &m_ClientAddr, &fromlen);
+    n = recvfrom(m_Socket, (void *) buffer, MAX_MESSAGE_SIZE, 0, (struct sockaddr *) &m_ClientAddr, &fromlen);
     if (n < 0) {
         cerr << "Error receiving from " << m_Socket << " socket" << endl;
         exit(0);
     }
-    // Conversion of the buffer received from char* to string
-    string message_received((const char *) &buffer, (unsigned long) n);
+    stampReception();
+    // The database is not released while the message is processed.
+    // It is released before waiting for the next one, so a reload
+    // never waits for an idle worker.
+    m_DnsDb = m_DbManager.enter(m_Reader);
     // The original message will be passed as parameter to the different
     // methods inside the clas to be reused on the response transmission
     // Call to ParseMessage
-    parseMessage(message_received, (unsigned long) n);
+    parseMessage(buffer, (unsigned long) n);
+    m_DbManager.leave(m_Reader);
+}
+
+/*! Reads a batch of messages from the clients, processes all of
+ *  them and sends the responses together
+ */
+void CDns::readBatch() {
+    int n;
+
+    // The kernel overwrites the length of the addresses
+    for (unsigned int i = 0; i < m_BatchSize; i++) {
+        memset(&m_RxMsgs[i], 0, sizeof(struct mmsghdr));
+        m_RxMsgs[i].msg_hdr.msg_name = &m_RxAddrs[i];
+        m_RxMsgs[i].msg_hdr.msg_namelen = m_AddrLength;
+        m_RxMsgs[i].msg_hdr.msg_iov = &m_RxIov[i];
+        m_RxMsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // waits for the first message and takes the rest
+    // that are already queued, without waiting for them
+    n = recvmmsg(m_Socket, &m_RxMsgs[0], m_BatchSize, MSG_WAITFORONE, NULL);
+    if (n < 0) {
+        cerr << "Error receiving from " << m_Socket << " socket" << endl;
+        exit(0);
+    }
+    // all the messages of the batch have the same reception time
+    stampReception();
+
+    // the whole batch is answered with the same database
+    m_DnsDb = m_DbManager.enter(m_Reader);
+    m_Batching = true;
+    m_TxCount = 0;
+    for (int i = 0; i < n; i++) {
+        m_ClientAddr = m_RxAddrs[i];
+        parseMessage(&m_RxBuffers[i * MAX_RESPONSE_SIZE], m_RxMsgs[i].msg_len);
+    }
+    m_Batching = false;
+    m_DbManager.leave(m_Reader);
+
+    flushBatch();
 }
 
-/*! Sends message to client
+/*! Sends message to client. While a batch is being processed
+ *  the message is only queued, see flushBatch(), and the messages
+ *  of other transports are only kept, see processMessage()
  */
-void CDns::sendMessage(string &txMessage) {
+void CDns::sendMessage(const unsigned char *txMessage, unsigned long length) {
     ssize_t n;
-    socklen_t tolen = sizeof(struct sockaddr_in);
+    socklen_t tolen = m_AddrLength;
 
-    m_Log.printString("\nMessage (sent):");
-    m_Log.printFormattedString(txMessage);
+    if (m_Timing) {
+        uint64_t now = endStage(CStats::BUILD);
+        m_Stats.recordLatency(CStats::TOTAL, now - ((uint64_t) m_RxTime.tv_sec * 1000000000ULL + m_RxTime.tv_nsec));
+    }
+    m_Stats.countResponse(m_Message.getExtendedRCode());
+
+    // with the binary query log the packets are not dumped
+    if (m_QueryLog == NULL) {
+        m_Log.printString("\nMessage (sent):");
+        m_Log.printFormattedString(txMessage, length);
+    }
+    logQuery(length);
+
+    if (m_Capturing) {
+        // the transport sends it
+        m_ResponseLength = length;
+        return;
+    }
+
+    if (m_Batching) {
+        // there is always room, one response per message received,
+        // and the response stays inside the reception buffer
+        m_TxIov[m_TxCount].iov_base = (void *) txMessage;
+        m_TxIov[m_TxCount].iov_len = length;
+        m_TxAddrs[m_TxCount] = m_ClientAddr;
+        m_TxCount++;
+        return;
+    }
 
     // sends message back to resolver
-    n = sendto(m_Socket, txMessage.c_str(), txMessage.size(),
+    n = sendto(m_Socket, txMessage, length,
                0, (struct sockaddr *) &m_ClientAddr, tolen);
     if (n < 0) {
         cerr << "Error sending to " << m_Socket << " socket" << endl;
@@ -116,29 +317,102 @@ void CDns::sendMessage(string &txMessage) {
     }
 }
 
-/*! Parses the message received
+/*! Sends all the responses queued for the current batch
+ */
+void CDns::flushBatch() {
+    unsigned int sent = 0;
+    int n;
+
+    for (unsigned int i = 0; i < m_TxCount; i++) {
+        memset(&m_TxMsgs[i], 0, sizeof(struct mmsghdr));
+        m_TxMsgs[i].msg_hdr.msg_name = &m_TxAddrs[i];
+        m_TxMsgs[i].msg_hdr.msg_namelen = m_AddrLength;
+        m_TxMsgs[i].msg_hdr.msg_iov = &m_TxIov[i];
+        m_TxMsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // sendmmsg could send less messages than requested
+    while (sent < m_TxCount) {
+        n = sendmmsg(m_Socket, &m_TxMsgs[sent], m_TxCount - sent, 0);
+        if (n < 0) {
+            cerr << "Error sending to " << m_Socket << " socket" << endl;
+            exit(0);
+        }
+        sent += (unsigned int) n;
+    }
+    m_TxCount = 0;
+}
+
+/*! Keeps the reception time of the messages for the binary
+ *  query log and the latency of the whole processing
+ */
+void CDns::stampReception() {
+    struct timespec now;
+
+    if (m_QueryLog == NULL && !m_Timing) return;
+
+    clock_gettime(CLOCK_MONOTONIC, &m_RxTime);
+    // the first stage starts at the reception, the next
+    // messages of a batch when the previous one ends
+    m_StageStart = (uint64_t) m_RxTime.tv_sec * 1000000000ULL + (uint64_t) m_RxTime.tv_nsec;
+    if (m_QueryLog == NULL) return;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    m_RxTimestamp = (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+/*! Stores the query being processed in the binary query log
+ */
+void CDns::logQuery(unsigned long responseLength) {
+    struct timespec now;
+    int64_t latency;
+
+    if (m_QueryLog == NULL) return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    latency = (int64_t) (now.tv_sec - m_RxTime.tv_sec) * 1000000000LL + (now.tv_nsec - m_RxTime.tv_nsec);
+    m_QueryLog->add(m_RxTimestamp, (uint32_t) latency, (const struct sockaddr *) &m_ClientAddr,
+                    m_Message.getQName(), m_Message.getQNameLength(), m_Message.getQType(),
+                    m_Message.getExtendedRCode(), (unsigned int) m_RxLength, (unsigned int) responseLength);
+}
+
+/*! Parses the message received. The buffer must have room
+ *  for MAX_RESPONSE_SIZE bytes (MAX_STREAM_SIZE over TCP), the
+ *  response is built on it.
  */
-void CDns::parseMessage(string &txMessage, unsigned long inLength) {
-    // A new message is created
-    m_Message = new CMessage(m_Log);
+void CDns::parseMessage(unsigned char *txMessage, unsigned long inLength) {
+    // The message of the previous query is reused
+    m_Message.reset();
 
     // Initialize error variable
     m_Error = false;
+    m_Forwarded = false;
+    m_RxLength = inLength;
+    // a replayed query was already counted when it was received
+    if (!m_Replaying) m_Stats.countMessage();
+    if (m_Forwarder != NULL) m_Message.setRecursionAvailable();
 
-    // Conversion of string to be logged in a file
-    ostringstream s;
-    s << DNS_PORT;
-    m_Log.printString("\n----- Message received from socket (port " + s.str() + ") -----");
+    m_Log.printString(m_Banner.c_str());
     m_Log.printString("--------------------------------------------------");
 
-    m_Log.printString("\nMessage (received):");
-    m_Log.printFormattedString(txMessage);
+    if (m_QueryLog == NULL) {
+        m_Log.printString("\nMessage (received):");
+        m_Log.printFormattedString(txMessage, inLength);
+    }
 
-    // Header: 12 bytes (RFC 1035)
-    string header(txMessage, 0, HEADER_SIZE);
-    m_Error = m_Message->setHeader(header);
+    // Header: 12 bytes (RFC 1035). Without a whole header
+    // there is not even an ID to reply to.
+    if (inLength < HEADER_SIZE) {
+        m_Log.printString("parseMessage: message too short, discarded");
+        m_Stats.countDrop();
+        logQuery(0);
+        return;
+    }
+    m_Error = m_Message.setHeader(txMessage);
     if (m_Error) {
         m_Log.printString("parseMessage: error parsing header");
+        m_Stats.countParseError();
+        endStage(CStats::PARSE);
         // Let's build the response
         buildMessage(txMessage);
         return;
@@ -147,14 +421,25 @@ void CDns::parseMessage(string &txMessage, unsigned long inLength) {
     // Question: variable length. We assume there is only
     // 1 question section. If there are more, a not implemented
     // has been already returned.
-    string question(txMessage, HEADER_SIZE, inLength - HEADER_SIZE);
-    m_Error = m_Message->setQuestion(question, inLength - HEADER_SIZE);
+    m_Error = m_Message.setQuestion(txMessage + HEADER_SIZE, inLength - HEADER_SIZE);
+
+    // The records after the question, only the OPT record (EDNS0)
+    // is used. It is also needed by the errors of the question.
+    if (m_Message.getQuestionLength() > 0) {
+        unsigned long offset = HEADER_SIZE + m_Message.getQuestionLength();
+        bool error = m_Message.setAdditional(txMessage + offset, inLength - offset);
+        m_Error = m_Error || error;
+    }
     if (m_Error) {
         m_Log.printString("parseMessage: error parsing question");
+        m_Stats.countParseError();
+        endStage(CStats::PARSE);
         // Let's build the response
         buildMessage(txMessage);
         return;
     }
+    if (!m_Replaying) m_Stats.countQuery(m_Message.getQType());
+    endStage(CStats::PARSE);
     // No errors, let's look for the host
     hostLookup(txMessage);
 }
@@ -162,50 +447,257 @@ void CDns::parseMessage(string &txMessage, unsigned long inLength) {
 
 /*! Looks for the host in the Db
  */
-void CDns::hostLookup(string &txMessage) {
-    struct in_addr addr;
-    unsigned long saddr;
-    string hostname;
+void CDns::hostLookup(unsigned char *txMessage) {
+    CDnsDb::TAnswer answer;
+    bool found;
 
-    // Get hostname from message class
-    hostname = m_Message->getHost();
+    // Look for the answer inside Db, directly with the QName
+    // of the message. It is already in wire format.
+    found = m_DnsDb->getAnswer(m_Message.getQName(), m_Message.getQNameLength(), m_Message.getQType(), answer);
 
-    // Look for the IP address inside Db
-    addr.s_addr = m_DnsDb.getAddress(hostname.c_str());
-    // Get the address in network order
-    saddr = htonl(addr.s_addr);
+    m_Log.printHost(m_Message.getQName(), m_Message.getQNameLength());
 
-    ostringstream s;
-    s << hostname.size();
-    m_Log.printString("Host " + hostname + " (" + s.str() + ")");
+    // The names that are not in the database are asked
+    // to the upstream servers, if there are any
+    if (!found && m_Forwarder != NULL) {
+        bool forwarded = upstreamLookup(txMessage);
+        endStage(CStats::LOOKUP);
+        if (!forwarded) buildMessage(txMessage);
+        return;
+    }
 
-    // Let's update the address for the reply
-    m_Error = m_Message->setAnswer(saddr);
+    // Let's update the answer for the reply
+    if (found) {
+        m_Error = m_Message.setAnswer(answer.m_Data, answer.m_Length, answer.m_Count);
+    } else {
+        m_Error = m_Message.setAnswer(NULL, 0, 0);
+    }
+    if (!found || answer.m_Count == 0) {
+        // NXDOMAIN or NODATA (the name exists without records
+        // of that type), the SOA lets the resolvers cache it
+        m_DnsDb->getAuthority(answer);
+        m_Message.setAuthority(answer.m_Data, answer.m_Length, answer.m_Count);
+    }
     if (m_Error) {
         m_Log.printString("hostLookup: address not found");
     }
+    endStage(CStats::LOOKUP);
     // Build the message to send it back
     buildMessage(txMessage);
 }
 
-/*! Build message with the response
+/*! Build message with the response. Over UDP it is limited to the
+ *  payload size of the client (512 bytes without EDNS0)
  */
-void CDns::buildMessage(string &txMessage) {
+void CDns::buildMessage(unsigned char *txMessage) {
+    unsigned int length;
+    unsigned int size;
+    unsigned int room;
+
     // txMessage has already the original data to be reused.
     // To reply faster, only the header will be stored,
-    // all question section will the same one.
+    // all question section will the same one. Anything
+    // after the question is dropped.
+    if (m_Stream) {
+        size = MAX_STREAM_SIZE;
+    } else {
+        size = m_Message.getPayloadSize();
+        if (size > MAX_RESPONSE_SIZE) size = MAX_RESPONSE_SIZE;
+    }
+    length = HEADER_SIZE + m_Message.getQuestionLength();
 
-    m_Message->getHeader(txMessage);
+    // appends Answer, Authority and Additional in case they
+    // exist. After an error only the authority section of a
+    // negative answer can be there. The OPT record always
+    // has room, a section that does not fit is left out.
+    room = size - m_Message.getAdditionalLength();
+    length += m_Message.getAnswer(txMessage + length, room - length);
+    length += m_Message.getAuthority(txMessage, length, room - length);
+    length += m_Message.getAdditional(txMessage + length, size - length);
 
-    if (!m_Error) {
-        // appends Answer, Authority and Additional
-        // in case they exist.
-        txMessage += m_Message->getAnswer();
-        txMessage += m_Message->getAuthority();
-        txMessage += m_Message->getAdditional();
-    }
+    // The header is the last one, the counters depend
+    // on the sections that fit
+    m_Message.getHeader(txMessage);
 
     // Now txMessage contains all the information
     // to be sent back to the resolver.
-    sendMessage(txMessage);
+    sendMessage(txMessage, length);
+}
+
+/*! Processes a message received by another transport (TCP). The
+ *  buffer must have room for MAX_STREAM_SIZE bytes, the response
+ *  is built on it and it is not sent. It returns the length of the
+ *  response, 0 if the message is discarded.
+ */
+unsigned long CDns::processMessage(unsigned char *buffer, unsigned long length,
+                                   const struct sockaddr_in6 &client, uint64_t connection) {
+    bool capturing = m_Capturing;
+    bool stream = m_Stream;
+
+    m_ClientAddr = client;
+    m_Connection = connection;
+    stampReception();
+
+    m_DnsDb = m_DbManager.enter(m_Reader);
+    m_Capturing = true;
+    m_Stream = true;
+    m_ResponseLength = 0;
+    parseMessage(buffer, length);
+    m_Capturing = capturing;
+    m_Stream = stream;
+    m_DbManager.leave(m_Reader);
+
+    return m_ResponseLength;
+}
+
+/*! The last message processed has been handed to the forwarder,
+ *  its response will be delivered later (see CTcpServer::deliver)
+ */
+bool CDns::isForwarded() {
+    return m_Forwarded;
+}
+
+/*! The names not found in the database are answered from the
+ *  cache or forwarded to the upstream servers
+ */
+void CDns::setForwarding(CForwarder *forwarder, CCache *cache) {
+    m_Forwarder = forwarder;
+    m_Cache = cache;
+    // a cached answer can take a whole TCP message
+    m_CacheBuffer.resize(MAX_STREAM_SIZE);
+}
+
+/*! The messages of processMessage() come from this TCP server,
+ *  the forwarded ones are delivered through it
+ */
+void CDns::setTcpServer(CTcpServer *tcp) {
+    m_TcpServer = tcp;
+}
+
+/*! Processes again a forwarded query, now with the answer of the
+ *  upstream servers (NULL if they failed, then it is a SERVFAIL).
+ *  The buffer must have room for MAX_STREAM_SIZE bytes, the response
+ *  is built on it and it is not sent. It returns its length
+ */
+unsigned long CDns::replayMessage(const CForwarder::TRequest &request, const CCache::TAnswer *answer,
+                                  unsigned char *buffer) {
+    bool capturing = m_Capturing;
+    bool stream = m_Stream;
+
+    // the latency and the query log count from the first reception
+    memcpy(buffer, &request.m_Query[0], request.m_Query.size());
+    m_ClientAddr = request.m_ClientAddr;
+    m_RxTime = request.m_RxTime;
+    m_RxTimestamp = request.m_RxTimestamp;
+    if (m_Timing) m_StageStart = CStats::now();
+
+    m_DnsDb = m_DbManager.enter(m_Reader);
+    m_Capturing = true;
+    m_Stream = request.m_Tcp != NULL;
+    m_Replaying = true;
+    m_ReplayAnswer = answer;
+    m_ResponseLength = 0;
+    parseMessage(buffer, request.m_Query.size());
+    m_Replaying = false;
+    m_ReplayAnswer = NULL;
+    m_Capturing = capturing;
+    m_Stream = stream;
+    m_DbManager.leave(m_Reader);
+
+    return m_ResponseLength;
+}
+
+/*! The responses are kept instead of sent, as in processMessage(),
+ *  so buildMessage() can be called alone (dnsd-microbench)
+ */
+void CDns::setCapture(bool capture) {
+    m_Capturing = capture;
+    m_Stream = capture;
+}
+
+/*! Returns the counters of this worker. Only the thread of
+ *  the worker counts, any thread can read them
+ */
+CStats &CDns::getStats() {
+    return m_Stats;
+}
+
+/*! The time of every stage is measured too (the clock is read
+ *  once per stage), not only the counters
+ */
+void CDns::setTiming(bool timing) {
+    m_Timing = timing;
+}
+
+/*! Waits until the log records queued so far are written.
+ *  Any thread can call it
+ */
+void CDns::flushLog() {
+    m_Log.flush();
+}
+
+/*! Counts the time of a stage, from the end of the previous one
+ *  (or the reception), and returns the current time (ns, monotonic)
+ */
+uint64_t CDns::endStage(CStats::TStage stage) {
+    uint64_t now;
+
+    if (!m_Timing) return 0;
+
+    now = CStats::now();
+
+    m_Stats.recordLatency(stage, now - m_StageStart);
+    m_StageStart = now;
+    return now;
+}
+
+/*! Answers a name that is not in the database, from the cache or
+ *  from the upstream servers while replaying. It returns true if
+ *  the query has been forwarded, and there is no response yet
+ */
+bool CDns::upstreamLookup(const unsigned char *txMessage) {
+    if (m_Replaying) {
+        if (m_ReplayAnswer != NULL) {
+            m_Message.setCachedAnswer(*m_ReplayAnswer);
+        } else {
+            m_Message.setServerFailure();
+        }
+        return false;
+    }
+
+    CCache::TLookup found = m_Cache->lookup(m_Message.getQName(), m_Message.getQNameLength(),
+                                            m_Message.getQType(), m_Message.getQClass(), &m_CacheBuffer[0],
+                                            (unsigned int) m_CacheBuffer.size(), m_CacheAnswer);
+    if (found != CCache::MISS) {
+        m_Message.setCachedAnswer(m_CacheAnswer);
+        // the client is answered now, the new response
+        // replaces the entry in the background
+        if (found == CCache::REFRESH) {
+            m_Log.printString("upstreamLookup: cached answer refreshed");
+            forwardQuery(txMessage, false);
+        }
+        return false;
+    }
+
+    // the forwarder answers the client, on the socket of
+    // this worker or through the TCP server
+    m_Log.printString("upstreamLookup: query forwarded");
+    forwardQuery(txMessage, true);
+    m_Forwarded = true;
+    return true;
+}
+
+/*! Hands the query to the forwarder. Without a client, the
+ *  response only refreshes the cache
+ */
+void CDns::forwardQuery(const unsigned char *txMessage, bool client) {
+    m_Request.m_Query.assign(txMessage, txMessage + m_RxLength);
+    m_Request.m_ClientAddr = m_ClientAddr;
+    m_Request.m_AddrLength = m_AddrLength;
+    m_Request.m_Socket = client && m_TcpServer == NULL ? m_Socket : -1;
+    m_Request.m_Tcp = client ? m_TcpServer : NULL;
+    m_Request.m_Connection = m_Connection;
+    m_Request.m_RxTime = m_RxTime;
+    m_Request.m_RxTimestamp = m_RxTimestamp;
+    m_Forwarder->forward(m_Request);
 }
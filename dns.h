@@ -7,10 +7,23 @@
 *  Message handling that includes the reception of a packet, the management
 *  of that packet and the transmission of a response packet.
 *
-*  Right now it is single thread, meaning that it is only possible to 
-*  handle one request, process it and reply at a time. In future releases,
-*  to have a more eficient name server, a pool of threads will handle
-*  a queue of requests.
+*  Every CDns object is one worker: it owns its socket, its message state
+*  and its log file, and handles one request at a time. Several workers
+*  can run in parallel (see CWorkerPool), each one with its own socket
+*  bound to the same port through SO_REUSEPORT, sharing the database.
+*
+*  A worker can also read the requests in batches: up to batchSize
+*  datagrams are received with one recvmmsg call, every one of them is
+*  processed, and all the responses are sent together with one sendmmsg.
+*
+*  Every worker counts its messages (and, if enabled, the time of every
+*  stage of their processing) in its own CStats object, read by the
+*  metrics listener.
+*
+*  With upstream servers (see CForwarder), the names that are not in the
+*  database are answered from the response cache (see CCache). If they
+*  are not there either, the query is handed to the forwarder and the
+*  worker goes on: the forwarder answers the client later.
 *
 *  \version 0.1
 *  \date    11-September-2006
@@ -24,9 +37,15 @@
 
 #include "log.h"
 #include "message.h"
-#include "dnsDb.h"
+#include "dnsDbManager.h"
+#include "queryLog.h"
+#include "stats.h"
+#include "cache.h"
+#include "forwarder.h"
 
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <vector>
 
 /*! \class CDns
  *  \brief It takes care of all related to message handling
@@ -40,9 +59,13 @@ using namespace std;
 
 class CDns {
 public:
-    /*! Constructor
+    /*! Constructor. The database is shared with other workers
+     *  and it must be already loaded. It can be replaced at any time,
+     *  the worker takes the current one for every batch of requests.
+     *  With a batchSize bigger than 1 the requests are read and replied
+     *  in batches.
      */
-    CDns(char *outFile);
+    CDns(char *outFile, CDnsDbManager &dnsDb, unsigned int batchSize);
 
     /*! Destructor
      */
@@ -52,36 +75,126 @@ public:
     // Functions taking care of the communications
     //
 
-    /*! Starts communication with the resolver
+    /*! Starts communication with the resolver on the given port
+     *  (DNS_PORT usually). If reusePort is set, the socket is opened
+     *  with SO_REUSEPORT so other workers can bind the same port. The
+     *  socket is dual stack (ipv6 and ipv4 mapped addresses) unless
+     *  the system has no ipv6.
+     */
+    void openCommunication(bool reusePort, unsigned short port);
+
+    /*! Every query is stored in the binary query log, shared
+     *  with other workers. It can be NULL
+     */
+    void setQueryLog(CQueryLog *queryLog);
+
+    /*! The addresses of every answer are rotated (round robin)
+     */
+    void setRotation(bool rotate);
+
+    /*! Serves requests forever
      */
-    void openCommunication();
+    void run();
 
     /*! Reads message from client
      */
     void readMessage();
 
-    /*! Sends message to client
+    /*! Reads a batch of messages from the clients, processes all of
+     *  them and sends the responses together
      */
-    void sendMessage(string &txMessage);
+    void readBatch();
+
+    /*! Sends message to client. While a batch is being processed
+     *  the message is only queued, see flushBatch(), and the messages
+     *  of other transports are only kept, see processMessage()
+     */
+    void sendMessage(const unsigned char *txMessage, unsigned long length);
+
+    /*! Sends all the responses queued for the current batch
+     */
+    void flushBatch();
+
+    /*! Keeps the reception time of the messages for the binary
+     *  query log and the latency of the whole processing
+     */
+    void stampReception();
+
+    /*! Stores the query being processed in the binary query log
+     */
+    void logQuery(unsigned long responseLength);
 
     //
     //  Functions taking care of the parsing of the query and
     //  the building of the correct response for the client
     //
 
-    /*! Parses the message received
+    /*! Parses the message received. The buffer must have room
+     *  for MAX_RESPONSE_SIZE bytes (MAX_STREAM_SIZE over TCP), the
+     *  response is built on it.
      */
-    void parseMessage(string &txMessage, unsigned long inLength);
+    void parseMessage(unsigned char *txMessage, unsigned long inLength);
 
     /*! Looks for the host in the Db
      */
-    void hostLookup(string &txMessage);
+    void hostLookup(unsigned char *txMessage);
 
-    /*! Build message with the response
+    /*! Build message with the response. Over UDP it is limited to the
+     *  payload size of the client (512 bytes without EDNS0)
      */
-    void buildMessage(string &txMessage);
+    void buildMessage(unsigned char *txMessage);
+
+    /*! Processes a message received by another transport (TCP). The
+     *  buffer must have room for MAX_STREAM_SIZE bytes, the response
+     *  is built on it and it is not sent. It returns the length of the
+     *  response, 0 if the message is discarded.
+     */
+    unsigned long processMessage(unsigned char *buffer, unsigned long length,
+                                 const struct sockaddr_in6 &client, uint64_t connection);
+
+    /*! The last message processed has been handed to the forwarder,
+     *  its response will be delivered later (see CTcpServer::deliver)
+     */
+    bool isForwarded();
+
+    /*! The names not found in the database are answered from the
+     *  cache or forwarded to the upstream servers
+     */
+    void setForwarding(CForwarder *forwarder, CCache *cache);
+
+    /*! The messages of processMessage() come from this TCP server,
+     *  the forwarded ones are delivered through it
+     */
+    void setTcpServer(CTcpServer *tcp);
+
+    /*! Processes again a forwarded query, now with the answer of the
+     *  upstream servers (NULL if they failed, then it is a SERVFAIL).
+     *  The buffer must have room for MAX_STREAM_SIZE bytes, the response
+     *  is built on it and it is not sent. It returns its length
+     */
+    unsigned long replayMessage(const CForwarder::TRequest &request, const CCache::TAnswer *answer,
+                                unsigned char *buffer);
+
+    /*! The responses are kept instead of sent, as in processMessage(),
+     *  so buildMessage() can be called alone (dnsd-microbench)
+     */
+    void setCapture(bool capture);
+
+    /*! Returns the counters of this worker. Only the thread of
+     *  the worker counts, any thread can read them
+     */
+    CStats &getStats();
+
+    /*! The time of every stage is measured too (the clock is read
+     *  once per stage), not only the counters
+     */
+    void setTiming(bool timing);
+
+    /*! Waits until the log records queued so far are written.
+     *  Any thread can call it
+     */
+    void flushLog();
 
-private:
     //  Creation of all data types for the message (RFC 1035)
     //  involving different classes within the process
     static const unsigned short DNS_PORT = 53; /**<  Port used for the DNS. Another solution is to get it from
@@ -89,12 +202,74 @@ private:
 						   I have discarded that possibility */
     static const unsigned short HEADER_SIZE = 12; /**<  Size of the header of the message. It is a fixed value,
                                                       following RFC 1035 it is 12 bytes */
+    static const unsigned short MAX_MESSAGE_SIZE = CMessage::EDNS_PAYLOAD_SIZE; /**<  Max size of a message received
+                                                                                   over UDP, advertised with EDNS0 */
+    static const unsigned short MAX_RESPONSE_SIZE = MAX_MESSAGE_SIZE; /**<  Size of the buffer of a message, the response
+                                                                          is built over the query and it is never bigger */
+    static const unsigned short MAX_STREAM_SIZE = 65535; /**<  Max size of a message over TCP (2 bytes length) */
+
+private:
+    /*! Counts the time of a stage, from the end of the previous one
+     *  (or the reception), and returns the current time (ns, monotonic)
+     */
+    uint64_t endStage(CStats::TStage stage);
+
+    /*! Answers a name that is not in the database, from the cache or
+     *  from the upstream servers while replaying. It returns true if
+     *  the query has been forwarded, and there is no response yet
+     */
+    bool upstreamLookup(const unsigned char *txMessage);
+
+    /*! Hands the query to the forwarder. Without a client, the
+     *  response only refreshes the cache
+     */
+    void forwardQuery(const unsigned char *txMessage, bool client);
+
     int m_Socket;     /**<  Socket to communicate with the client */
     bool m_Error;      /**<  Error */
-    CMessage *m_Message;    /**<  CMessage class */
-    struct sockaddr_in m_ClientAddr; /**<  Address of the client */
-    CDnsDb m_DnsDb;      /**<  CDnsDb class */
+    socklen_t m_AddrLength;  /**<  Length of the addresses of the socket family */
+    struct sockaddr_in6 m_ClientAddr; /**<  Address of the client (sockaddr_in with an ipv4 socket) */
+    CDnsDbManager &m_DbManager; /**<  Current database, shared by all the workers */
+    unsigned int m_Reader;      /**<  Reader identifier of this worker inside m_DbManager */
+    const CDnsDb *m_DnsDb;      /**<  Database used by the batch being processed */
     CLog m_Log;        /**<  Log file class */
+    CMessage m_Message;    /**<  CMessage class, reset and reused for every query */
+    string m_Banner;       /**<  Line logged for every message received */
+    CQueryLog *m_QueryLog;       /**<  Binary query log, NULL if disabled */
+    struct timespec m_RxTime;    /**<  Reception time of the current message (monotonic) */
+    uint64_t m_RxTimestamp;      /**<  Reception time of the current message (ns since the epoch) */
+    unsigned long m_RxLength;    /**<  Length of the current message */
+    CStats m_Stats;              /**<  Counters of this worker */
+    bool m_Timing;               /**<  The time of the stages is measured */
+    uint64_t m_StageStart;       /**<  Start of the current stage (ns, monotonic) */
+
+    // Forwarding mode, the names not in the database
+    CForwarder *m_Forwarder;           /**<  Asks the upstream servers, NULL if disabled */
+    CCache *m_Cache;                   /**<  Responses of the upstream servers */
+    vector<unsigned char> m_CacheBuffer; /**<  Records read from the cache */
+    CCache::TAnswer m_CacheAnswer;     /**<  Answer read from the cache */
+    CForwarder::TRequest m_Request;    /**<  Query handed to the forwarder */
+    bool m_Forwarded;                  /**<  The current query has been forwarded */
+    bool m_Replaying;                  /**<  The current query comes back from the forwarder */
+    const CCache::TAnswer *m_ReplayAnswer; /**<  Answer of the upstream servers, NULL if they failed */
+    CTcpServer *m_TcpServer;           /**<  TCP server of processMessage(), NULL over UDP */
+    uint64_t m_Connection;             /**<  TCP connection of the current message */
+
+    // Batch handling (recvmmsg/sendmmsg), all the buffers are
+    // allocated once in the constructor
+    unsigned int m_BatchSize;                /**<  Max number of messages per batch */
+    bool m_Batching;                         /**<  A batch is being processed */
+    bool m_Capturing;                        /**<  The response is kept, see processMessage() */
+    bool m_Stream;                           /**<  The response goes over TCP, up to MAX_STREAM_SIZE */
+    unsigned long m_ResponseLength;          /**<  Length of the response kept */
+    vector<unsigned char> m_RxBuffers;       /**<  Message buffers, MAX_RESPONSE_SIZE per message */
+    vector<struct sockaddr_in6> m_RxAddrs;   /**<  Addresses of the clients of the batch */
+    vector<struct iovec> m_RxIov;            /**<  Reception vectors */
+    vector<struct mmsghdr> m_RxMsgs;         /**<  Reception headers */
+    vector<struct sockaddr_in6> m_TxAddrs;   /**<  Addresses of the responses queued */
+    vector<struct iovec> m_TxIov;            /**<  Transmission vectors */
+    vector<struct mmsghdr> m_TxMsgs;         /**<  Transmission headers */
+    unsigned int m_TxCount;                  /**<  Number of responses queued */
 };
 
 #endif
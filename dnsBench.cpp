@@ -0,0 +1,562 @@
+/*!
+*****************************************************************************
+*  \file dnsBench.cpp
+*
+*  \brief   Load generator for the dns server (dnsd-bench)
+*
+*  It sends queries over UDP to a server (usually a dnsd on localhost
+*  started with "-p") from several threads and measures the queries per
+*  second answered, the queries lost and the latency percentiles.
+*
+*  The load is open loop: every thread sends its queries at fixed times,
+*  given by the target rate, whether the previous ones have been answered
+*  or not, so a slow server gets a growing queue instead of a lighter
+*  load. The latency of a query is measured from the time it should have
+*  been sent, which also counts the delays of the generator itself.
+*
+*  The names are taken from a hosts file (ip_hosts by default) and
+*  chosen with a Zipf distribution (a few names get most of the queries,
+*  as in real traffic). A share of the queries are misses, names that
+*  are not in the file. The query types are chosen from a weighted mix.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#include "dnsDb.h"
+#include "histogram.h"
+#include "rr.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <poll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+static const unsigned int HEADER_SIZE = 12;      /**< Size of the header of a message */
+static const unsigned int MAX_MESSAGE_SIZE = 65535; /**< Size of the reception buffer */
+static const unsigned int MAX_IDS = 65536;       /**< Queries in flight per thread (16-bit ID) */
+static const unsigned int MAX_BURST = 64;        /**< Queries sent before reading responses */
+
+/*! Options of the benchmark
+ */
+struct TOptions {
+    string m_Server;          /**< Address of the server */
+    string m_Port;            /**< Port of the server */
+    string m_HostsFile;       /**< Hosts file with the names */
+    unsigned int m_Threads;   /**< Number of threads */
+    double m_Rate;            /**< Target queries per second (all the threads) */
+    double m_Duration;        /**< Seconds sending queries */
+    double m_MissRatio;       /**< Share of queries with names not in the file */
+    double m_Zipf;            /**< Exponent of the Zipf distribution, 0 is uniform */
+    unsigned int m_Payload;   /**< EDNS0 payload size, 0 without OPT record */
+    uint64_t m_Timeout;       /**< A response later than this is lost (ns) */
+};
+
+/*! Shared data, read-only once the threads start
+ */
+struct TWorkload {
+    struct sockaddr_storage m_Address;  /**< Address of the server */
+    socklen_t m_AddressLength;          /**< Length of m_Address */
+    vector<unsigned char> m_Names;      /**< Wire names of the hits, one after the other */
+    vector<unsigned long> m_Offsets;    /**< Offset of every name, plus the end */
+    vector<double> m_Cdf;               /**< Cumulative Zipf weights, by rank */
+    vector<unsigned int> m_Types;       /**< QTypes of the mix */
+    vector<double> m_TypeCdf;           /**< Cumulative weights of the QTypes */
+};
+
+/*! Results of a thread
+ */
+struct TResults {
+    uint64_t m_Sent;          /**< Queries sent */
+    uint64_t m_SendErrors;    /**< Queries that could not be sent */
+    uint64_t m_Received;      /**< Responses received in time */
+    uint64_t m_Late;          /**< Responses received after the timeout */
+    uint64_t m_NoError;       /**< Responses with NOERROR */
+    uint64_t m_NxDomain;      /**< Responses with NXDOMAIN */
+    uint64_t m_OtherRCode;    /**< Responses with other codes */
+    uint64_t m_Truncated;     /**< Responses with TC */
+};
+
+/*! Thread state
+ */
+struct TThread {
+    pthread_t m_Thread;          /**< Thread */
+    unsigned int m_Index;        /**< Number of the thread */
+    const TOptions *m_Options;   /**< Options */
+    const TWorkload *m_Workload; /**< Names and types */
+    uint64_t m_Start;            /**< Time of the first query of all the threads */
+    TResults m_Results;          /**< Results */
+    CHistogram m_Latency;        /**< Latency of the responses (ns) */
+};
+
+/*! Prints the usage and leaves
+ */
+static void usage() {
+    cerr << "Usage: dnsd-bench [-s <server>] [-p <port>] [-d <hosts_file>] [-t <threads>]" << endl
+         << "                  [-r <qps>] [-l <seconds>] [-m <miss_percent>] [-z <zipf_exponent>]" << endl
+         << "                  [-q <type:weight,...>] [-e <edns_payload>] [-w <timeout_ms>]" << endl;
+    exit(1);
+}
+
+/*! Monotonic time in ns
+ */
+static uint64_t now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/*! Random number generator (xorshift64*), one per thread
+ */
+static uint64_t nextRandom(uint64_t &state) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+}
+
+/*! Uniform random number in [0, 1)
+ */
+static double uniform(uint64_t &state) {
+    return (double) (nextRandom(state) >> 11) / 9007199254740992.0;
+}
+
+/*! Returns the QType of a name (A, AAAA...) or a number, 0 if not valid
+ */
+static unsigned int parseType(const string &name) {
+    static const struct {
+        const char *m_Name;
+        unsigned int m_Type;
+    } types[] = {
+        { "A", CResourceRecord::A },
+        { "NS", CResourceRecord::NS },
+        { "CNAME", CResourceRecord::CNAME },
+        { "SOA", CResourceRecord::SOA },
+        { "PTR", CResourceRecord::PTR },
+        { "MX", CResourceRecord::MX },
+        { "TXT", CResourceRecord::TXT },
+        { "AAAA", CResourceRecord::AAAA },
+        { "ANY", CResourceRecord::ALL }
+    };
+    char *end;
+
+    for (unsigned int i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (strcasecmp(name.c_str(), types[i].m_Name) == 0) return types[i].m_Type;
+    }
+    unsigned long type = strtoul(name.c_str(), &end, 10);
+    if (name.empty() || *end != 0 || type > 65535) return 0;
+    return (unsigned int) type;
+}
+
+/*! Reads the query type mix ("A:80,AAAA:20"). It returns true if
+ *  it is not valid
+ */
+static bool parseMix(const string &mix, TWorkload &workload) {
+    stringstream s(mix);
+    string item;
+    double total = 0;
+
+    workload.m_Types.clear();
+    workload.m_TypeCdf.clear();
+    while (getline(s, item, ',')) {
+        string::size_type colon = item.find(':');
+        unsigned int type = parseType(item.substr(0, colon));
+        double weight = colon == string::npos ? 1 : strtod(item.c_str() + colon + 1, NULL);
+
+        if (type == 0 || weight <= 0) return true;
+        total += weight;
+        workload.m_Types.push_back(type);
+        workload.m_TypeCdf.push_back(total);
+    }
+    return workload.m_Types.empty();
+}
+
+/*! Reads the names of the hosts file in wire format. It returns
+ *  true if the file cannot be read or it has no names
+ */
+static bool readNames(const string &file, TWorkload &workload) {
+    ifstream in(file.c_str());
+    unsigned char wire[CDnsDb::MAX_NAME_SIZE];
+    string line;
+
+    if (!in) return true;
+    while (getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        stringstream s(line);
+        string word;
+
+        // the address, or a directive ($TTL, $SOA)
+        if (!(s >> word) || word[0] == '$') continue;
+        while (s >> word) {
+            if (word.compare(0, 4, "ttl=") == 0) continue;
+            unsigned int length = CDnsDb::toWire(word.c_str(), wire);
+            if (length == 0) continue;
+            workload.m_Offsets.push_back(workload.m_Names.size());
+            workload.m_Names.insert(workload.m_Names.end(), wire, wire + length);
+        }
+    }
+    workload.m_Offsets.push_back(workload.m_Names.size());
+    return workload.m_Offsets.size() < 2;
+}
+
+/*! Shuffles the names, so the popular ones are not the first
+ *  ones of the file, and builds the Zipf distribution
+ */
+static void prepareNames(TWorkload &workload, double exponent) {
+    unsigned long count = workload.m_Offsets.size() - 1;
+    vector<unsigned long> order(count);
+    vector<unsigned char> names;
+    vector<unsigned long> offsets;
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    double total = 0;
+
+    for (unsigned long i = 0; i < count; i++) order[i] = i;
+    for (unsigned long i = count - 1; i > 0; i--) {
+        swap(order[i], order[nextRandom(state) % (i + 1)]);
+    }
+    for (unsigned long i = 0; i < count; i++) {
+        offsets.push_back(names.size());
+        names.insert(names.end(), workload.m_Names.begin() + workload.m_Offsets[order[i]],
+                     workload.m_Names.begin() + workload.m_Offsets[order[i] + 1]);
+    }
+    offsets.push_back(names.size());
+    workload.m_Names.swap(names);
+    workload.m_Offsets.swap(offsets);
+
+    // the name of rank i is chosen with weight 1 / i^exponent
+    workload.m_Cdf.resize(count);
+    for (unsigned long i = 0; i < count; i++) {
+        total += pow((double) (i + 1), -exponent);
+        workload.m_Cdf[i] = total;
+    }
+}
+
+/*! Builds a query inside the buffer, returns its length
+ */
+static unsigned int buildQuery(const TOptions &options, const TWorkload &workload, uint64_t &state,
+                               uint16_t id, unsigned char *buffer) {
+    unsigned int length = HEADER_SIZE;
+    unsigned int type;
+
+    memset(buffer, 0, HEADER_SIZE);
+    buffer[0] = (unsigned char) (id >> 8);
+    buffer[1] = (unsigned char) id;
+    buffer[5] = 1;
+    if (options.m_Payload > 0) buffer[11] = 1;
+
+    if (uniform(state) < options.m_MissRatio) {
+        // a random name that is not in the file
+        length += (unsigned int) sprintf((char *) buffer + length + 1, "%016llx",
+                                         (unsigned long long) nextRandom(state));
+        buffer[HEADER_SIZE] = 16;
+        memcpy(buffer + length + 1, "\007invalid", 9);
+        length += 1 + 9;
+    } else {
+        const vector<double> &cdf = workload.m_Cdf;
+        unsigned long rank = (unsigned long) (upper_bound(cdf.begin(), cdf.end(), uniform(state) * cdf.back())
+                                              - cdf.begin());
+        if (rank >= cdf.size()) rank = cdf.size() - 1;
+        unsigned long nameLength = workload.m_Offsets[rank + 1] - workload.m_Offsets[rank];
+        memcpy(buffer + length, &workload.m_Names[workload.m_Offsets[rank]], nameLength);
+        length += (unsigned int) nameLength;
+    }
+
+    const vector<double> &typeCdf = workload.m_TypeCdf;
+    unsigned long index = (unsigned long) (upper_bound(typeCdf.begin(), typeCdf.end(),
+                                                       uniform(state) * typeCdf.back()) - typeCdf.begin());
+    if (index >= typeCdf.size()) index = typeCdf.size() - 1;
+    type = workload.m_Types[index];
+
+    // QType and QClass (IN)
+    buffer[length] = (unsigned char) (type >> 8);
+    buffer[length + 1] = (unsigned char) type;
+    buffer[length + 2] = 0;
+    buffer[length + 3] = CResourceRecord::IN;
+    length += 4;
+
+    if (options.m_Payload > 0) {
+        // OPT record: root, type, payload, TTL and RdLength
+        unsigned char opt[11] = { 0, 0, CResourceRecord::OPT,
+                                  (unsigned char) (options.m_Payload >> 8), (unsigned char) options.m_Payload,
+                                  0, 0, 0, 0, 0, 0 };
+        memcpy(buffer + length, opt, sizeof(opt));
+        length += sizeof(opt);
+    }
+    return length;
+}
+
+/*! Reads all the responses waiting
+ */
+static void readResponses(int fd, const TOptions &options, vector<uint64_t> &pending, unsigned long &inFlight,
+                          TResults &results, CHistogram &latencies) {
+    unsigned char buffer[MAX_MESSAGE_SIZE];
+
+    while (1) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // EAGAIN, or an error because of a lost query
+            // (ECONNREFUSED): the timeout counts it
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            continue;
+        }
+        uint64_t received = now();
+
+        // only responses to queries in flight
+        if (n < (ssize_t) HEADER_SIZE || (buffer[2] & 0x80) == 0) continue;
+        uint16_t id = (uint16_t) ((buffer[0] << 8) | buffer[1]);
+        if (pending[id] == 0) continue;
+
+        uint64_t latency = received - pending[id];
+        pending[id] = 0;
+        inFlight--;
+        if (latency > options.m_Timeout) {
+            results.m_Late++;
+            continue;
+        }
+        results.m_Received++;
+        latencies.record(latency);
+        switch (buffer[3] & 0x0f) {
+            case 0: results.m_NoError++; break;
+            case 3: results.m_NxDomain++; break;
+            default: results.m_OtherRCode++; break;
+        }
+        if (buffer[2] & 0x02) results.m_Truncated++;
+    }
+}
+
+/*! Thread entry point: sends the queries of the thread at their
+ *  times and reads the responses in between
+ */
+static void *benchThread(void *arg) {
+    TThread *thread = (TThread *) arg;
+    const TOptions &options = *thread->m_Options;
+    const TWorkload &workload = *thread->m_Workload;
+    TResults &results = thread->m_Results;
+    vector<uint64_t> pending(MAX_IDS, 0);
+    unsigned long inFlight = 0;
+    unsigned char query[HEADER_SIZE + CDnsDb::MAX_NAME_SIZE + 4 + 11];
+    uint64_t state = 0x2545f4914f6cdd1dULL * (thread->m_Index + 1);
+    uint64_t interval = (uint64_t) (1e9 * options.m_Threads / options.m_Rate);
+    uint64_t end = thread->m_Start + (uint64_t) (options.m_Duration * 1e9);
+    uint64_t next = thread->m_Start + interval * thread->m_Index / options.m_Threads;
+    uint16_t id = 0;
+    int fd;
+
+    fd = socket(workload.m_Address.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0 || connect(fd, (const struct sockaddr *) &workload.m_Address, workload.m_AddressLength) < 0) {
+        cerr << "Error opening socket" << endl;
+        exit(1);
+    }
+    // room for the responses of a burst of the server
+    int size = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    while (1) {
+        uint64_t t = now();
+
+        // the queries due, a few at a time if the
+        // thread is late so the responses are read
+        for (unsigned int burst = 0; next <= t && next < end && burst < MAX_BURST; burst++) {
+            if (pending[id] != 0) {
+                // still in flight after 65536 queries, it is lost
+                inFlight--;
+            }
+            unsigned int length = buildQuery(options, workload, state, id, query);
+            if (send(fd, query, length, 0) == (ssize_t) length) {
+                pending[id] = next;
+                inFlight++;
+            } else {
+                pending[id] = 0;
+                results.m_SendErrors++;
+            }
+            results.m_Sent++;
+            id++;
+            next += interval;
+        }
+
+        readResponses(fd, options, pending, inFlight, results, thread->m_Latency);
+
+        // after the last query, until every response arrives or times out
+        t = now();
+        if (next >= end && (inFlight == 0 || t >= end + options.m_Timeout)) break;
+
+        // waits for responses until the next query is due
+        uint64_t wake = next < end ? next : end + options.m_Timeout;
+        if (wake > t) {
+            struct pollfd pfd;
+            struct timespec timeout;
+
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            timeout.tv_sec = (time_t) ((wake - t) / 1000000000ULL);
+            timeout.tv_nsec = (long) ((wake - t) % 1000000000ULL);
+            ppoll(&pfd, 1, &timeout, NULL);
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+/*! Prints a count with its share of the queries sent
+ */
+static void printCount(const char *label, uint64_t count, uint64_t sent) {
+    cout << left << setw(12) << label << right << setw(12) << count
+         << fixed << setprecision(3) << setw(10) << (sent > 0 ? 100.0 * count / sent : 0.0) << " %" << endl;
+}
+
+int main(int argc, char **argv) {
+    TOptions options;
+    TWorkload workload;
+    string mix("A:100");
+    int opt;
+
+    options.m_Server = "127.0.0.1";
+    options.m_Port = "53";
+    options.m_HostsFile = "ip_hosts";
+    options.m_Threads = 1;
+    options.m_Rate = 10000;
+    options.m_Duration = 10;
+    options.m_MissRatio = 0.1;
+    options.m_Zipf = 1.0;
+    options.m_Payload = 0;
+    options.m_Timeout = 1000000000ULL;
+
+    while ((opt = getopt(argc, argv, "s:p:d:t:r:l:m:z:q:e:w:")) != -1) {
+        switch (opt) {
+            case 's': options.m_Server = optarg; break;
+            case 'p': options.m_Port = optarg; break;
+            case 'd': options.m_HostsFile = optarg; break;
+            case 't':
+                options.m_Threads = (unsigned int) strtoul(optarg, NULL, 10);
+                if (options.m_Threads < 1 || options.m_Threads > 256) usage();
+                break;
+            case 'r':
+                options.m_Rate = strtod(optarg, NULL);
+                if (options.m_Rate <= 0) usage();
+                break;
+            case 'l':
+                options.m_Duration = strtod(optarg, NULL);
+                if (options.m_Duration <= 0) usage();
+                break;
+            case 'm':
+                options.m_MissRatio = strtod(optarg, NULL) / 100.0;
+                if (options.m_MissRatio < 0 || options.m_MissRatio > 1) usage();
+                break;
+            case 'z':
+                options.m_Zipf = strtod(optarg, NULL);
+                if (options.m_Zipf < 0) usage();
+                break;
+            case 'q': mix = optarg; break;
+            case 'e':
+                options.m_Payload = (unsigned int) strtoul(optarg, NULL, 10);
+                if (options.m_Payload > 65535) usage();
+                break;
+            case 'w':
+                options.m_Timeout = strtoull(optarg, NULL, 10) * 1000000ULL;
+                if (options.m_Timeout == 0) usage();
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind != argc || parseMix(mix, workload)) usage();
+
+    // address of the server, ipv4 or ipv6
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(options.m_Server.c_str(), options.m_Port.c_str(), &hints, &result) != 0) {
+        cerr << "Error resolving <" << options.m_Server << ">" << endl;
+        exit(1);
+    }
+    memcpy(&workload.m_Address, result->ai_addr, result->ai_addrlen);
+    workload.m_AddressLength = result->ai_addrlen;
+    freeaddrinfo(result);
+
+    if (readNames(options.m_HostsFile, workload)) {
+        cerr << "Error reading names from <" << options.m_HostsFile << ">" << endl;
+        exit(1);
+    }
+    prepareNames(workload, options.m_Zipf);
+
+    cout << "target " << options.m_Server << " port " << options.m_Port << ", " << workload.m_Cdf.size()
+         << " names, " << options.m_Threads << " threads, " << options.m_Rate << " qps for "
+         << options.m_Duration << " s" << endl;
+
+    // a little ahead, so every thread is ready for its first query
+    vector<TThread> threads(options.m_Threads);
+    uint64_t start = now() + 10000000ULL;
+    for (unsigned int i = 0; i < options.m_Threads; i++) {
+        threads[i].m_Index = i;
+        threads[i].m_Options = &options;
+        threads[i].m_Workload = &workload;
+        threads[i].m_Start = start;
+        threads[i].m_Results = TResults();
+        if (pthread_create(&threads[i].m_Thread, NULL, benchThread, &threads[i]) != 0) {
+            cerr << "Error creating thread" << endl;
+            exit(1);
+        }
+    }
+
+    TResults total = TResults();
+    CHistogram latency;
+    for (unsigned int i = 0; i < options.m_Threads; i++) {
+        pthread_join(threads[i].m_Thread, NULL);
+
+        const TResults &results = threads[i].m_Results;
+        total.m_Sent += results.m_Sent;
+        total.m_SendErrors += results.m_SendErrors;
+        total.m_Received += results.m_Received;
+        total.m_Late += results.m_Late;
+        total.m_NoError += results.m_NoError;
+        total.m_NxDomain += results.m_NxDomain;
+        total.m_OtherRCode += results.m_OtherRCode;
+        total.m_Truncated += results.m_Truncated;
+        latency.add(threads[i].m_Latency);
+    }
+
+    uint64_t lost = total.m_Sent - total.m_Received;
+    cout << fixed << setprecision(1)
+         << "sent qps    " << setw(12) << total.m_Sent / options.m_Duration << endl
+         << "answered qps" << setw(12) << total.m_Received / options.m_Duration << endl;
+    printCount("sent", total.m_Sent, total.m_Sent);
+    printCount("answered", total.m_Received, total.m_Sent);
+    printCount("lost", lost, total.m_Sent);
+    printCount("  late", total.m_Late, total.m_Sent);
+    printCount("  not sent", total.m_SendErrors, total.m_Sent);
+    printCount("noerror", total.m_NoError, total.m_Sent);
+    printCount("nxdomain", total.m_NxDomain, total.m_Sent);
+    printCount("other rcode", total.m_OtherRCode, total.m_Sent);
+    printCount("truncated", total.m_Truncated, total.m_Sent);
+
+    cout << setprecision(1)
+         << "latency us  p50 " << latency.getPercentile(50) / 1000.0
+         << "  p99 " << latency.getPercentile(99) / 1000.0
+         << "  p999 " << latency.getPercentile(99.9) / 1000.0
+         << "  max " << latency.getMax() / 1000.0 << endl;
+    return 0;
+}
@@ -7,6 +7,44 @@
 *  It creates and mantains a structure to keep all information included
 *  inside a file "/etc/hosts" style. It also accepts request queries of it.
 *
+*  The names are kept in an open-addressing hash table: the buckets are
+*  contiguous and keep a fingerprint of the hash, so a lookup usually
+*  touches one bucket and compares one name. All the names are stored
+*  one after the other inside a single arena.
+*
+*  The names are stored in canonical wire format (length-prefixed
+*  labels, lowercase), so the QName of a query is hashed and compared
+*  in place, without converting it, and the match is case-insensitive
+*  (RFC 1035).
+*
+*  Every name of a line (the first one and its aliases) gets the address
+*  of the line, ipv4 (A record) or ipv6 (AAAA record, RFC 3596). A name
+*  found in several lines has several addresses, kept in the order of
+*  the file.
+*
+*  Once the file has been read, the answer section of every name is
+*  built in wire format and kept in another arena, so a response only
+*  needs to copy those bytes after the question of the query. The owner
+*  of every record is a compression pointer to the QName of the question
+*  (0xC00C), so the records are small and all the records of a type have
+*  the same size. All the resource records of a name are contiguous:
+*  first the A records and then the AAAA records.
+*
+*  The TTL of the records is given by the directive "$TTL <seconds>",
+*  which applies to the lines after it (0 by default), or by a token
+*  "ttl=<seconds>" inside the line. All the records of a name get the
+*  smallest TTL of its lines (RFC 2181). The negative answers carry the
+*  SOA record given by the directive
+*  "$SOA [<owner>] <mname> <rname> <serial> <refresh> <retry> <expire> <minimum>"
+*  (the owner is the root by default), or a default one whose minimum is
+*  the last $TTL, so the resolvers can cache them too (RFC 2308).
+*
+*  The table and both arenas can also be saved as a binary image
+*  (dnsd-compile). An image is mapped read-only and served as it is,
+*  without parsing or allocating anything, so the startup time does not
+*  depend on the number of names and all the processes that map the same
+*  image share the same copy inside the page cache.
+*
 *  \version 0.1
 *  \date    11-September-2006
 *  \author  Cristina Camacho Romaguera
@@ -15,103 +53,645 @@
 */
 
 #include "dnsDb.h"
+#include "answer.h"
+#include "rr.h"
 
 #include <iostream>
 #include <string>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*! First bytes of an image
+ */
+static const char IMAGE_MAGIC[8] = "DNSDBIM";
 
 /*! Constructor
  */
 CDnsDb::CDnsDb()
-        : m_Db() {
+        : m_Buckets(MIN_BUCKETS),
+          m_Names(),
+          m_Answers(),
+          m_Addresses(),
+          m_Soa(),
+          m_DefaultTTL(0),
+          m_Size(0),
+          m_Table(NULL),
+          m_Mask(0),
+          m_NameData(NULL),
+          m_AnswerData(NULL),
+          m_SoaData(NULL),
+          m_SoaLength(0),
+          m_Image(NULL),
+          m_ImageSize(0) {
+    for (unsigned long i = 0; i < m_Buckets.size(); i++) {
+        m_Buckets[i].m_Name = EMPTY;
+    }
+    publish();
 }
 
 /*! Destructor
  */
 CDnsDb::~CDnsDb() {
+    if (m_Image != NULL) munmap(m_Image, m_ImageSize);
 }
 
 /*! Reads the config file given as parameter. In the file, there
- *  are pairs of IP address and hostnames 
+ *  are pairs of IP address and hostnames. If the file is an image
+ *  built by dnsd-compile, it is mapped instead. It returns true
+ *  if there is an error
  */
 bool CDnsDb::readConfigFile(const char *inFile) {
     bool error = false;
 
-    char buffer[128];
+    char magic[sizeof(IMAGE_MAGIC)];
+    string line;
     ifstream fs(inFile, ios::in | ios::binary);
 
     if (fs) {
-        // Config file opened correctly
-        do {
-            fs.getline(reinterpret_cast<char *>(&buffer), 128);
-            parseLine(buffer);
-        } while (!fs.eof());
+        // compiled images are mapped, not parsed
+        if (fs.read(magic, sizeof(magic)) && memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0) {
+            fs.close();
+            return mapImage(inFile);
+        }
+        fs.clear();
+        fs.seekg(0);
+
+        // Config file opened correctly. The lines can be of any length
+        while (getline(fs, line)) {
+            parseLine(line);
+        }
         fs.close();
+        prepareAnswers();
     } else {
         error = true;
     }
     return error;
 }
 
+/*! Saves the database as an image that can be mapped by
+ *  readConfigFile. It returns true if there is an error
+ */
+bool CDnsDb::writeImage(const char *outFile) const {
+    TImageHeader header;
+    FILE *file;
+    bool error = false;
+
+    // the data comes from the vectors, an image is never saved again
+    if (m_Image != NULL) return true;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.m_Magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.m_Version = IMAGE_VERSION;
+    header.m_ByteOrder = IMAGE_BYTE_ORDER;
+    header.m_Buckets = m_Mask + 1;
+    header.m_Size = m_Size;
+    header.m_NamesLength = m_Names.size();
+    header.m_AnswersLength = m_Answers.size();
+    header.m_SoaLength = m_Soa.size();
+
+    file = fopen(outFile, "wb");
+    if (file == NULL) return true;
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(m_Table, sizeof(TBucket), m_Mask + 1, file) != m_Mask + 1 ||
+        fwrite(m_NameData, 1, m_Names.size(), file) != m_Names.size() ||
+        fwrite(m_AnswerData, 1, m_Answers.size(), file) != m_Answers.size() ||
+        fwrite(m_SoaData, 1, m_Soa.size(), file) != m_Soa.size()) {
+        error = true;
+    }
+    if (fclose(file) != 0) error = true;
+    return error;
+}
+
+/*! Maps an image built by writeImage. It returns true if
+ *  there is an error
+ */
+bool CDnsDb::mapImage(const char *inFile) {
+    struct stat st;
+    const TImageHeader *header;
+    void *image;
+    int fd = open(inFile, O_RDONLY);
+
+    if (fd < 0) return true;
+    if (fstat(fd, &st) < 0 || (unsigned long) st.st_size < sizeof(TImageHeader)) {
+        close(fd);
+        return true;
+    }
+    // the mapping is kept after closing the file
+    image = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) return true;
+
+    // checked once here, the lookups trust the image
+    header = (const TImageHeader *) image;
+    if (checkImage(header, (unsigned long) st.st_size)) {
+        munmap(image, (size_t) st.st_size);
+        return true;
+    }
+    // the buckets are accessed at random, reading ahead is useless
+    madvise(image, (size_t) st.st_size, MADV_RANDOM);
 
-/*! If the hostname is found in the database, the IP address
- *  in long format (compatible to the s_addr field of the 
+    m_Image = image;
+    m_ImageSize = (unsigned long) st.st_size;
+    m_Size = header->m_Size;
+    m_Table = (const TBucket *) (header + 1);
+    m_Mask = header->m_Buckets - 1;
+    m_NameData = (const unsigned char *) (m_Table + header->m_Buckets);
+    m_AnswerData = m_NameData + header->m_NamesLength;
+    m_SoaData = m_AnswerData + header->m_AnswersLength;
+    m_SoaLength = header->m_SoaLength;
+
+    // the vectors are not used any more
+    vector<TBucket>().swap(m_Buckets);
+    return false;
+}
+
+
+/*! Lowercase version of a byte. The length of a label is
+ *  never bigger than 63 so it is not modified
+ */
+static inline unsigned char lower(unsigned char c) {
+    return (unsigned char) ((unsigned char) (c - 'A') < 26 ? c + ('a' - 'A') : c);
+}
+
+/*! If the hostname (QName in wire format, of the given length
+ *  including the 0 label) is found in the database, its first IP address
+ *  in long format (compatible to the s_addr field of the
  *  in_addr structure) is returned. If the address has not been
  *  found a 0 is returned.
  */
-in_addr_t CDnsDb::getAddress(const char *name) {
-    map<const char *, unsigned long int, less_string>::iterator it = m_Db.find(name);
+in_addr_t CDnsDb::getAddress(const unsigned char *qname, unsigned int length) const {
+    unsigned long index = findBucket(qname, length, hashName(qname, length));
+    const TBucket &bucket = m_Table[index];
+    in_addr_t address;
 
-    if (it == m_Db.end()) {
+    if (bucket.m_Name == EMPTY || bucket.m_ACount == 0) {
         return 0;
     } else {
-        return (in_addr_t) (*it).second;
+        // the RData of the first A record, its last 4 bytes
+        memcpy(&address, m_AnswerData + bucket.m_Answer + bucket.m_ALength / bucket.m_ACount - 4, 4);
+        return address;
+    }
+}
+
+/*! Looks for the hostname (QName in wire format, of the given
+ *  length including the 0 label). If it is found, answer points
+ *  to its records of the given type and true is returned. The
+ *  answer has no records if the name has none of that type (NODATA).
+ *  ANY gets the A records, or the AAAA ones if there are no A
+ *  records (RFC 8482).
+ */
+bool CDnsDb::getAnswer(const unsigned char *qname, unsigned int length, unsigned int qtype,
+                       TAnswer &answer) const {
+    unsigned long index = findBucket(qname, length, hashName(qname, length));
+    const TBucket &bucket = m_Table[index];
+
+    if (bucket.m_Name == EMPTY) return false;
+
+    answer.m_Data = m_AnswerData + bucket.m_Answer;
+    answer.m_Length = 0;
+    answer.m_Count = 0;
+    if (qtype == CResourceRecord::A || (qtype == CResourceRecord::ALL && bucket.m_ACount > 0)) {
+        answer.m_Length = bucket.m_ALength;
+        answer.m_Count = bucket.m_ACount;
+    } else if (qtype == CResourceRecord::AAAA || qtype == CResourceRecord::ALL) {
+        answer.m_Data += bucket.m_ALength;
+        answer.m_Length = bucket.m_AAAALength;
+        answer.m_Count = bucket.m_AAAACount;
+    }
+    return true;
+}
+
+/*! Returns the authority section of the negative answers
+ *  (the SOA record)
+ */
+void CDnsDb::getAuthority(TAnswer &authority) const {
+    authority.m_Data = m_SoaData;
+    authority.m_Length = (unsigned int) m_SoaLength;
+    authority.m_Count = m_SoaLength > 0 ? 1 : 0;
+}
+
+/*! Adds an address (network order, 4 bytes for ipv4 or 16 for
+ *  ipv6) to a host (dotted format). The addresses of a host are
+ *  kept in the order they are added, repeated ones are ignored.
+ *  It returns true if the name is not valid or the database is a
+ *  mapped image
+ */
+bool CDnsDb::addHost(const char *name, const unsigned char *addr, unsigned int addrLength, unsigned int ttl) {
+    unsigned char wire[MAX_NAME_SIZE];
+    unsigned int length = toWire(name, wire);
+    TAddress address;
+    uint64_t hash;
+    unsigned long index;
+
+    if (length == 0 || m_Image != NULL || (addrLength != 4 && addrLength != 16)) return true;
+
+    memset(address.m_Address, 0, sizeof(address.m_Address));
+    memcpy(address.m_Address, addr, addrLength);
+    address.m_Length = addrLength;
+    address.m_TTL = ttl;
+    address.m_Next = EMPTY;
+
+    hash = hashName(wire, length);
+    index = findBucket(wire, length, hash);
+    if (m_Buckets[index].m_Name != EMPTY) {
+        uint32_t *last = &m_Buckets[index].m_Answer;
+
+        // the new address goes at the end of the list
+        while (*last != EMPTY) {
+            TAddress &other = m_Addresses[*last];
+            if (other.m_Length == addrLength && memcmp(other.m_Address, addr, addrLength) == 0) {
+                if (ttl < other.m_TTL) other.m_TTL = ttl;
+                return false;
+            }
+            last = &other.m_Next;
+        }
+        *last = (uint32_t) m_Addresses.size();
+        m_Addresses.push_back(address);
+        return false;
+    }
+
+    m_Buckets[index].m_Hash = (uint32_t) (hash >> 32);
+    m_Buckets[index].m_Name = (uint32_t) m_Names.size();
+    m_Buckets[index].m_Answer = (uint32_t) m_Addresses.size();
+    m_Buckets[index].m_ALength = 0;
+    m_Buckets[index].m_ACount = 0;
+    m_Buckets[index].m_AAAALength = 0;
+    m_Buckets[index].m_AAAACount = 0;
+    m_Names.insert(m_Names.end(), wire, wire + length);
+    m_Addresses.push_back(address);
+    m_Size++;
+
+    // never more than half full
+    if (2 * m_Size > m_Buckets.size()) grow();
+    publish();
+    return false;
+}
+
+/*! Builds the answer section of every host. It must be called
+ *  once, after the last host has been added (readConfigFile does it)
+ */
+void CDnsDb::prepareAnswers() {
+    if (m_Image != NULL) return;
+
+    m_Answers.clear();
+    for (unsigned long i = 0; i < m_Buckets.size(); i++) {
+        TBucket &bucket = m_Buckets[i];
+
+        if (bucket.m_Name == EMPTY) continue;
+
+        // The A records and then the AAAA records
+        uint32_t first = bucket.m_Answer;
+
+        bucket.m_Answer = (uint32_t) m_Answers.size();
+        appendRecords(first, CResourceRecord::A, bucket.m_ALength, bucket.m_ACount);
+        appendRecords(first, CResourceRecord::AAAA, bucket.m_AAAALength, bucket.m_AAAACount);
+    }
+    vector<TAddress>().swap(m_Addresses);
+
+    // without $SOA the server is the authority of the root
+    if (m_Soa.empty()) {
+        setSoa(".", "localhost", "hostmaster.localhost", 1, 3600, 600, 86400, m_DefaultTTL);
+    }
+    publish();
+}
+
+/*! Writes the records of a host of one type (A or AAAA) at the
+ *  end of the answers arena, from its list of addresses. The owner
+ *  of the records is a pointer to the QName of the response
+ */
+void CDnsDb::appendRecords(uint32_t first, unsigned int type, uint16_t &length, uint16_t &count) {
+    // The question always starts at offset 12, right after the header
+    static const unsigned char owner[2] = { CNameCompressor::POINTER, 12 };
+    unsigned char buffer[sizeof(owner) + 10 + CResourceRecord::MAX_RDATA_SIZE];
+    unsigned int addrLength = type == CResourceRecord::A ? 4 : 16;
+    unsigned int ttl = MAX_TTL;
+    CAnswer answer;
+
+    // One resource record per address, one after the other,
+    // all of them with the same TTL (RFC 2181)
+    for (uint32_t next = first; next != EMPTY; next = m_Addresses[next].m_Next) {
+        if (m_Addresses[next].m_Length == addrLength && m_Addresses[next].m_TTL < ttl) {
+            ttl = m_Addresses[next].m_TTL;
+        }
+    }
+    length = 0;
+    count = 0;
+    for (uint32_t next = first; next != EMPTY; next = m_Addresses[next].m_Next) {
+        if (m_Addresses[next].m_Length != addrLength) continue;
+
+        answer.reset();
+        answer.setAnswerSection(owner, sizeof(owner), type, CResourceRecord::IN,
+                                ttl, m_Addresses[next].m_Address, addrLength);
+        unsigned int rrLength = answer.getAnswerSection(buffer, sizeof(buffer));
+        // the rest of the addresses are dropped
+        if (length + rrLength > MAX_ANSWER_SIZE) break;
+        m_Answers.insert(m_Answers.end(), buffer, buffer + rrLength);
+        length = (uint16_t) (length + rrLength);
+        count++;
+    }
+}
+
+/*! Sets the SOA record of the negative answers (names in dotted
+ *  format). It returns true if a name is not valid or the database
+ *  is a mapped image
+ */
+bool CDnsDb::setSoa(const char *owner, const char *mName, const char *rName, unsigned int serial,
+                    unsigned int refresh, unsigned int retry, unsigned int expire, unsigned int minimum) {
+    unsigned char buffer[MAX_NAME_SIZE + 10 + CResourceRecord::MAX_RDATA_SIZE];
+    unsigned char ownerWire[MAX_NAME_SIZE];
+    unsigned char mNameWire[MAX_NAME_SIZE];
+    unsigned char rNameWire[MAX_NAME_SIZE];
+    unsigned int ownerLength = toWire(owner, ownerWire);
+    unsigned int mNameLength = toWire(mName, mNameWire);
+    unsigned int rNameLength = toWire(rName, rNameWire);
+    CAuthority authority;
+
+    if (ownerLength == 0 || mNameLength == 0 || rNameLength == 0 || m_Image != NULL) return true;
+
+    authority.setAuthoritySection(ownerWire, ownerLength, mNameWire, mNameLength, rNameWire, rNameLength,
+                                  serial, refresh, retry, expire, minimum);
+    unsigned int length = authority.getAuthoritySection(buffer, sizeof(buffer));
+    m_Soa.assign(buffer, buffer + length);
+    publish();
+    return false;
+}
+
+/*! Returns the number of hosts in the database
+ */
+unsigned long CDnsDb::getSize() const {
+    return m_Size;
+}
+
+/*! Converts a dotted hostname into canonical wire format (lowercase).
+ *  The buffer must have room for MAX_NAME_SIZE bytes. It returns
+ *  the length of the wire name, or 0 if the name is not valid
+ */
+unsigned int CDnsDb::toWire(const char *name, unsigned char *wire) {
+    unsigned int length = 0;
+    unsigned int label = 0;
+
+    // the root name has no labels
+    if (name[0] == '.' && name[1] == 0) {
+        wire[0] = 0;
+        return 1;
+    }
+    while (1) {
+        unsigned char c = (unsigned char) *name++;
+
+        if (c == '.' || c == 0) {
+            // empty labels are not allowed, except the final dot
+            if (length == label) {
+                if (c == 0 && length > 0) break;
+                return 0;
+            }
+            if (length - label > 63) return 0;
+            wire[label] = (unsigned char) (length - label);
+            length++;
+            label = length;
+            if (c == 0) break;
+            continue;
+        }
+        if (length + 2 >= MAX_NAME_SIZE) return 0;
+        wire[length + 1] = lower(c);
+        length++;
+    }
+    wire[length] = 0;
+    return length + 1;
+}
+
+/*! Checks an image of the given size: its header, free buckets
+ *  in the table, and every name, answer and the SOA inside their
+ *  arenas. It returns true if it cannot be served
+ */
+bool CDnsDb::checkImage(const TImageHeader *header, unsigned long size) {
+    uint64_t left = size - sizeof(TImageHeader);
+    uint64_t used = 0;
+
+    if (memcmp(header->m_Magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+        header->m_Version != IMAGE_VERSION ||
+        header->m_ByteOrder != IMAGE_BYTE_ORDER ||
+        header->m_Buckets == 0 ||
+        (header->m_Buckets & (header->m_Buckets - 1)) != 0) {
+        return true;
+    }
+
+    // every part is checked against what is left of the file,
+    // so a corrupted length cannot overflow the sum
+    if (header->m_Buckets > left / sizeof(TBucket)) return true;
+    left -= header->m_Buckets * sizeof(TBucket);
+    if (header->m_NamesLength > left) return true;
+    left -= header->m_NamesLength;
+    if (header->m_AnswersLength > left) return true;
+    left -= header->m_AnswersLength;
+    if (header->m_SoaLength != left || header->m_SoaLength > MAX_ANSWER_SIZE) return true;
+
+    // findBucket stops at the first free bucket
+    if (header->m_Size > header->m_Buckets / 2) return true;
+
+    const TBucket *table = (const TBucket *) (header + 1);
+    const unsigned char *names = (const unsigned char *) (table + header->m_Buckets);
+    for (uint64_t i = 0; i < header->m_Buckets; i++) {
+        const TBucket &bucket = table[i];
+
+        if (bucket.m_Name == EMPTY) continue;
+        used++;
+
+        // the name ends, label by label, inside its arena
+        uint64_t offset = bucket.m_Name;
+        while (offset < header->m_NamesLength && names[offset] != 0) offset += names[offset] + 1;
+        if (offset >= header->m_NamesLength) return true;
+
+        // the A and AAAA records inside theirs, and the first
+        // A record has room for the address read by getAddress
+        if ((uint64_t) bucket.m_Answer + bucket.m_ALength + bucket.m_AAAALength > header->m_AnswersLength) {
+            return true;
+        }
+        if (bucket.m_ALength < 4 * (unsigned int) bucket.m_ACount) return true;
     }
+    return used != header->m_Size;
+}
+
+/*! Length of a wire name stored in the arena, including the 0 label
+ */
+unsigned int CDnsDb::nameLength(const unsigned char *name) {
+    unsigned int length = 1;
+
+    while (name[length - 1] != 0) length += name[length - 1] + 1;
+    return length;
+}
+
+/*! Hash of a wire name (FNV-1a, 64 bits) over its lowercase form
+ */
+uint64_t CDnsDb::hashName(const unsigned char *name, unsigned int length) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (unsigned int i = 0; i < length; i++) {
+        hash ^= lower(name[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*! Finds the bucket of a wire name, or the free bucket
+ *  where it should be inserted
+ */
+unsigned long CDnsDb::findBucket(const unsigned char *name, unsigned int length, uint64_t hash) const {
+    uint32_t fingerprint = (uint32_t) (hash >> 32);
+    unsigned long index = (unsigned long) hash & m_Mask;
+
+    // linear probing, the table always has free buckets
+    while (m_Table[index].m_Name != EMPTY) {
+        const TBucket &bucket = m_Table[index];
+
+        if (bucket.m_Hash == fingerprint) {
+            // the stored name is already lowercase. It is compared
+            // byte by byte, stopping at the first difference: while
+            // all the bytes match both names have the same labels, so
+            // the stored one is never read past its end
+            const unsigned char *stored = m_NameData + bucket.m_Name;
+            unsigned int i = 0;
+            while (i < length && lower(name[i]) == stored[i]) i++;
+            if (i == length) return index;
+        }
+        index = (index + 1) & m_Mask;
+    }
+    return index;
+}
+
+/*! Doubles the size of the table
+ */
+void CDnsDb::grow() {
+    vector<TBucket> old(m_Buckets.size() * 2);
+    unsigned long mask = old.size() - 1;
+
+    for (unsigned long i = 0; i < old.size(); i++) {
+        old[i].m_Name = EMPTY;
+    }
+    old.swap(m_Buckets);
+
+    // the names stay in the arena, only the buckets are moved
+    for (unsigned long i = 0; i < old.size(); i++) {
+        if (old[i].m_Name == EMPTY) continue;
+
+        // the hash of the name is not kept, it is computed again
+        const unsigned char *name = &m_Names[old[i].m_Name];
+        unsigned long index = (unsigned long) hashName(name, nameLength(name)) & mask;
+        while (m_Buckets[index].m_Name != EMPTY) {
+            index = (index + 1) & mask;
+        }
+        m_Buckets[index] = old[i];
+    }
+    publish();
+}
+
+/*! Points the lookups to the table and the arenas after
+ *  they have been modified
+ */
+void CDnsDb::publish() {
+    m_Table = m_Buckets.data();
+    m_Mask = m_Buckets.size() - 1;
+    m_NameData = m_Names.data();
+    m_AnswerData = m_Answers.data();
+    m_SoaData = m_Soa.data();
+    m_SoaLength = m_Soa.size();
 }
 
 /*! Parses a line within the file
  */
-void CDnsDb::parseLine(char *buffer) {
-    string strAux(buffer);
-    unsigned long ind_end;
+void CDnsDb::parseLine(const string &strAux) {
+    unsigned long ind_end = 0;
     unsigned long ind_beg;
-    string address, *name;
-    bool address_found = false;
-    struct in_addr inp;
-
-    do {
-        address.erase();
-        // skip all possible spaces, ind_beg points to the first element
-        ind_beg = strAux.find_first_not_of(" \t");
-        // from the first element, I am looking for the next space, then I will have the first string
-        ind_end = strAux.find_first_of(" \t", ind_beg);
-        // address it now contains the IP address
-        if (ind_beg == ind_end) {
-            // blank line
-            return;
-        }
-        address.append(strAux.substr(ind_beg, ind_end - ind_beg));
-        if (address[0] == '#') {
-            // skip this line as it's a comment
+    vector<string> words;
+    unsigned char address[16];
+    unsigned int addressLength = 4;
+    unsigned int ttl = m_DefaultTTL;
+
+    // split the line in words, until the end of the line or a comment
+    while (1) {
+        // skip all possible spaces, ind_beg points to the next element
+        ind_beg = strAux.find_first_not_of(" \t\r", ind_end);
+        if (ind_beg == string::npos || strAux[ind_beg] == '#') break;
+        // from that element, I am looking for the next space, then I will have the next string
+        ind_end = strAux.find_first_of(" \t\r", ind_beg);
+        words.push_back(strAux.substr(ind_beg, ind_end - ind_beg));
+        if (ind_end == string::npos) break;
+    }
+    if (words.empty()) {
+        // blank line or comment
+        return;
+    }
+    if (words[0][0] == '$') {
+        parseDirective(words);
+        return;
+    }
+
+    // the first word is the IP address, ipv4 or ipv6
+    if (inet_pton(AF_INET, words[0].c_str(), address) != 1) {
+        if (inet_pton(AF_INET6, words[0].c_str(), address) != 1) {
             return;
         }
-        // check if it is an ipv4 address
-        struct sockaddr_in sa;
-        if (inet_pton(AF_INET, address.data(), &(sa.sin_addr)) == 0) {
+        addressLength = 16;
+    }
+    // the TTL is for all the names of the line
+    for (unsigned long i = 1; i < words.size(); i++) {
+        if (words[i].compare(0, 4, "ttl=") == 0 && parseTTL(words[i].substr(4), ttl)) {
             return;
         }
-        if (inet_aton(address.data(), &inp)) {
-            address_found = true;
-        }
-    } while (!address_found);
+    }
 
     // Now the the IP address has been found and I'm keeping the hostname
-    // For now, let's assume there is only one name for each IP address
+    // and all its aliases
+    for (unsigned long i = 1; i < words.size(); i++) {
+        if (words[i].compare(0, 4, "ttl=") == 0) continue;
+        addHost(words[i].c_str(), address, addressLength, ttl);
+    }
+}
+
+/*! Parses a directive ($TTL or $SOA) split in words. It
+ *  returns true if it is not valid
+ */
+bool CDnsDb::parseDirective(const vector<string> &words) {
+    if (words[0] == "$TTL") {
+        if (words.size() != 2) return true;
+        return parseTTL(words[1], m_DefaultTTL);
+    }
+    if (words[0] == "$SOA") {
+        // the owner is optional
+        unsigned long first = words.size() == 9 ? 2 : 1;
+        unsigned int values[5];
+
+        if (words.size() != 8 && words.size() != 9) return true;
+        for (unsigned int i = 0; i < 5; i++) {
+            char *end;
+            unsigned long value = strtoul(words[first + 2 + i].c_str(), &end, 10);
+            if (*end != 0 || value > 0xffffffffUL) return true;
+            values[i] = (unsigned int) value;
+        }
+        // the minimum is a TTL too (RFC 2308)
+        if (values[4] > MAX_TTL) return true;
+        return setSoa(first == 2 ? words[1].c_str() : ".", words[first].c_str(), words[first + 1].c_str(),
+                      values[0], values[1], values[2], values[3], values[4]);
+    }
+    return true;
+}
+
+/*! Reads a TTL (decimal seconds). It returns true if it is not valid
+ */
+bool CDnsDb::parseTTL(const string &text, unsigned int &ttl) {
+    char *end;
+    unsigned long value;
 
-    ind_beg = strAux.find_first_not_of(" \t", ind_end + 1);
-    ind_end = strAux.find_first_of(" \t", ind_beg);
-    name = new string(strAux.substr(ind_beg, ind_end - ind_beg));
-    m_Db[name->c_str()] = inp.s_addr;
+    if (text.empty() || text[0] < '0' || text[0] > '9') return true;
+    value = strtoul(text.c_str(), &end, 10);
+    if (*end != 0 || value > MAX_TTL) return true;
+    ttl = (unsigned int) value;
+    return false;
 }
@@ -7,6 +7,44 @@
 *  It creates and mantains a structure to keep all information included
 *  inside a file "/etc/hosts" style. It also accepts request queries of it.
 *
+*  The names are kept in an open-addressing hash table: the buckets are
+*  contiguous and keep a fingerprint of the hash, so a lookup usually
+*  touches one bucket and compares one name. All the names are stored
+*  one after the other inside a single arena.
+*
+*  The names are stored in canonical wire format (length-prefixed
+*  labels, lowercase), so the QName of a query is hashed and compared
+*  in place, without converting it, and the match is case-insensitive
+*  (RFC 1035).
+*
+*  Every name of a line (the first one and its aliases) gets the address
+*  of the line, ipv4 (A record) or ipv6 (AAAA record, RFC 3596). A name
+*  found in several lines has several addresses, kept in the order of
+*  the file.
+*
+*  Once the file has been read, the answer section of every name is
+*  built in wire format and kept in another arena, so a response only
+*  needs to copy those bytes after the question of the query. The owner
+*  of every record is a compression pointer to the QName of the question
+*  (0xC00C), so the records are small and all the records of a type have
+*  the same size. All the resource records of a name are contiguous:
+*  first the A records and then the AAAA records.
+*
+*  The TTL of the records is given by the directive "$TTL <seconds>",
+*  which applies to the lines after it (0 by default), or by a token
+*  "ttl=<seconds>" inside the line. All the records of a name get the
+*  smallest TTL of its lines (RFC 2181). The negative answers carry the
+*  SOA record given by the directive
+*  "$SOA [<owner>] <mname> <rname> <serial> <refresh> <retry> <expire> <minimum>"
+*  (the owner is the root by default), or a default one whose minimum is
+*  the last $TTL, so the resolvers can cache them too (RFC 2308).
+*
+*  The table and both arenas can also be saved as a binary image
+*  (dnsd-compile). An image is mapped read-only and served as it is,
+*  without parsing or allocating anything, so the startup time does not
+*  depend on the number of names and all the processes that map the same
+*  image share the same copy inside the page cache.
+*
 *  \version 0.1
 *  \date    11-September-2006
 *  \author  Cristina Camacho Romaguera
@@ -17,20 +55,21 @@
 #ifndef _DNS_DB_H
 #define _DNS_DB_H
 
-#include <map>
 #include <string>
+#include <vector>
+#include <stdint.h>
 
 /*! \class CDnsDb
  *  \brief It takes care of the dns database
  *
  *   CDnsDb reads the information stored withing the configuration file
- *   and keep it inside a map data type. Then everytime it is necessary
+ *   and keep it inside a hash table. Then everytime it is necessary
  *   to match a hostname with an ip address, this class returns the 
  *   ip address if it has been found inside the db, otherwise it will
  *   return a 0.
  *
- *   A future improvement will be to have alias, meaning more than a
- *   name for the same ip address. For now, the matching is one to one.
+ *   A name can have several addresses and an address several names
+ *   (aliases).
  *
  */
 using namespace std;
@@ -45,37 +84,208 @@ public:
      */
     ~CDnsDb();
 
+    /*! Answer section ready to be copied inside a response
+     */
+    struct TAnswer {
+        const unsigned char *m_Data;  /**< resource records in wire format */
+        unsigned int m_Length;        /**< bytes of the resource records */
+        unsigned int m_Count;         /**< number of resource records */
+    };
+
     /*! Reads the config file given as parameter. In the file, there
-     *  are pairs of IP address and hostnames
+     *  are pairs of IP address and hostnames. If the file is an image
+     *  built by dnsd-compile, it is mapped instead. It returns true
+     *  if there is an error
      */
     bool readConfigFile(const char *inFile);
 
-    /*! If the hostname is found in the database, the IP address
+    /*! Saves the database as an image that can be mapped by
+     *  readConfigFile. It returns true if there is an error
+     */
+    bool writeImage(const char *outFile) const;
+
+    /*! Looks for the hostname (QName in wire format, of the given
+     *  length including the 0 label). If it is found, answer points
+     *  to its records of the given type and true is returned. The
+     *  answer has no records if the name has none of that type (NODATA).
+     *  ANY gets the A records, or the AAAA ones if there are no A
+     *  records (RFC 8482).
+     */
+    bool getAnswer(const unsigned char *qname, unsigned int length, unsigned int qtype,
+                   TAnswer &answer) const;
+
+    /*! If the hostname (QName in wire format, of the given length
+     *  including the 0 label) is found in the database, its first IP address
      *  in long format (compatible to the s_addr field of the
      *  in_addr structure) is returned. If the address has not been
      *  found a 0 is returned.
+     *  The database is not modified once loaded, so several workers
+     *  can query it at the same time.
+     */
+    unsigned int getAddress(const unsigned char *qname, unsigned int length) const;
+
+    /*! Returns the authority section of the negative answers
+     *  (the SOA record)
+     */
+    void getAuthority(TAnswer &authority) const;
+
+    /*! Adds an address (network order, 4 bytes for ipv4 or 16 for
+     *  ipv6) to a host (dotted format). The addresses of a host are
+     *  kept in the order they are added, repeated ones are ignored.
+     *  It returns true if the name is not valid or the database is a
+     *  mapped image
+     */
+    bool addHost(const char *name, const unsigned char *addr, unsigned int addrLength, unsigned int ttl);
+
+    /*! Sets the SOA record of the negative answers (names in dotted
+     *  format). It returns true if a name is not valid or the database
+     *  is a mapped image
+     */
+    bool setSoa(const char *owner, const char *mName, const char *rName, unsigned int serial,
+                unsigned int refresh, unsigned int retry, unsigned int expire, unsigned int minimum);
+
+    /*! Builds the answer section of every host. It must be called
+     *  once, after the last host has been added (readConfigFile does it)
      */
-    unsigned int getAddress(const char *name);
+    void prepareAnswers();
+
+    /*! Returns the number of hosts in the database
+     */
+    unsigned long getSize() const;
+
+    /*! Converts a dotted hostname into canonical wire format (lowercase).
+     *  The buffer must have room for MAX_NAME_SIZE bytes. It returns
+     *  the length of the wire name, or 0 if the name is not valid
+     */
+    static unsigned int toWire(const char *name, unsigned char *wire);
+
+    /*! Hash of a wire name (FNV-1a, 64 bits) over its lowercase form
+     */
+    static uint64_t hashName(const unsigned char *name, unsigned int length);
+
+    static const unsigned int MAX_NAME_SIZE = 255;  /**< Max size of a domain name (RFC 1035) */
 
 private:
-    /*! Comparison
+    /*! Bucket of the hash table
      */
-    class less_string {
-    public:
-        bool operator()(const char *s1, const char *s2) const {
-            return strcmp(s1, s2) < 0;
-        }
+    struct TBucket {
+        uint32_t m_Hash;      /**< upper bits of the hash of the name */
+        uint32_t m_Name;      /**< offset of the name inside the arena, EMPTY if free */
+        uint32_t m_Answer;    /**< offset of the answer section inside its arena. Until the
+                                   answers are prepared, first address inside m_Addresses */
+        uint16_t m_ALength;   /**< length of the A records, at the beginning of the answer */
+        uint16_t m_ACount;    /**< number of A records */
+        uint16_t m_AAAALength; /**< length of the AAAA records, after the A ones */
+        uint16_t m_AAAACount; /**< number of AAAA records */
     };
 
+    /*! Address of a host, only used while the
+     *  database is being built
+     */
+    struct TAddress {
+        unsigned char m_Address[16]; /**< address, network order */
+        uint32_t m_Length;    /**< 4 for ipv4, 16 for ipv6 */
+        uint32_t m_TTL;       /**< TTL of the line of the address */
+        uint32_t m_Next;      /**< next address inside m_Addresses, EMPTY if last */
+    };
+
+    /*! Header of an image. It is followed by the buckets, the
+     *  names and the answer sections, all of them with the same
+     *  layout they have in memory. The offsets are relative to
+     *  their arenas, so the image can be mapped anywhere.
+     */
+    struct TImageHeader {
+        char m_Magic[8];          /**< IMAGE_MAGIC */
+        uint32_t m_Version;       /**< IMAGE_VERSION */
+        uint32_t m_ByteOrder;     /**< IMAGE_BYTE_ORDER as written by the compiler */
+        uint64_t m_Buckets;       /**< number of buckets, power of 2 */
+        uint64_t m_Size;          /**< number of hosts */
+        uint64_t m_NamesLength;   /**< bytes of the names arena */
+        uint64_t m_AnswersLength; /**< bytes of the answers arena */
+        uint64_t m_SoaLength;     /**< bytes of the SOA record, after the answers */
+        uint64_t m_Reserved;      /**< up to 64 bytes */
+    };
+
+    static const uint32_t EMPTY = 0xffffffff;  /**< Name of a free bucket */
+    static const uint32_t IMAGE_VERSION = 4;   /**< Version of the image layout */
+    static const uint32_t IMAGE_BYTE_ORDER = 0x01020304; /**< Detects images of other architectures */
+    static const unsigned long MIN_BUCKETS = 64; /**< Initial size of the table */
+    static const unsigned int MAX_ANSWER_SIZE = 65535; /**< Max size of the answer section of a host */
+    static const unsigned int MAX_TTL = 0x7fffffff;    /**< Max TTL (RFC 2181) */
+
+    /*! Length of a wire name stored in the arena, including the 0 label
+     */
+    static unsigned int nameLength(const unsigned char *name);
+
+    /*! Finds the bucket of a wire name, or the free bucket
+     *  where it should be inserted
+     */
+    unsigned long findBucket(const unsigned char *name, unsigned int length, uint64_t hash) const;
+
+    /*! Doubles the size of the table
+     */
+    void grow();
+
+    /*! Writes the records of a host of one type (A or AAAA) at the
+     *  end of the answers arena, from its list of addresses. The owner
+     *  of the records is a pointer to the QName of the response
+     */
+    void appendRecords(uint32_t first, unsigned int type, uint16_t &length, uint16_t &count);
+
+    /*! Points the lookups to the table and the arenas after
+     *  they have been modified
+     */
+    void publish();
+
+    /*! Maps an image built by writeImage. It returns true if
+     *  there is an error
+     */
+    bool mapImage(const char *inFile);
+
+    /*! Checks an image of the given size: its header, free buckets
+     *  in the table, and every name, answer and the SOA inside their
+     *  arenas. It returns true if it cannot be served
+     */
+    static bool checkImage(const TImageHeader *header, unsigned long size);
+
     /*! Parses a line within the file
      */
-    void parseLine(char *buffer);
+    void parseLine(const string &strAux);
+
+    /*! Parses a directive ($TTL or $SOA) split in words. It
+     *  returns true if it is not valid
+     */
+    bool parseDirective(const vector<string> &words);
+
+    /*! Reads a TTL (decimal seconds). It returns true if it is not valid
+     */
+    static bool parseTTL(const string &text, unsigned int &ttl);
 
     /*! Data structure to keep the database with all the
-     *  information. There is only one pair hostname, ip.
+     *  information. Every name (aliases included) has a bucket
+     *  with its name in m_Names and its answer section in
+     *  m_Answers: all its A records, then all its AAAA records.
+     *  The number of buckets is a power of 2 and the table
+     *  is never more than half full.
      */
-    std::map<const char *, unsigned long int, less_string> m_Db;
+    vector<TBucket> m_Buckets;
+    vector<unsigned char> m_Names;  /**< Arena with all the names, wire format */
+    vector<unsigned char> m_Answers; /**< Arena with all the answer sections, wire format */
+    vector<TAddress> m_Addresses;   /**< Addresses of the hosts, until the answers are prepared */
+    vector<unsigned char> m_Soa;    /**< SOA record of the negative answers, wire format */
+    unsigned int m_DefaultTTL;      /**< TTL of the lines without ttl= ($TTL) */
+    unsigned long m_Size;     /**< Number of hosts */
+
+    // The lookups only use these pointers, that refer to the
+    // vectors above or to a mapped image
+    const TBucket *m_Table;            /**< Buckets */
+    unsigned long m_Mask;              /**< Number of buckets - 1 */
+    const unsigned char *m_NameData;   /**< Names arena */
+    const unsigned char *m_AnswerData; /**< Answers arena */
+    const unsigned char *m_SoaData;    /**< SOA record */
+    unsigned long m_SoaLength;         /**< Length of the SOA record */
+    void *m_Image;                     /**< Mapped image, NULL if none */
+    unsigned long m_ImageSize;         /**< Size of the mapped image */
 };
 
 #endif
-
@@ -0,0 +1,248 @@
+/*!
+*****************************************************************************
+*  \file dnsDbManager.cpp
+*
+*  \brief   Publication and hot reload of the dns database
+*
+*  The workers never wait for a reload. A new CDnsDb is built from the
+*  file by a background thread, it is published with an atomic swap of
+*  the current pointer, and the old one is deleted only when no worker
+*  can be using it any more (RCU style, quiescent states):
+*
+*  - Every worker is a reader with its own epoch. It announces the global
+*    epoch before taking the current database and announces 0 (offline)
+*    when it has finished with it, that is, after every batch and always
+*    before waiting for new messages.
+*  - After the swap the global epoch is incremented, and the old database
+*    is deleted once every reader is offline or has announced the new
+*    epoch.
+*
+*  A reload is triggered by SIGHUP and, optionally, by any change of the
+*  file (inotify on its directory, so files replaced by a rename are also
+*  seen).
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#include "dnsDbManager.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+
+/*! Constructor. maxReaders is the number of workers
+ *  that will register
+ */
+CDnsDbManager::CDnsDbManager(const char *file, unsigned int maxReaders)
+        : m_File(file),
+          m_Current(NULL),
+          m_Epoch(1),
+          m_Readers(new TReader[maxReaders]),
+          m_MaxReaders(maxReaders),
+          m_NumReaders(0),
+          m_Watch(false),
+          m_Reloader() {
+    for (unsigned int i = 0; i < maxReaders; i++) {
+        m_Readers[i].m_Epoch.store(0);
+    }
+}
+
+/*! Destructor
+ */
+CDnsDbManager::~CDnsDbManager() {
+    delete m_Current.load();
+    delete[] m_Readers;
+}
+
+/*! Changes the file of the database. It must be called before open()
+ */
+void CDnsDbManager::setFile(const string &file) {
+    m_File = file;
+}
+
+/*! Returns the file of the database
+ */
+const string &CDnsDbManager::getFile() const {
+    return m_File;
+}
+
+/*! Loads the file for the first time. It returns true if there is an error
+ */
+bool CDnsDbManager::open() {
+    CDnsDb *db = new CDnsDb();
+
+    if (db->readConfigFile(m_File.c_str())) {
+        delete db;
+        return true;
+    }
+    m_Current.store(db);
+    return false;
+}
+
+/*! Blocks the reload signal in the calling thread. It must be
+ *  called before any other thread is created, so they inherit it
+ */
+void CDnsDbManager::blockSignals() {
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+/*! Starts the thread that reloads the database on SIGHUP and, if
+ *  watch is set, when the file changes. SIGHUP must be blocked in
+ *  all the threads, see blockSignals()
+ */
+void CDnsDbManager::startReloader(bool watch) {
+    m_Watch = watch;
+    if (pthread_create(&m_Reloader, NULL, reloaderThread, this) != 0) {
+        cerr << "Error creating reloader thread" << endl;
+        exit(0);
+    }
+    pthread_detach(m_Reloader);
+}
+
+/*! Registers a new reader and returns its identifier
+ */
+unsigned int CDnsDbManager::registerReader() {
+    unsigned int reader = m_NumReaders.fetch_add(1);
+
+    if (reader >= m_MaxReaders) {
+        cerr << "Error registering database reader" << endl;
+        exit(0);
+    }
+    return reader;
+}
+
+/*! Returns the current database. It can be used until leave() is
+ *  called by the same reader
+ */
+const CDnsDb *CDnsDbManager::enter(unsigned int reader) {
+    // the epoch must be visible before the pointer is read,
+    // otherwise the writer could miss this reader
+    m_Readers[reader].m_Epoch.store(m_Epoch.load());
+    return m_Current.load();
+}
+
+/*! The reader does not use the database any more
+ */
+void CDnsDbManager::leave(unsigned int reader) {
+    m_Readers[reader].m_Epoch.store(0, memory_order_release);
+}
+
+/*! Builds a new database from the file and publishes it. It returns
+ *  true if the file could not be read (the current one is kept)
+ */
+bool CDnsDbManager::reload() {
+    CDnsDb *db = new CDnsDb();
+    CDnsDb *old;
+    uint64_t epoch;
+
+    // the workers keep using the current database meanwhile
+    if (db->readConfigFile(m_File.c_str())) {
+        delete db;
+        return true;
+    }
+
+    old = m_Current.exchange(db);
+    epoch = m_Epoch.fetch_add(1) + 1;
+    waitReaders(epoch);
+    delete old;
+    return false;
+}
+
+/*! Waits until no reader can be using a database
+ *  replaced before the given epoch
+ */
+void CDnsDbManager::waitReaders(uint64_t epoch) {
+    unsigned int readers = m_NumReaders.load();
+
+    for (unsigned int i = 0; i < readers; i++) {
+        while (1) {
+            uint64_t current = m_Readers[i].m_Epoch.load();
+            if (current == 0 || current >= epoch) break;
+            // the reader is processing a batch, it will not take long
+            sched_yield();
+        }
+    }
+}
+
+/*! Reloader thread
+ */
+void *CDnsDbManager::reloaderThread(void *arg) {
+    CDnsDbManager *manager = (CDnsDbManager *) arg;
+    struct pollfd fds[2];
+    sigset_t mask;
+    int nfds = 1;
+    string dir(".");
+    string base(manager->m_File);
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    fds[0].fd = signalfd(-1, &mask, 0);
+    fds[0].events = POLLIN;
+    if (fds[0].fd < 0) {
+        cerr << "Error creating signalfd for SIGHUP" << endl;
+        return NULL;
+    }
+
+    // the directory is watched, editors usually replace the file
+    if (manager->m_Watch) {
+        unsigned long slash = manager->m_File.rfind('/');
+        if (slash != string::npos) {
+            dir = manager->m_File.substr(0, slash + 1);
+            base = manager->m_File.substr(slash + 1);
+        }
+        fds[1].fd = inotify_init1(IN_NONBLOCK);
+        fds[1].events = POLLIN;
+        if (fds[1].fd < 0 ||
+            inotify_add_watch(fds[1].fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+            cerr << "Error watching <" << manager->m_File << ">, only SIGHUP reloads it" << endl;
+        } else {
+            nfds = 2;
+        }
+    }
+
+    while (1) {
+        bool changed = false;
+
+        if (poll(fds, (nfds_t) nfds, -1) < 0) continue;
+
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            if (read(fds[0].fd, &info, sizeof(info)) == (ssize_t) sizeof(info)) changed = true;
+        }
+        if (nfds == 2 && (fds[1].revents & POLLIN)) {
+            // several events arrive together when a file is written,
+            // they are all read after a short while
+            usleep(100000);
+            char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+            ssize_t length;
+            while ((length = read(fds[1].fd, events, sizeof(events))) > 0) {
+                for (char *p = events; p < events + length;) {
+                    struct inotify_event *event = (struct inotify_event *) p;
+                    if (event->len > 0 && base == event->name) changed = true;
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+        }
+
+        if (changed) {
+            if (manager->reload()) {
+                cerr << "Error reloading <" << manager->m_File << ">, keeping the previous one" << endl;
+            }
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,126 @@
+/*!
+*****************************************************************************
+*  \file dnsDbManager.h
+*
+*  \brief   Publication and hot reload of the dns database
+*
+*  The workers never wait for a reload. A new CDnsDb is built from the
+*  file by a background thread, it is published with an atomic swap of
+*  the current pointer, and the old one is deleted only when no worker
+*  can be using it any more (RCU style, quiescent states):
+*
+*  - Every worker is a reader with its own epoch. It announces the global
+*    epoch before taking the current database and announces 0 (offline)
+*    when it has finished with it, that is, after every batch and always
+*    before waiting for new messages.
+*  - After the swap the global epoch is incremented, and the old database
+*    is deleted once every reader is offline or has announced the new
+*    epoch.
+*
+*  A reload is triggered by SIGHUP and, optionally, by any change of the
+*  file (inotify on its directory, so files replaced by a rename are also
+*  seen).
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#ifndef _DNS_DB_MANAGER_H
+#define _DNS_DB_MANAGER_H
+
+#include "dnsDb.h"
+
+#include <string>
+#include <atomic>
+#include <stdint.h>
+#include <pthread.h>
+
+/*! \class CDnsDbManager
+ *  \brief It keeps the current database and reloads it
+ *
+ */
+using namespace std;
+
+class CDnsDbManager {
+public:
+    /*! Constructor. maxReaders is the number of workers
+     *  that will register
+     */
+    CDnsDbManager(const char *file, unsigned int maxReaders);
+
+    /*! Destructor
+     */
+    ~CDnsDbManager();
+
+    /*! Changes the file of the database. It must be called before open()
+     */
+    void setFile(const string &file);
+
+    /*! Returns the file of the database
+     */
+    const string &getFile() const;
+
+    /*! Loads the file for the first time. It returns true if there is an error
+     */
+    bool open();
+
+    /*! Starts the thread that reloads the database on SIGHUP and, if
+     *  watch is set, when the file changes. SIGHUP must be blocked in
+     *  all the threads, see blockSignals()
+     */
+    void startReloader(bool watch);
+
+    /*! Blocks the reload signal in the calling thread. It must be
+     *  called before any other thread is created, so they inherit it
+     */
+    static void blockSignals();
+
+    /*! Registers a new reader and returns its identifier
+     */
+    unsigned int registerReader();
+
+    /*! Returns the current database. It can be used until leave() is
+     *  called by the same reader
+     */
+    const CDnsDb *enter(unsigned int reader);
+
+    /*! The reader does not use the database any more
+     */
+    void leave(unsigned int reader);
+
+    /*! Builds a new database from the file and publishes it. It returns
+     *  true if the file could not be read (the current one is kept)
+     */
+    bool reload();
+
+private:
+    /*! Epoch of a reader, alone in its cache line
+     */
+    struct TReader {
+        atomic<uint64_t> m_Epoch;  /**< 0 if offline */
+        char m_Padding[64 - sizeof(atomic<uint64_t>)];
+    };
+
+    /*! Waits until no reader can be using a database
+     *  replaced before the given epoch
+     */
+    void waitReaders(uint64_t epoch);
+
+    /*! Reloader thread
+     */
+    static void *reloaderThread(void *arg);
+
+    string m_File;                   /**< File with the hosts */
+    atomic<CDnsDb *> m_Current;      /**< Current database */
+    atomic<uint64_t> m_Epoch;        /**< Global epoch, starts at 1 */
+    TReader *m_Readers;              /**< Epochs of the readers */
+    unsigned int m_MaxReaders;       /**< Size of m_Readers */
+    atomic<unsigned int> m_NumReaders; /**< Readers registered */
+    bool m_Watch;                    /**< Reload when the file changes */
+    pthread_t m_Reloader;            /**< Reloader thread */
+};
+
+#endif
@@ -13,6 +13,52 @@
 *  a different location and that is the reason of accepting it as parameter
 *  of the binary file.
 *
+*  The number of workers (threads) can be chosen with the option "-t".
+*  Each worker has its own socket on the dns port and its own log file.
+*  With "-t 0" one worker per online processor is started.
+*
+*  With "-b" every worker reads up to that number of requests per system
+*  call (recvmmsg) and sends all the responses with one call (sendmmsg).
+*
+*  With "-q" every query is stored in a binary ring file mapped in memory
+*  ("-Q" records, 1048576 by default), which dnsd-qlog decodes, instead of
+*  dumped in hexadecimal to the text log.
+*
+*  The hosts file is "ip_hosts" unless "-d" gives another one. It can be
+*  a text file or an image built by dnsd-compile, which is mapped in
+*  memory instead of parsed.
+*
+*  A name can have several addresses. With "-r" every response starts by
+*  the next one (round robin), so the clients are spread among them.
+*
+*  The hosts file is reloaded without stopping the service on SIGHUP
+*  and, with "-w", every time the file changes.
+*
+*  The queries are also served over TCP on the same port. "-c" limits
+*  the number of TCP connections at the same time (1024 by default)
+*  and "-i" the seconds a connection can be idle (10 by default).
+*
+*  "-p" changes the port of UDP and TCP (53 by default), so a server
+*  can run without privileges, for instance to be measured by dnsd-bench.
+*
+*  With "-m" the counters of the server (queries by type, responses by
+*  code, errors and the latencies of every stage) are exported in the
+*  Prometheus text format at http://127.0.0.1:<port>/metrics.
+*
+*  With "-u" the names that are not in the hosts file are asked to the
+*  given upstream servers (comma separated, "address[@port]") instead of
+*  answered with NXDOMAIN. Their responses are kept in a cache of "-C"
+*  megabytes (64 by default). The fastest healthy upstream is asked
+*  first; with "-H" a query still without response after that many ms
+*  is sent to a second upstream too, and the first response wins.
+*  With "-P" a cached answer hit in the last percent of its TTL is asked
+*  again in the background, and with "-S" an expired one is served for
+*  that many seconds more while it is asked again (RFC 8767).
+*
+*  With "-s" the cache is loaded from that snapshot file when the server
+*  starts, and saved to it every "-W" seconds (300 by default, 0 only on
+*  exit) and on SIGTERM or SIGINT, before leaving.
+*
 *  \version 0.1
 *  \date    11-September-2006
 *  \author  Cristina Camacho Romaguera
@@ -20,40 +66,147 @@
 *****************************************************************************
 */
 
-#include "dns.h"
+#include "workerPool.h"
 #include <iostream>
 #include <sys/types.h>
 #include <unistd.h>
+#include <cstdlib>
 
 using namespace std;
 
+/*! Prints the usage and leaves
+ */
+static void usage() {
+    cerr << "Usage: dnsd [-f <log_file>] [-d <hosts_file>] [-t <threads>] [-b <batch_size>]" << endl
+         << "            [-q <query_log_file> [-Q <records>]] [-w] [-r]" << endl
+         << "            [-c <tcp_connections>] [-i <tcp_idle_seconds>] [-p <port>]" << endl
+         << "            [-m <metrics_port>] [-u <upstream>[,<upstream>...] [-C <cache_mb>]" << endl
+         << "            [-H <hedge_ms>] [-P <prefetch_percent>] [-S <stale_seconds>]" << endl
+         << "            [-s <snapshot_file> [-W <snapshot_seconds>]]]" << endl;
+    exit(0);
+}
+
 // Main function
 int main(int argc, char **argv) {
-    string logFile;
+    // Default log file
+    string logFile("/var/log/dnsLog.txt");
+    long workers = 1;
+    long batchSize = 1;
+    string queryLogFile;
+    long queryLogRecords = 1 << 20;
+    string dbFile;
+    bool watch = false;
+    bool rotate = false;
+    long tcpConnections = 1024;
+    long tcpIdleTimeout = 10;
+    long port = CDns::DNS_PORT;
+    long metricsPort = 0;
+    string upstreams;
+    long cacheSize = 64;
+    long hedgeDelay = 0;
+    long prefetch = 0;
+    long serveStale = 0;
+    string snapshotFile;
+    long snapshotInterval = 300;
+    int opt;
 
-    if (argc == 3) {
-        if (strcmp(argv[1], "-f") == 0) {
-            string lf(argv[2]);
-            logFile = lf;
-        } else {
-            cerr << "Usage: dnsd -f <log_file>" << endl;
-            exit(0);
-        }
-    } else {
-        if (argc == 1) {
-            // Default log file
-            string lf("/var/log/dnsLog.txt");
-            logFile = lf;
-        } else {
-            cerr << "Usage: dnsd -f <log_file>" << endl;
-            exit(0);
+    while ((opt = getopt(argc, argv, "f:d:t:b:q:Q:wrc:i:p:m:u:C:H:P:S:s:W:")) != -1) {
+        switch (opt) {
+            case 'f':
+                logFile = optarg;
+                break;
+            case 'd':
+                dbFile = optarg;
+                break;
+            case 't':
+                workers = strtol(optarg, NULL, 10);
+                if (workers < 0) usage();
+                if (workers == 0) {
+                    // one worker per online processor
+                    workers = sysconf(_SC_NPROCESSORS_ONLN);
+                    if (workers < 1) workers = 1;
+                }
+                break;
+            case 'b':
+                batchSize = strtol(optarg, NULL, 10);
+                if (batchSize < 1 || batchSize > 1024) usage();
+                break;
+            case 'q':
+                queryLogFile = optarg;
+                break;
+            case 'Q':
+                queryLogRecords = strtol(optarg, NULL, 10);
+                if (queryLogRecords < 1) usage();
+                break;
+            case 'w':
+                watch = true;
+                break;
+            case 'r':
+                rotate = true;
+                break;
+            case 'c':
+                tcpConnections = strtol(optarg, NULL, 10);
+                if (tcpConnections < 1) usage();
+                break;
+            case 'i':
+                tcpIdleTimeout = strtol(optarg, NULL, 10);
+                if (tcpIdleTimeout < 1) usage();
+                break;
+            case 'p':
+                port = strtol(optarg, NULL, 10);
+                if (port < 1 || port > 65535) usage();
+                break;
+            case 'm':
+                metricsPort = strtol(optarg, NULL, 10);
+                if (metricsPort < 1 || metricsPort > 65535) usage();
+                break;
+            case 'u':
+                upstreams = optarg;
+                break;
+            case 'C':
+                cacheSize = strtol(optarg, NULL, 10);
+                if (cacheSize < 1) usage();
+                break;
+            case 'H':
+                hedgeDelay = strtol(optarg, NULL, 10);
+                if (hedgeDelay < 0 || hedgeDelay >= CForwarder::TIMEOUT) usage();
+                break;
+            case 'P':
+                prefetch = strtol(optarg, NULL, 10);
+                if (prefetch < 0 || prefetch > 100) usage();
+                break;
+            case 'S':
+                serveStale = strtol(optarg, NULL, 10);
+                if (serveStale < 0 || serveStale > 7 * 86400) usage();
+                break;
+            case 's':
+                snapshotFile = optarg;
+                break;
+            case 'W':
+                snapshotInterval = strtol(optarg, NULL, 10);
+                if (snapshotInterval < 0 || snapshotInterval > 86400) usage();
+                break;
+            default:
+                usage();
         }
     }
+    if (optind != argc) usage();
+    // only the response cache of the forwarding mode is saved
+    if (!snapshotFile.empty() && upstreams.empty()) usage();
 
-    CDns *dns = new CDns((char *) logFile.c_str());
+    CWorkerPool *pool = new CWorkerPool(logFile, (unsigned int) workers, (unsigned int) batchSize);
 
-    dns->openCommunication();
-    while (1) {
-        dns->readMessage();
-    }
+    if (!queryLogFile.empty()) pool->setQueryLog(queryLogFile, (unsigned long) queryLogRecords);
+    if (!dbFile.empty()) pool->setDatabase(dbFile);
+    pool->setWatch(watch);
+    pool->setRotation(rotate);
+    pool->setPort((unsigned short) port);
+    pool->setTcpLimits((unsigned int) tcpConnections, (unsigned int) tcpIdleTimeout);
+    pool->setMetricsPort((unsigned short) metricsPort);
+    if (!upstreams.empty() && pool->setForwarding(upstreams, (unsigned long) cacheSize << 20)) usage();
+    pool->setHedgeDelay((unsigned int) hedgeDelay);
+    pool->setCacheRefresh((unsigned int) prefetch, (unsigned int) serveStale);
+    if (!snapshotFile.empty()) pool->setCacheSnapshot(snapshotFile, (unsigned int) snapshotInterval);
+    pool->open();
+    pool->run();
 }
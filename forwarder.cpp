@@ -0,0 +1,732 @@
+/*!
+*****************************************************************************
+*  \file forwarder.cpp
+*
+*  \brief   Forwarding of the queries the database cannot answer
+*
+*  The queries in flight are kept in a table indexed by their socket,
+*  so a response finds its query at once, and in a list in the order
+*  they were sent. All of them wait the same time, so the first ones of
+*  the list are the only ones that can have expired. The hedging delay
+*  is the same for all of them too: a pointer to the first one not
+*  checked yet walks the same list.
+*
+*  The pending questions are indexed by their question, with the QName
+*  in lowercase, so the queries that arrive while one is in flight join
+*  it.
+*
+*  The SRTT of an upstream is an exponential moving average (1/8 of
+*  every new sample, a timeout counts as TIMEOUT). The ones not chosen
+*  get a bit lower every time, so a slow upstream is measured again
+*  once in a while and the choice follows the changes of the network.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#include "forwarder.h"
+#include "dns.h"
+#include "tcpServer.h"
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+
+using namespace std;
+
+/*! Lowercase of an ascii character, the rest are not changed
+ */
+static inline unsigned char lower(unsigned char c) {
+    return (unsigned char) ((unsigned char) (c - 'A') < 26 ? c + ('a' - 'A') : c);
+}
+
+/*! Returns the length of the question of a message (QName, QType
+ *  and QClass), 0 if it is not complete
+ */
+static unsigned long questionLength(const unsigned char *message, unsigned long length) {
+    unsigned long offset = CMessage::HEADER_SIZE;
+
+    while (offset < length && message[offset] != 0) {
+        if (message[offset] & 0xc0) return 0;
+        offset += message[offset] + 1;
+    }
+    offset += 1 + 4;
+    if (offset > length) return 0;
+    return offset - CMessage::HEADER_SIZE;
+}
+
+/*! Returns the question of a query with the QName in lowercase (the
+ *  case of the letters does not change the answer), empty if it is
+ *  not valid
+ */
+static string questionKey(const vector<unsigned char> &query) {
+    unsigned long length = questionLength(&query[0], query.size());
+
+    if (length == 0) return string();
+    string key((const char *) &query[CMessage::HEADER_SIZE], length);
+
+    // QType and QClass are numbers, not letters
+    for (unsigned long i = 0; i + 4 < length; i++) {
+        key[i] = (char) lower((unsigned char) key[i]);
+    }
+    return key;
+}
+
+/*! Constructor. The database is shared with the workers, the
+ *  responses are built from the cache
+ */
+CForwarder::CForwarder(char *outFile, CDnsDbManager &dnsDb, CCache &cache)
+        : m_Dns(new CDns(outFile, dnsDb, 1)),
+          m_Cache(cache),
+          m_Upstreams(),
+          m_HedgeDelay(0),
+          m_Table(),
+          m_InFlight(),
+          m_Oldest(NULL),
+          m_Newest(NULL),
+          m_NextHedge(NULL),
+          m_Epoll(-1),
+          m_Event(-1),
+          m_Queue(),
+          m_Taken(),
+          m_Buffer(CDns::MAX_STREAM_SIZE),
+          m_Response(CDns::MAX_STREAM_SIZE),
+          m_Answer(),
+          m_RandomLeft(0),
+          m_Forwarded(0),
+          m_Coalesced(0),
+          m_Refreshes(0),
+          m_Hedged(0),
+          m_HedgeWins(0),
+          m_Failures(0) {
+    pthread_mutex_init(&m_Lock, NULL);
+    m_Dns->setForwarding(this, &m_Cache);
+}
+
+/*! Destructor
+ */
+CForwarder::~CForwarder() {
+    while (m_Oldest != NULL) {
+        TPending *pending = m_Oldest->m_Pending;
+
+        while (!pending->m_Queries.empty()) remove(pending->m_Queries.back());
+        delete pending;
+    }
+    for (unsigned int i = 0; i < m_Upstreams.size(); i++) {
+        delete m_Upstreams[i];
+    }
+    if (m_Event >= 0) close(m_Event);
+    if (m_Epoll >= 0) close(m_Epoll);
+    pthread_mutex_destroy(&m_Lock);
+    delete m_Dns;
+}
+
+/*! Adds an upstream server: an ipv4 or ipv6 address, optionally
+ *  followed by "@port" (53 by default). It returns true if the
+ *  address is not valid
+ */
+bool CForwarder::addUpstream(const char *address) {
+    struct sockaddr_storage storage;
+    socklen_t addrLength;
+    string host(address);
+    long port = CDns::DNS_PORT;
+    string::size_type at = host.find('@');
+
+    if (m_Upstreams.size() >= MAX_UPSTREAMS) return true;
+    if (at != string::npos) {
+        char *end;
+        port = strtol(host.c_str() + at + 1, &end, 10);
+        if (*end != '\0' || port < 1 || port > 65535) return true;
+        host.erase(at);
+    }
+
+    memset(&storage, 0, sizeof(storage));
+    struct sockaddr_in *addr4 = (struct sockaddr_in *) &storage;
+    struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *) &storage;
+    if (inet_pton(AF_INET, host.c_str(), &addr4->sin_addr) == 1) {
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = htons((unsigned short) port);
+        addrLength = sizeof(struct sockaddr_in);
+    } else if (inet_pton(AF_INET6, host.c_str(), &addr6->sin6_addr) == 1) {
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons((unsigned short) port);
+        addrLength = sizeof(struct sockaddr_in6);
+    } else {
+        return true;
+    }
+
+    TUpstream *upstream = new TUpstream();
+    upstream->m_Name = address;
+    upstream->m_Addr = storage;
+    upstream->m_AddrLength = addrLength;
+    upstream->m_FailuresInRow = 0;
+    upstream->m_Srtt.store(0);
+    upstream->m_DownUntil.store(0);
+    upstream->m_Sent.store(0);
+    upstream->m_Responses.store(0);
+    upstream->m_Timeouts.store(0);
+    upstream->m_Errors.store(0);
+    m_Upstreams.push_back(upstream);
+    return false;
+}
+
+/*! Returns the number of upstream servers
+ */
+unsigned int CForwarder::getUpstreams() const {
+    return (unsigned int) m_Upstreams.size();
+}
+
+/*! A query without response after delay ms is sent to a second
+ *  upstream too, the first response wins. 0 (by default) disables it
+ */
+void CForwarder::setHedgeDelay(unsigned int delay) {
+    m_HedgeDelay = delay;
+}
+
+/*! Opens the descriptors polled by the forwarder
+ */
+void CForwarder::open() {
+    m_Epoll = epoll_create1(0);
+    if (m_Epoll < 0) {
+        cerr << "Error creating forwarder epoll descriptor" << endl;
+        exit(0);
+    }
+
+    m_Event = eventfd(0, EFD_NONBLOCK);
+    if (m_Event < 0) {
+        cerr << "Error creating forwarder eventfd" << endl;
+        exit(0);
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = m_Event;
+    if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Event, &event) < 0) {
+        cerr << "Error adding forwarder eventfd to epoll" << endl;
+        exit(0);
+    }
+}
+
+/*! Every query is stored in the binary query log, shared
+ *  with other workers. It can be NULL
+ */
+void CForwarder::setQueryLog(CQueryLog *queryLog) {
+    m_Dns->setQueryLog(queryLog);
+}
+
+/*! Returns the counters of the forwarded queries (their
+ *  responses and their whole latency)
+ */
+CStats &CForwarder::getStats() {
+    return m_Dns->getStats();
+}
+
+/*! The time of every stage is measured too, see CDns
+ */
+void CForwarder::setTiming(bool timing) {
+    m_Dns->setTiming(timing);
+}
+
+/*! Waits until the log records queued so far are written.
+ *  Any thread can call it
+ */
+void CForwarder::flushLog() {
+    m_Dns->flushLog();
+}
+
+/*! Returns the counters of the forwarder. Only its thread
+ *  counts, any thread can read them
+ */
+void CForwarder::getCounters(TCounters &counters) const {
+    counters.m_Forwarded = m_Forwarded.load(memory_order_relaxed);
+    counters.m_Coalesced = m_Coalesced.load(memory_order_relaxed);
+    counters.m_Refreshes = m_Refreshes.load(memory_order_relaxed);
+    counters.m_Hedged = m_Hedged.load(memory_order_relaxed);
+    counters.m_HedgeWins = m_HedgeWins.load(memory_order_relaxed);
+    counters.m_Failures = m_Failures.load(memory_order_relaxed);
+}
+
+/*! Returns the counters and the state of an upstream server,
+ *  any thread can read them
+ */
+void CForwarder::getUpstreamCounters(unsigned int upstream, TUpstreamCounters &counters) const {
+    const TUpstream &server = *m_Upstreams[upstream];
+
+    counters.m_Name = server.m_Name;
+    counters.m_Sent = server.m_Sent.load(memory_order_relaxed);
+    counters.m_Responses = server.m_Responses.load(memory_order_relaxed);
+    counters.m_Timeouts = server.m_Timeouts.load(memory_order_relaxed);
+    counters.m_Errors = server.m_Errors.load(memory_order_relaxed);
+    counters.m_Srtt = server.m_Srtt.load(memory_order_relaxed);
+    counters.m_Up = server.m_DownUntil.load(memory_order_relaxed) <= now();
+}
+
+/*! Queues a query to be forwarded. It can be called from any thread
+ */
+void CForwarder::forward(const TRequest &request) {
+    bool wake;
+
+    pthread_mutex_lock(&m_Lock);
+    // the forwarder is only woken up by the first one
+    wake = m_Queue.empty();
+    m_Queue.push_back(request);
+    pthread_mutex_unlock(&m_Lock);
+
+    if (wake) {
+        uint64_t one = 1;
+        if (write(m_Event, &one, sizeof(one)) < 0) {
+            // the counter is already at its max, it will be read
+        }
+    }
+}
+
+/*! Serves the forwarded queries forever
+ */
+void CForwarder::run() {
+    static const int MAX_EVENTS = 64;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        int n = epoll_wait(m_Epoll, events, MAX_EVENTS, nextTimeout());
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            cerr << "Error waiting on forwarder epoll descriptor" << endl;
+            exit(0);
+        }
+        // by descriptor, not by query: a query can be freed by the
+        // events before its own (the other query of a hedge)
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == m_Event) {
+                takeRequests();
+            } else {
+                receive(events[i].data.fd);
+            }
+        }
+        expire();
+    }
+}
+
+/*! Takes the queries queued by the workers
+ */
+void CForwarder::takeRequests() {
+    uint64_t events;
+
+    if (read(m_Event, &events, sizeof(events)) < 0) {
+        // nothing queued, it was already taken
+    }
+
+    pthread_mutex_lock(&m_Lock);
+    m_Taken.swap(m_Queue);
+    pthread_mutex_unlock(&m_Lock);
+
+    for (unsigned int i = 0; i < m_Taken.size(); i++) {
+        string key = questionKey(m_Taken[i].m_Query);
+
+        count(m_Taken[i].m_Socket < 0 && m_Taken[i].m_Tcp == NULL ? m_Refreshes : m_Forwarded);
+        // the same question is already in flight, its
+        // response answers this client too
+        if (!key.empty()) {
+            unordered_map<string, TPending *>::iterator it = m_InFlight.find(key);
+            if (it != m_InFlight.end()) {
+                it->second->m_Waiters.push_back(m_Taken[i]);
+                count(m_Coalesced);
+                continue;
+            }
+        }
+
+        TPending *pending = new TPending();
+        pending->m_Waiters.push_back(m_Taken[i]);
+        pending->m_Key = key;
+        if (!key.empty()) m_InFlight[key] = pending;
+        pending->m_Tried = 0;
+        pending->m_Attempts = 0;
+        retry(pending);
+    }
+    m_Taken.clear();
+}
+
+/*! Asks the best upstream server not asked yet, unless another
+ *  query of the question is still in flight. If it cannot be sent
+ *  any more, the clients get a SERVFAIL and it is freed
+ */
+void CForwarder::retry(TPending *pending) {
+    // the other one can still answer
+    if (!pending->m_Queries.empty()) return;
+
+    if (send(pending, false)) answer(pending, NULL);
+}
+
+/*! Sends a query of a question to the best upstream server not
+ *  asked yet. It returns true if it was not sent: too many attempts,
+ *  no free ID, or a hedge without another upstream to ask
+ */
+bool CForwarder::send(TPending *pending, bool hedge) {
+    const vector<unsigned char> &query = pending->m_Waiters[0].m_Query;
+    unsigned long qLength = questionLength(&query[0], query.size());
+    unsigned char *buffer = &m_Buffer[0];
+    uint64_t current = now();
+    unsigned long length;
+    uint16_t id = randomId();
+
+    if (pending->m_Attempts >= MAX_ATTEMPTS || qLength == 0) return true;
+
+    int upstream = selectUpstream(pending->m_Tried, current);
+    if (upstream < 0) {
+        // all of them asked: a hedge needs another
+        // one, a retry starts again from the best
+        if (hedge) return true;
+        pending->m_Tried = 0;
+        upstream = selectUpstream(0, current);
+    }
+
+    // a socket of its own, the kernel binds it to a random source
+    // port; connected, so only the responses of that server are read
+    TUpstream &server = *m_Upstreams[upstream];
+    int fd = socket(server.m_Addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return true;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (connect(fd, (struct sockaddr *) &server.m_Addr, server.m_AddrLength) < 0 ||
+        epoll_ctl(m_Epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+        close(fd);
+        return true;
+    }
+
+    // header: recursion desired, one question and the OPT record
+    memset(buffer, 0, CMessage::HEADER_SIZE);
+    buffer[0] = (unsigned char) (id >> 8);
+    buffer[1] = (unsigned char) id;
+    buffer[2] = 0x01;
+    buffer[5] = 1;
+    buffer[11] = 1;
+    memcpy(buffer + CMessage::HEADER_SIZE, &query[CMessage::HEADER_SIZE], qLength);
+    length = CMessage::HEADER_SIZE + qLength;
+
+    // OPT: root owner, type 41, payload size, no flags, no options
+    static const unsigned char opt[11] = {0, 0, CResourceRecord::OPT, CMessage::EDNS_PAYLOAD_SIZE >> 8,
+                                          CMessage::EDNS_PAYLOAD_SIZE & 0xff, 0, 0, 0, 0, 0, 0};
+    memcpy(buffer + length, opt, sizeof(opt));
+    length += sizeof(opt);
+
+    // an error (an ICMP unreachable) is handled as a timeout
+    ::send(fd, buffer, length, 0);
+    count(server.m_Sent);
+
+    TQuery *sent = new TQuery();
+    sent->m_Pending = pending;
+    sent->m_Upstream = (unsigned int) upstream;
+    sent->m_Id = id;
+    sent->m_Socket = fd;
+    sent->m_Hedge = hedge;
+    sent->m_SentTime = current;
+    if ((unsigned int) fd >= m_Table.size()) m_Table.resize(fd + 1, (TQuery *) NULL);
+    m_Table[fd] = sent;
+    pending->m_Queries.push_back(sent);
+    pending->m_Tried |= (uint64_t) 1 << upstream;
+    pending->m_Attempts++;
+
+    // the last one sent
+    sent->m_Prev = m_Newest;
+    sent->m_Next = NULL;
+    if (m_Newest != NULL) {
+        m_Newest->m_Next = sent;
+    } else {
+        m_Oldest = sent;
+    }
+    m_Newest = sent;
+    if (m_NextHedge == NULL) m_NextHedge = sent;
+    return false;
+}
+
+/*! Returns the healthy upstream with the lowest SRTT, not in the
+ *  given mask; a down one if all of them are, -1 if all are in it
+ */
+int CForwarder::selectUpstream(uint64_t tried, uint64_t current) {
+    int best = -1;
+    int down = -1;
+    uint64_t bestSrtt = 0;
+    uint64_t downUntil = 0;
+
+    for (unsigned int i = 0; i < m_Upstreams.size(); i++) {
+        if (tried & ((uint64_t) 1 << i)) continue;
+
+        TUpstream &upstream = *m_Upstreams[i];
+        uint64_t until = upstream.m_DownUntil.load(memory_order_relaxed);
+        if (until > current) {
+            // the one that comes back first, if all of them are down
+            if (down < 0 || until < downUntil) {
+                down = (int) i;
+                downUntil = until;
+            }
+            continue;
+        }
+        // the ones not measured yet go first
+        uint64_t srtt = upstream.m_Srtt.load(memory_order_relaxed);
+        if (best < 0 || srtt < bestSrtt) {
+            best = (int) i;
+            bestSrtt = srtt;
+        }
+    }
+    if (best < 0) return down;
+
+    // the others get closer to the best one, they will
+    // be asked again if they have become faster
+    for (unsigned int i = 0; i < m_Upstreams.size(); i++) {
+        if ((int) i == best) continue;
+        uint64_t srtt = m_Upstreams[i]->m_Srtt.load(memory_order_relaxed);
+        if (srtt > bestSrtt) m_Upstreams[i]->m_Srtt.store(srtt - (srtt >> SRTT_DECAY), memory_order_relaxed);
+    }
+    return best;
+}
+
+/*! Adds a round trip time to the SRTT of an upstream
+ */
+void CForwarder::measure(unsigned int upstream, uint64_t rtt) {
+    atomic<uint64_t> &srtt = m_Upstreams[upstream]->m_Srtt;
+    uint64_t value = srtt.load(memory_order_relaxed);
+
+    value = value == 0 ? rtt : value - value / 8 + rtt / 8;
+    // 0 is not measured yet
+    srtt.store(value > 0 ? value : 1, memory_order_relaxed);
+}
+
+/*! Counts a failure of an upstream, it is left aside after
+ *  MAX_FAILURES in a row
+ */
+void CForwarder::fail(unsigned int upstream, uint64_t current) {
+    TUpstream &server = *m_Upstreams[upstream];
+
+    // once back, a single failure leaves it aside again
+    server.m_FailuresInRow++;
+    if (server.m_FailuresInRow >= MAX_FAILURES) {
+        server.m_DownUntil.store(current + (uint64_t) HOLD_DOWN * 1000, memory_order_relaxed);
+    }
+}
+
+/*! Reads the response received on the socket of a query
+ */
+void CForwarder::receive(int socket) {
+    unsigned char *buffer = &m_Buffer[0];
+
+    // already answered, by this socket or by another one
+    if ((unsigned int) socket >= m_Table.size() || m_Table[socket] == NULL) return;
+    TQuery *query = m_Table[socket];
+
+    while (1) {
+        ssize_t n = recv(socket, buffer, m_Buffer.size(), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // EAGAIN, or the error of a previous send
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            continue;
+        }
+        if ((unsigned long) n < CMessage::HEADER_SIZE) continue;
+        if (((buffer[0] << 8) | buffer[1]) != query->m_Id) continue;
+
+        // the same question, the case of the letters of the
+        // QName can change, QType and QClass cannot
+        const vector<unsigned char> &question = query->m_Pending->m_Waiters[0].m_Query;
+        unsigned long end = CMessage::HEADER_SIZE + questionLength(&question[0], question.size());
+        if ((unsigned long) n < end) continue;
+        unsigned long i = CMessage::HEADER_SIZE;
+        while (i < end - 4 && lower(buffer[i]) == lower(question[i])) i++;
+        if (i < end - 4 || memcmp(buffer + i, &question[i], 4) != 0) continue;
+
+        // it frees the query and closes the socket
+        handleResponse(query, buffer, (unsigned long) n);
+        return;
+    }
+}
+
+/*! Handles a response to a query
+ */
+void CForwarder::handleResponse(TQuery *query, const unsigned char *response, unsigned long length) {
+    TPending *pending = query->m_Pending;
+    unsigned int upstream = query->m_Upstream;
+    uint64_t current = now();
+    bool error = CCache::parseResponse(response, length, m_Answer);
+
+    measure(upstream, current - query->m_SentTime);
+
+    // the errors of a server are not kept, another one is asked
+    if (error || (m_Answer.m_RCode != CHeader::NO_ERROR && m_Answer.m_RCode != CHeader::NAME_ERROR)) {
+        count(m_Upstreams[upstream]->m_Errors);
+        fail(upstream, current);
+        remove(query);
+        retry(pending);
+        return;
+    }
+
+    TUpstream &server = *m_Upstreams[upstream];
+    count(server.m_Responses);
+    server.m_FailuresInRow = 0;
+    server.m_DownUntil.store(0, memory_order_relaxed);
+    if (query->m_Hedge) count(m_HedgeWins);
+
+    // the one that lost the race is at least as slow as its wait
+    for (unsigned int i = 0; i < pending->m_Queries.size(); i++) {
+        TQuery *other = pending->m_Queries[i];
+        uint64_t wait = current - other->m_SentTime;
+        if (other != query && wait > m_Upstreams[other->m_Upstream]->m_Srtt.load(memory_order_relaxed)) {
+            measure(other->m_Upstream, wait);
+        }
+    }
+
+    const unsigned char *qname = &pending->m_Waiters[0].m_Query[CMessage::HEADER_SIZE];
+    unsigned int qLength = (unsigned int) (pending->m_Key.size());
+    const unsigned char *qtype = qname + qLength - 4;
+    m_Cache.insert(qname, qLength - 4, (qtype[0] << 8) | qtype[1], (qtype[2] << 8) | qtype[3], m_Answer);
+
+    // the other query of a hedge is forgotten, its response is dropped
+    answer(pending, &m_Answer);
+}
+
+/*! Sends the queries without response after the hedging delay to a
+ *  second upstream, and again the ones without response in time
+ */
+void CForwarder::expire() {
+    uint64_t current = now();
+
+    while (m_Oldest != NULL && m_Oldest->m_SentTime + (uint64_t) TIMEOUT * 1000 <= current) {
+        TQuery *query = m_Oldest;
+        TPending *pending = query->m_Pending;
+        unsigned int upstream = query->m_Upstream;
+
+        count(m_Upstreams[upstream]->m_Timeouts);
+        measure(upstream, (uint64_t) TIMEOUT * 1000);
+        fail(upstream, current);
+        remove(query);
+        retry(pending);
+    }
+
+    if (m_HedgeDelay == 0 || m_Upstreams.size() < 2) return;
+    while (m_NextHedge != NULL && m_NextHedge->m_SentTime + (uint64_t) m_HedgeDelay * 1000 <= current) {
+        TQuery *query = m_NextHedge;
+
+        m_NextHedge = query->m_Next;
+        // only a query alone in flight, not a hedge itself
+        if (query->m_Hedge || query->m_Pending->m_Queries.size() > 1) continue;
+        if (!send(query->m_Pending, true)) count(m_Hedged);
+    }
+}
+
+/*! Returns the ms until the next timeout or hedge, for poll
+ */
+int CForwarder::nextTimeout() {
+    uint64_t current = now();
+    uint64_t next = current + (uint64_t) TICK * 1000;
+
+    if (m_Oldest != NULL) {
+        next = min(next, m_Oldest->m_SentTime + (uint64_t) TIMEOUT * 1000);
+    }
+    if (m_HedgeDelay > 0 && m_NextHedge != NULL) {
+        next = min(next, m_NextHedge->m_SentTime + (uint64_t) m_HedgeDelay * 1000);
+    }
+    if (next <= current) return 0;
+    return (int) ((next - current + 999) / 1000);
+}
+
+/*! Answers the clients of a pending query, from the given answer
+ *  or with a SERVFAIL if it is NULL, and frees it with its queries
+ */
+void CForwarder::answer(TPending *pending, const CCache::TAnswer *answer) {
+    if (!pending->m_Key.empty()) m_InFlight.erase(pending->m_Key);
+    while (!pending->m_Queries.empty()) remove(pending->m_Queries.back());
+
+    // every client gets its own response: its ID, its
+    // payload size and its transport
+    for (unsigned int i = 0; i < pending->m_Waiters.size(); i++) {
+        TRequest &request = pending->m_Waiters[i];
+
+        // a refresh, only for the cache
+        if (request.m_Socket < 0 && request.m_Tcp == NULL) continue;
+
+        unsigned long length = m_Dns->replayMessage(request, answer, &m_Response[0]);
+
+        if (answer == NULL) count(m_Failures);
+        if (request.m_Tcp != NULL) {
+            // the connection waits for it, even if there is no response
+            request.m_Tcp->deliver(request.m_Connection, &m_Response[0], length);
+        } else if (length > 0) {
+            // the worker socket can be shared, sendto is atomic
+            sendto(request.m_Socket, &m_Response[0], length, 0, (struct sockaddr *) &request.m_ClientAddr,
+                   request.m_AddrLength);
+        }
+    }
+    delete pending;
+}
+
+/*! Takes a query out of the table, of the list and of its
+ *  question, and frees it with its socket
+ */
+void CForwarder::remove(TQuery *query) {
+    vector<TQuery *> &queries = query->m_Pending->m_Queries;
+
+    // closing the descriptor also removes it from epoll
+    m_Table[query->m_Socket] = NULL;
+    close(query->m_Socket);
+
+    if (m_NextHedge == query) m_NextHedge = query->m_Next;
+    if (query->m_Prev != NULL) {
+        query->m_Prev->m_Next = query->m_Next;
+    } else {
+        m_Oldest = query->m_Next;
+    }
+    if (query->m_Next != NULL) {
+        query->m_Next->m_Prev = query->m_Prev;
+    } else {
+        m_Newest = query->m_Prev;
+    }
+
+    for (unsigned int i = 0; i < queries.size(); i++) {
+        if (queries[i] == query) {
+            queries[i] = queries.back();
+            queries.pop_back();
+            break;
+        }
+    }
+    delete query;
+}
+
+/*! Returns a random ID
+ */
+uint16_t CForwarder::randomId() {
+    if (m_RandomLeft == 0) {
+        // with the random source port of every query, the IDs
+        // keep a forged response out of the cache, they must
+        // not be predictable
+        if (getrandom(m_Random, sizeof(m_Random), 0) != (ssize_t) sizeof(m_Random)) {
+            for (unsigned int i = 0; i < sizeof(m_Random) / sizeof(m_Random[0]); i++) {
+                m_Random[i] = (uint16_t) rand();
+            }
+        }
+        m_RandomLeft = sizeof(m_Random) / sizeof(m_Random[0]);
+    }
+    return m_Random[--m_RandomLeft];
+}
+
+/*! Current time in us (monotonic)
+ */
+uint64_t CForwarder::now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/*! Adds 1 to a counter, only written by the thread of the forwarder
+ */
+void CForwarder::count(atomic<uint64_t> &counter) {
+    counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
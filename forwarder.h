@@ -0,0 +1,331 @@
+/*!
+*****************************************************************************
+*  \file forwarder.h
+*
+*  \brief   Forwarding of the queries the database cannot answer
+*
+*  With upstream servers configured, a name that is not in the database
+*  is not a NXDOMAIN any more: the workers look for it in the response
+*  cache (see CCache) and, if it is not there, they hand the query to the
+*  forwarder and go on with the next one, without waiting.
+*
+*  The forwarder runs in a thread of its own. It asks the upstream
+*  servers over UDP, with recursion desired and an OPT record. Every
+*  query is sent from a socket of its own, connected to the upstream,
+*  so it has a random source port as well as a random ID: a forged
+*  response must guess both. The response must come to that socket
+*  with the same ID and question. A query without response
+*  after TIMEOUT ms is sent again to another upstream, up to MAX_ATTEMPTS
+*  times; then the client gets a SERVFAIL. The same happens with the
+*  responses that are errors (SERVFAIL, REFUSED...) or truncated.
+*
+*  Every upstream has a smoothed round trip time (SRTT) and a count of
+*  failures in a row. A query is sent to the healthy upstream with the
+*  lowest SRTT; one that fails MAX_FAILURES times in a row is left aside
+*  for HOLD_DOWN ms. With a hedging delay, a query still without response
+*  after it is sent to the next best upstream too, and the first valid
+*  response answers the clients: a slow upstream does not make the slow
+*  queries slower than the delay plus the round trip of another one.
+*
+*  The queries with the same question (name, type and class) wait for
+*  the same upstream query: while one is in flight, the next clients
+*  asking for it are added to its waiters, and all of them are answered
+*  with its response. A burst of queries for a name that is not cached
+*  sends one query to the upstream servers, not one per client.
+*
+*  The response is inserted in the cache and the client is answered by
+*  the forwarder itself, with its own CDns object that builds the response
+*  from the cached records: on the socket of the worker over UDP, or
+*  through the TCP server (see CTcpServer::deliver) over TCP. A query
+*  without a client (no socket and no TCP server) is a refresh of an
+*  entry of the cache (see CCache::lookup): its response is only cached.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#ifndef _FORWARDER_H
+#define _FORWARDER_H
+
+#include "cache.h"
+#include "dnsDbManager.h"
+#include "queryLog.h"
+#include "stats.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ctime>
+
+class CDns;
+class CTcpServer;
+
+/*! \class CForwarder
+ *  \brief It asks the upstream servers for the names not in the database
+ *
+ *   CForwarder receives the queries of the workers (any thread can call
+ *   forward()), sends them to the upstream servers, waits for their
+ *   responses in its own thread, keeps them in the cache and answers
+ *   the clients.
+ *
+ */
+using namespace std;
+
+class CForwarder {
+public:
+    /*! Query of a client waiting for an upstream server
+     */
+    struct TRequest {
+        vector<unsigned char> m_Query;    /**< Query as received */
+        struct sockaddr_in6 m_ClientAddr; /**< Address of the client */
+        socklen_t m_AddrLength;           /**< Length of the address of the client */
+        int m_Socket;                     /**< UDP socket of the worker, -1 over TCP or for a refresh */
+        CTcpServer *m_Tcp;                /**< TCP server of the client, NULL over UDP or for a refresh */
+        uint64_t m_Connection;            /**< TCP connection of the client */
+        struct timespec m_RxTime;         /**< Reception time (monotonic) */
+        uint64_t m_RxTimestamp;           /**< Reception time (ns since the epoch) */
+    };
+
+    /*! Counters of the forwarder
+     */
+    struct TCounters {
+        uint64_t m_Forwarded;  /**< Queries of the clients received */
+        uint64_t m_Coalesced;  /**< Queries that waited for one already in flight */
+        uint64_t m_Refreshes;  /**< Queries without a client, to refresh the cache */
+        uint64_t m_Hedged;     /**< Queries sent to a second upstream after the hedging delay */
+        uint64_t m_HedgeWins;  /**< Hedged queries answered first by the second upstream */
+        uint64_t m_Failures;   /**< Clients answered with a SERVFAIL */
+    };
+
+    /*! Counters and state of an upstream server
+     */
+    struct TUpstreamCounters {
+        string m_Name;         /**< Address as given */
+        uint64_t m_Sent;       /**< Queries sent */
+        uint64_t m_Responses;  /**< Valid responses received */
+        uint64_t m_Timeouts;   /**< Queries without response in time */
+        uint64_t m_Errors;     /**< Responses that are errors or not valid */
+        uint64_t m_Srtt;       /**< Smoothed round trip time (us), 0 if not measured yet */
+        bool m_Up;             /**< It is not left aside after its failures */
+    };
+
+    /*! Constructor. The database is shared with the workers, the
+     *  responses are built from the cache
+     */
+    CForwarder(char *outFile, CDnsDbManager &dnsDb, CCache &cache);
+
+    /*! Destructor
+     */
+    ~CForwarder();
+
+    /*! Adds an upstream server: an ipv4 or ipv6 address, optionally
+     *  followed by "@port" (53 by default). It returns true if the
+     *  address is not valid
+     */
+    bool addUpstream(const char *address);
+
+    /*! Returns the number of upstream servers
+     */
+    unsigned int getUpstreams() const;
+
+    /*! A query without response after delay ms is sent to a second
+     *  upstream too, the first response wins. 0 (by default) disables it
+     */
+    void setHedgeDelay(unsigned int delay);
+
+    /*! Opens the descriptors polled by the forwarder
+     */
+    void open();
+
+    /*! Every query is stored in the binary query log, shared
+     *  with other workers. It can be NULL
+     */
+    void setQueryLog(CQueryLog *queryLog);
+
+    /*! Returns the counters of the forwarded queries (their
+     *  responses and their whole latency)
+     */
+    CStats &getStats();
+
+    /*! The time of every stage is measured too, see CDns
+     */
+    void setTiming(bool timing);
+
+    /*! Waits until the log records queued so far are written.
+     *  Any thread can call it
+     */
+    void flushLog();
+
+    /*! Returns the counters of the forwarder. Only its thread
+     *  counts, any thread can read them
+     */
+    void getCounters(TCounters &counters) const;
+
+    /*! Returns the counters and the state of an upstream server,
+     *  any thread can read them
+     */
+    void getUpstreamCounters(unsigned int upstream, TUpstreamCounters &counters) const;
+
+    /*! Queues a query to be forwarded. It can be called from any thread
+     */
+    void forward(const TRequest &request);
+
+    /*! Serves the forwarded queries forever
+     */
+    void run();
+
+    static const unsigned int TIMEOUT = 1000;     /**< Ms to wait for an upstream server */
+    static const unsigned int MAX_ATTEMPTS = 3;   /**< Times a query is sent before a SERVFAIL */
+    static const unsigned int MAX_UPSTREAMS = 64; /**< Max number of upstream servers */
+    static const unsigned int MAX_FAILURES = 3;   /**< Failures in a row that leave an upstream aside */
+    static const unsigned int HOLD_DOWN = 5000;   /**< Ms an upstream is left aside */
+
+private:
+    /*! Upstream server. Only the thread of the forwarder writes it,
+     *  the atomic members are read by the metrics too
+     */
+    struct TUpstream {
+        string m_Name;                 /**< Address as given */
+        struct sockaddr_storage m_Addr; /**< Address */
+        socklen_t m_AddrLength;        /**< Length of the address */
+        unsigned int m_FailuresInRow;  /**< Failures since its last valid response */
+        atomic<uint64_t> m_Srtt;       /**< Smoothed round trip time (us), 0 if not measured yet */
+        atomic<uint64_t> m_DownUntil;  /**< Time it is left aside until (us, monotonic) */
+        atomic<uint64_t> m_Sent;       /**< Queries sent */
+        atomic<uint64_t> m_Responses;  /**< Valid responses received */
+        atomic<uint64_t> m_Timeouts;   /**< Queries without response in time */
+        atomic<uint64_t> m_Errors;     /**< Responses that are errors or not valid */
+    };
+
+    struct TQuery;
+
+    /*! Question waiting for the upstream servers
+     */
+    struct TPending {
+        vector<TRequest> m_Waiters; /**< Queries of the clients, with the same question */
+        string m_Key;             /**< Question in lowercase, empty if it is not valid */
+        vector<TQuery *> m_Queries; /**< Queries in flight, two while hedging */
+        uint64_t m_Tried;         /**< Upstream servers already asked (bit mask) */
+        unsigned int m_Attempts;  /**< Times it has been sent */
+    };
+
+    /*! Query sent to an upstream server, waiting for its response
+     */
+    struct TQuery {
+        TPending *m_Pending;      /**< Question asked */
+        unsigned int m_Upstream;  /**< Upstream server asked */
+        uint16_t m_Id;            /**< ID of the query sent */
+        int m_Socket;             /**< UDP socket connected to the upstream, only for this query */
+        bool m_Hedge;             /**< It was sent after the hedging delay */
+        uint64_t m_SentTime;      /**< Time it was sent (us, monotonic) */
+        TQuery *m_Prev;           /**< Previous one, sent before */
+        TQuery *m_Next;           /**< Next one, sent after */
+    };
+
+    /*! Takes the queries queued by the workers
+     */
+    void takeRequests();
+
+    /*! Asks the best upstream server not asked yet, unless another
+     *  query of the question is still in flight. If it cannot be sent
+     *  any more, the clients get a SERVFAIL and it is freed
+     */
+    void retry(TPending *pending);
+
+    /*! Sends a query of a question to the best upstream server not
+     *  asked yet. It returns true if it was not sent: too many attempts,
+     *  no free ID, or a hedge without another upstream to ask
+     */
+    bool send(TPending *pending, bool hedge);
+
+    /*! Returns the healthy upstream with the lowest SRTT, not in the
+     *  given mask; a down one if all of them are, -1 if all are in it
+     */
+    int selectUpstream(uint64_t tried, uint64_t current);
+
+    /*! Adds a round trip time to the SRTT of an upstream
+     */
+    void measure(unsigned int upstream, uint64_t rtt);
+
+    /*! Counts a failure of an upstream, it is left aside after
+     *  MAX_FAILURES in a row
+     */
+    void fail(unsigned int upstream, uint64_t current);
+
+    /*! Reads the response received on the socket of a query
+     */
+    void receive(int socket);
+
+    /*! Handles a response to a query
+     */
+    void handleResponse(TQuery *query, const unsigned char *response, unsigned long length);
+
+    /*! Sends the queries without response after the hedging delay to a
+     *  second upstream, and again the ones without response in time
+     */
+    void expire();
+
+    /*! Returns the ms until the next timeout or hedge, for poll
+     */
+    int nextTimeout();
+
+    /*! Answers the clients of a pending query, from the given answer
+     *  or with a SERVFAIL if it is NULL, and frees it with its queries
+     */
+    void answer(TPending *pending, const CCache::TAnswer *answer);
+
+    /*! Takes a query out of the table, of the list and of its
+     *  question, and frees it with its socket
+     */
+    void remove(TQuery *query);
+
+    /*! Returns a random ID
+     */
+    uint16_t randomId();
+
+    /*! Current time in us (monotonic)
+     */
+    static uint64_t now();
+
+    /*! Adds 1 to a counter, only written by the thread of the forwarder
+     */
+    static void count(atomic<uint64_t> &counter);
+
+    static const unsigned int TICK = 100;       /**< Max ms between checks of the timeouts */
+    static const unsigned int SRTT_DECAY = 7;   /**< The SRTT not chosen lose 1/2^SRTT_DECAY */
+
+    CDns *m_Dns;                       /**< Builds the responses of the clients */
+    CCache &m_Cache;                   /**< Responses of the upstream servers */
+    vector<TUpstream *> m_Upstreams;   /**< Upstream servers */
+    unsigned int m_HedgeDelay;         /**< Ms before a second upstream is asked, 0 never */
+    vector<TQuery *> m_Table;          /**< Queries in flight by socket */
+    unordered_map<string, TPending *> m_InFlight; /**< Pending questions by question */
+    TQuery *m_Oldest;                  /**< Query in flight sent first */
+    TQuery *m_Newest;                  /**< Query in flight sent last */
+    TQuery *m_NextHedge;               /**< First query not checked for hedging yet */
+    int m_Epoll;                       /**< Epoll descriptor of the eventfd and the sockets */
+    int m_Event;                       /**< Eventfd written when the queue is not empty */
+    pthread_mutex_t m_Lock;            /**< Lock of the queue */
+    vector<TRequest> m_Queue;          /**< Queries queued by the workers */
+    vector<TRequest> m_Taken;          /**< Queries taken from the queue */
+    vector<unsigned char> m_Buffer;    /**< Query sent, response received */
+    vector<unsigned char> m_Response;  /**< Response built for a client */
+    CCache::TAnswer m_Answer;          /**< Records of the response received */
+    uint16_t m_Random[256];            /**< Random IDs not used yet */
+    unsigned int m_RandomLeft;         /**< Number of them */
+    atomic<uint64_t> m_Forwarded;      /**< Queries of the clients received */
+    atomic<uint64_t> m_Coalesced;      /**< Queries that waited for one already in flight */
+    atomic<uint64_t> m_Refreshes;      /**< Queries without a client, to refresh the cache */
+    atomic<uint64_t> m_Hedged;         /**< Queries sent to a second upstream after the hedging delay */
+    atomic<uint64_t> m_HedgeWins;      /**< Hedged queries answered first by the second upstream */
+    atomic<uint64_t> m_Failures;       /**< Clients answered with a SERVFAIL */
+};
+
+#endif
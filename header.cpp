@@ -38,11 +38,13 @@
 CHeader::CHeader()
         : m_OpCodePart(0),
           m_RCode(NO_ERROR),
+          m_RecursionAvailable(false),
           m_QdCount(0),
           m_AnCount(0),
           m_NsCount(0),
           m_ArCount(0),
-          m_AllCounts() {
+          m_QueryRecords(0),
+          m_QueryArCount(0) {
 }
 
 /*! Destructor
@@ -50,6 +52,20 @@ CHeader::CHeader()
 CHeader::~CHeader() {
 }
 
+/*! Clears all the fields to process a new query
+ */
+void CHeader::reset() {
+    m_OpCodePart = 0;
+    m_RCode = NO_ERROR;
+    m_RecursionAvailable = false;
+    m_QdCount = 0;
+    m_AnCount = 0;
+    m_NsCount = 0;
+    m_ArCount = 0;
+    m_QueryRecords = 0;
+    m_QueryArCount = 0;
+}
+
 CHeader::TRCode CHeader::setOpCodePart(unsigned char c) {
     int qr;
     int op_code;
@@ -75,32 +91,54 @@ CHeader::TRCode CHeader::setOpCodePart(unsigned char c) {
     if (tc != 0) {
         return NOT_IMPLEMENTED;
     }
-    // If RD set, RA=0 will be returned so nothing will be done.
+    // If RD set, RA is only returned by a forwarding server.
     return NO_ERROR;
 }
 
 unsigned char CHeader::getOpCodePart() {
     // Setting response (QR=1)
-    m_OpCodePart = (unsigned char) ((1 << 7) + m_OpCodePart);
+    m_OpCodePart = (unsigned char) ((1 << 7) | m_OpCodePart);
 
     // Normal use, it should be 81
     return m_OpCodePart;
 }
 
 void CHeader::setRCode(unsigned char c) {
-    m_RCode = (TRCode) c;
-    // Z field will be ignored (and assume it's always 0).
+    // RA and Z fields will be ignored (and assume they are always 0).
+    m_RCode = (TRCode) (c & 0x0f);
 }
 
 unsigned char CHeader::getRCode() {
     return (unsigned char) m_RCode;
 }
 
-CHeader::TRCode CHeader::setAllCounts(string &buffer) {
+/*! Sets the RA bit: the server asks other servers for the
+ *  names it does not know (see CForwarder)
+ */
+void CHeader::setRecursionAvailable() {
+    m_RecursionAvailable = true;
+}
+
+/*! Returns the 4th byte of the header: the RA bit, Z and the
+ *  response code
+ */
+unsigned char CHeader::getRCodePart() {
+    return (unsigned char) ((m_RecursionAvailable ? 0x80 : 0) | m_RCode);
+}
+
+/*! Reads the 4 counters (8 bytes in network order) of the query.
+ *  The sections of the response are empty until they are set, the
+ *  counters of the query are kept apart to parse its records
+ */
+CHeader::TRCode CHeader::setAllCounts(const unsigned char *buffer) {
     // fixed size (8 bytes)
-    m_AllCounts = buffer;
+    m_QdCount = (unsigned int) ((buffer[0] << 8) | buffer[1]);
+    m_QueryRecords = (unsigned int) ((buffer[2] << 8) | buffer[3]) + (unsigned int) ((buffer[4] << 8) | buffer[5]);
+    m_QueryArCount = (unsigned int) ((buffer[6] << 8) | buffer[7]);
+    m_AnCount = 0;
+    m_NsCount = 0;
+    m_ArCount = 0;
 
-    m_QdCount = (buffer[0] << 8) + buffer[1];
     // Check value
     if (m_QdCount == 0)
         return FORMAT_ERROR;
@@ -111,24 +149,25 @@ CHeader::TRCode CHeader::setAllCounts(string &buffer) {
     return NO_ERROR;
 }
 
-string &CHeader::getAllCounts() {
-    // m_AnCount has been set previously set
-
-    // For now these 2 fiels are always 0 although
-    // the structure is prepared for the future
-    m_NsCount = 0;
-    m_ArCount = 0;
-
-    // we'll only modify the last 6 bytes,
-    // m_QdCount should be the same one
-    m_AllCounts[2] = (char) ((m_AnCount >> 8) & 0xff);
-    m_AllCounts[3] = (char) (m_AnCount & 0xff);
-    m_AllCounts[4] = (char) ((m_NsCount >> 8) & 0xff);
-    m_AllCounts[5] = (char) (m_NsCount & 0xff);
-    m_AllCounts[6] = (char) ((m_ArCount >> 8) & 0xff);
-    m_AllCounts[7] = (char) (m_ArCount & 0xff);
+/*! Writes the 4 counters (8 bytes in network order) of the response
+ */
+void CHeader::getAllCounts(unsigned char *buffer) {
+    // m_AnCount, m_NsCount and m_ArCount have been set previously.
+    buffer[0] = (unsigned char) ((m_QdCount >> 8) & 0xff);
+    buffer[1] = (unsigned char) (m_QdCount & 0xff);
+    buffer[2] = (unsigned char) ((m_AnCount >> 8) & 0xff);
+    buffer[3] = (unsigned char) (m_AnCount & 0xff);
+    buffer[4] = (unsigned char) ((m_NsCount >> 8) & 0xff);
+    buffer[5] = (unsigned char) (m_NsCount & 0xff);
+    buffer[6] = (unsigned char) ((m_ArCount >> 8) & 0xff);
+    buffer[7] = (unsigned char) (m_ArCount & 0xff);
+}
 
-    return m_AllCounts;
+/*! Used when the question section is not echoed
+ *  in the response
+ */
+void CHeader::setQdCount(unsigned int qdCount) {
+    m_QdCount = qdCount;
 }
 
 /*! Used mostly during the error management 
@@ -138,3 +177,38 @@ string &CHeader::getAllCounts() {
 void CHeader::setAnCount(unsigned int anCount) {
     m_AnCount = anCount;
 }
+
+unsigned int CHeader::getAnCount() {
+    return m_AnCount;
+}
+
+/*! Number of resource records of the authority section
+ */
+void CHeader::setNsCount(unsigned int nsCount) {
+    m_NsCount = nsCount;
+}
+
+/*! Number of resource records of the additional section
+ */
+void CHeader::setArCount(unsigned int arCount) {
+    m_ArCount = arCount;
+}
+
+/*! Number of resource records of the answer and authority
+ *  sections of the query, they come before the additional ones
+ */
+unsigned int CHeader::getQueryRecords() {
+    return m_QueryRecords;
+}
+
+/*! Number of resource records of the additional section of the query
+ */
+unsigned int CHeader::getQueryArCount() {
+    return m_QueryArCount;
+}
+
+/*! Sets the TC bit: the response did not fit
+ */
+void CHeader::setTruncated() {
+    m_OpCodePart |= 0x02;
+}
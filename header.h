@@ -65,9 +65,15 @@ public:
         SERVER_FAILURE,
         NAME_ERROR,
         NOT_IMPLEMENTED,
-        REFUSED
+        REFUSED,
+        BAD_VERSION = 16   /**< EDNS0 version not supported, its upper
+                                bits go inside the OPT record (RFC 6891) */
     };
 
+    /*! Clears all the fields to process a new query
+     */
+    void reset();
+
     TRCode setOpCodePart(unsigned char c);
 
     unsigned char getOpCodePart();
@@ -76,9 +82,30 @@ public:
 
     unsigned char getRCode();
 
-    TRCode setAllCounts(string &buffer);
+    /*! Sets the RA bit: the server asks other servers for the
+     *  names it does not know (see CForwarder)
+     */
+    void setRecursionAvailable();
+
+    /*! Returns the 4th byte of the header: the RA bit, Z and the
+     *  response code
+     */
+    unsigned char getRCodePart();
 
-    string &getAllCounts();
+    /*! Reads the 4 counters (8 bytes in network order) of the query.
+     *  The sections of the response are empty until they are set, the
+     *  counters of the query are kept apart to parse its records
+     */
+    TRCode setAllCounts(const unsigned char *buffer);
+
+    /*! Writes the 4 counters (8 bytes in network order) of the response
+     */
+    void getAllCounts(unsigned char *buffer);
+
+    /*! Used when the question section is not echoed
+     *  in the response
+     */
+    void setQdCount(unsigned int qdCount);
 
     /*! Used mostly during the error management
      *  Otherwise it will updated to 1 when
@@ -86,6 +113,29 @@ public:
      */
     void setAnCount(unsigned int anCount);
 
+    unsigned int getAnCount();
+
+    /*! Number of resource records of the authority section
+     */
+    void setNsCount(unsigned int nsCount);
+
+    /*! Number of resource records of the additional section
+     */
+    void setArCount(unsigned int arCount);
+
+    /*! Number of resource records of the answer and authority
+     *  sections of the query, they come before the additional ones
+     */
+    unsigned int getQueryRecords();
+
+    /*! Number of resource records of the additional section of the query
+     */
+    unsigned int getQueryArCount();
+
+    /*! Sets the TC bit: the response did not fit
+     */
+    void setTruncated();
+
 private:
     /*
     // short should be the type used, but as it takes longer process time than int
@@ -105,11 +155,13 @@ private:
  *                           4 - not implemented
  *                           5 - refused
  *                        6-15 - reserved */
-    char m_QdCount;    /**< 16-bit, # entries in the question section*/
+    bool m_RecursionAvailable; /**< RA bit of the response */
+    unsigned int m_QdCount;    /**< 16-bit, # entries in the question section*/
     unsigned int m_AnCount;    /**< 16-bit, # resource records in the answer section*/
     unsigned int m_NsCount;    /**< 16-bit, # name server resource records in the authority section*/
     unsigned int m_ArCount;    /**< 16-bit, # resource records in the additional section*/
-    string m_AllCounts;
+    unsigned int m_QueryRecords; /**< # resource records in the answer and authority sections of the query */
+    unsigned int m_QueryArCount; /**< # resource records in the additional section of the query */
 };
 
 #endif
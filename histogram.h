@@ -0,0 +1,101 @@
+/*!
+*****************************************************************************
+*  \file histogram.h
+*
+*  \brief   Histogram of latencies
+*
+*  The values (nanoseconds) are counted in buckets of logarithmic size
+*  with linear sub-buckets, like an HDR histogram: the values below 128
+*  are exact and every power of 2 above them is split in 64 buckets, so
+*  any percentile is within 1.6% of the real value, from 1 ns to hours,
+*  with a fixed size (30 KB) and a constant cost per value.
+*
+*  A histogram is not shared: every thread counts in its own one and
+*  they are added together to read them. The counters are atomic, so
+*  a histogram can be read (added to another one) while its thread
+*  counts, without locks: the thread that counts is the only writer.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <stdint.h>
+#include <atomic>
+
+/*! \class CHistogram
+ *  \brief It counts values in logarithmic buckets
+ *
+ *   CHistogram keeps the number of values of every bucket, their
+ *   sum and the biggest one. The percentiles are given as the
+ *   highest value of the bucket where they are.
+ *
+ */
+class CHistogram {
+public:
+    /*! Constructor
+     */
+    CHistogram();
+
+    /*! Clears all the values
+     */
+    void reset();
+
+    /*! Counts a value
+     */
+    void record(uint64_t value);
+
+    /*! Adds the values of another histogram
+     */
+    void add(const CHistogram &other);
+
+    /*! Returns the number of values
+     */
+    uint64_t getCount() const;
+
+    /*! Returns the sum of the values
+     */
+    uint64_t getSum() const;
+
+    /*! Returns the biggest value, 0 if there are none
+     */
+    uint64_t getMax() const;
+
+    /*! Returns the value below which there are the given percent
+     *  (0 to 100) of the values, 0 if there are none
+     */
+    uint64_t getPercentile(double percent) const;
+
+    /*! Returns the number of values of a bucket
+     */
+    uint64_t getBucketCount(unsigned int bucket) const;
+
+    /*! Returns the highest value of a bucket
+     */
+    static uint64_t getBucketLimit(unsigned int bucket);
+
+    /*! Returns the bucket of a value
+     */
+    static unsigned int getBucket(uint64_t value);
+
+    static const unsigned int EXACT = 128;    /**< Values counted exactly */
+    static const unsigned int SUB_BUCKETS = 64; /**< Buckets per power of 2 above EXACT */
+    static const unsigned int BUCKETS = EXACT + 57 * SUB_BUCKETS; /**< Buckets up to 2^64 */
+
+private:
+    /*! Adds to a counter with only one writer, without a locked instruction
+     */
+    static void add(std::atomic<uint64_t> &counter, uint64_t value);
+
+    std::atomic<uint64_t> m_Counts[BUCKETS];  /**< Values of every bucket */
+    std::atomic<uint64_t> m_Count;            /**< Number of values */
+    std::atomic<uint64_t> m_Sum;              /**< Sum of the values */
+    std::atomic<uint64_t> m_Max;              /**< Biggest value */
+};
+
+#endif
@@ -8,6 +8,15 @@
 *  that can be chosen as a parameter of the program, otherwise
 *  a default file is used
 *
+*  The worker never writes to the file. Every print function only
+*  copies a compact binary record into a lock-free ring (one producer,
+*  the worker, and one consumer) and a background thread formats the
+*  records and writes them to the file in batches. If the ring is full
+*  the record is dropped and counted, the worker never waits for the
+*  disk. The worker never wakes the writer up either: an idle writer
+*  checks the ring after 1 ms, then doubles the wait up to 50 ms, so
+*  an idle daemon does not wake up every log thread once per ms.
+*
 *  \version 0.1
 *  \date    11-September-2006
 *  \author  Cristina Camacho Romaguera
@@ -17,62 +26,225 @@
 
 #include "log.h"
 #include <iostream>
-#include <iomanip>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
 
 
 /*! Constructor
  */
 CLog::CLog(char *outFile)
-        : m_Fs(outFile, ios::out | ios::binary) {
+        : m_Fs(outFile, ios::out | ios::binary),
+          m_Ring(new unsigned char[RING_SIZE]),
+          m_Head(0),
+          m_Tail(0),
+          m_Written(0),
+          m_Dropped(0),
+          m_Stop(false),
+          m_Writer(),
+          m_Output() {
+    if (pthread_create(&m_Writer, NULL, writerThread, this) != 0) {
+        cerr << "Error creating log thread" << endl;
+        exit(0);
+    }
 }
 
-/*! Destructor
+/*! Destructor. The records still queued are written
  */
 CLog::~CLog() {
+    m_Stop.store(true);
+    pthread_join(m_Writer, NULL);
+    delete[] m_Ring;
 }
 
 /*! Prints a string in the log file
  */
-void CLog::printString(string outString) {
-    m_Fs << outString << endl;
+void CLog::printString(const char *outString) {
+    push(STRING, 0, outString, strlen(outString));
 }
 
 /*! Prints a formatted string in the log file
  */
-void CLog::printFormattedString(string &outString) {
-    char s[3];
+void CLog::printFormattedString(const unsigned char *buffer, unsigned long length) {
+    push(FORMATTED, 0, buffer, length);
+}
+
+/*! Prints an error in the log file
+ */
+void CLog::printError(const char *outString, CHeader::TRCode error_code) {
+    push(ERROR, (unsigned char) error_code, outString, strlen(outString));
+}
+
+/*! Prints the host requested (QName in wire format) in the log file
+ */
+void CLog::printHost(const unsigned char *qname, unsigned int length) {
+    push(HOST, 0, qname, length);
+}
+
+/*! Returns the number of records dropped because the ring was full
+ */
+unsigned long CLog::getDropped() {
+    return m_Dropped.load(memory_order_relaxed);
+}
+
+/*! Waits until the records queued so far are written to the
+ *  file. Any thread can call it
+ */
+void CLog::flush() {
+    unsigned long head = m_Head.load(memory_order_acquire);
+
+    // the writer looks for records at least every MAX_IDLE_SLEEP us
+    while ((long) (head - m_Written.load(memory_order_acquire)) > 0) usleep(1000);
+}
 
-    for (unsigned int i = 0; i < outString.size(); i++) {
-        snprintf(s, 3, "%.2x", (unsigned char) outString[i]);
-        m_Fs << "[" << hex << s << "] ";
+/*! Copies a record inside the ring, or drops it if there is no room
+ */
+void CLog::push(TRecordType type, unsigned char code, const void *data, unsigned long length) {
+    unsigned long head = m_Head.load(memory_order_relaxed);
+    unsigned long tail = m_Tail.load(memory_order_acquire);
+    unsigned long offset = head & (RING_SIZE - 1);
+    unsigned long size;
+    TRecord *record;
+
+    if (length > MAX_DATA) length = MAX_DATA;
+    // records are aligned to 8 bytes
+    size = (sizeof(TRecord) + length + 7) & ~7UL;
+
+    // a record is never split, if it does not fit until the
+    // end of the ring the rest of the ring is skipped
+    if (offset + size > RING_SIZE) {
+        if (RING_SIZE - (head - tail) < (RING_SIZE - offset) + size) {
+            m_Dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        record = (TRecord *) (m_Ring + offset);
+        record->m_Size = (unsigned int) (RING_SIZE - offset);
+        record->m_Type = PADDING;
+        head += RING_SIZE - offset;
+        offset = 0;
+    } else if (RING_SIZE - (head - tail) < size) {
+        m_Dropped.fetch_add(1, memory_order_relaxed);
+        return;
     }
-    m_Fs << dec << " - " << outString.size() << " bytes" << endl;
+
+    record = (TRecord *) (m_Ring + offset);
+    record->m_Size = (unsigned int) size;
+    record->m_Type = (unsigned char) type;
+    record->m_Code = code;
+    record->m_Length = (unsigned short) length;
+    memcpy(m_Ring + offset + sizeof(TRecord), data, length);
+
+    // publish the record to the writer
+    m_Head.store(head + size, memory_order_release);
 }
 
-/*! Prints an error in the log file
+/*! Formats and writes all the records queued. Returns false if
+ *  there was nothing to write
+ */
+bool CLog::writeRecords() {
+    static const char hex_digits[] = "0123456789abcdef";
+    static const char *error_names[] = {"NO_ERROR", "FORMAT_ERROR", "SERVER_FAILURE",
+                                        "NAME_ERROR", "NOT_IMPLEMENTED:", "REFUSED"};
+    unsigned long tail = m_Tail.load(memory_order_relaxed);
+    unsigned long head = m_Head.load(memory_order_acquire);
+
+    if (tail == head) return false;
+
+    m_Output.clear();
+    while (tail != head) {
+        TRecord *record = (TRecord *) (m_Ring + (tail & (RING_SIZE - 1)));
+        const char *data = (const char *) record + sizeof(TRecord);
+
+        switch (record->m_Type) {
+            case STRING:
+                m_Output.append(data, record->m_Length);
+                m_Output += '\n';
+                break;
+            case FORMATTED: {
+                for (unsigned int i = 0; i < record->m_Length; i++) {
+                    unsigned char c = (unsigned char) data[i];
+                    m_Output += '[';
+                    m_Output += hex_digits[c >> 4];
+                    m_Output += hex_digits[c & 0x0f];
+                    m_Output += "] ";
+                }
+                ostringstream s;
+                s << " - " << record->m_Length << " bytes\n";
+                m_Output += s.str();
+                break;
+            }
+            case ERROR:
+                m_Output.append(data, record->m_Length);
+                if (record->m_Code <= CHeader::REFUSED) {
+                    m_Output += error_names[record->m_Code];
+                } else if (record->m_Code == CHeader::BAD_VERSION) {
+                    m_Output += "BADVERS";
+                } else {
+                    m_Output += "RCODE?";
+                }
+                m_Output += '\n';
+                break;
+            case HOST: {
+                // the QName is converted to the dotted format here
+                unsigned int i = 0, host_len = 0;
+                m_Output += "Host ";
+                while (i < record->m_Length && data[i] != 0) {
+                    unsigned int len = (unsigned char) data[i];
+                    if (i + 1 + len > record->m_Length) break;
+                    if (host_len > 0) {
+                        m_Output += '.';
+                        host_len++;
+                    }
+                    m_Output.append(data + i + 1, len);
+                    host_len += len;
+                    i += len + 1;
+                }
+                ostringstream s;
+                s << " (" << host_len << ")\n";
+                m_Output += s.str();
+                break;
+            }
+            default:
+                // PADDING
+                break;
+        }
+        tail += record->m_Size;
+    }
+    // the room is given back to the worker
+    m_Tail.store(tail, memory_order_release);
+
+    m_Fs.write(m_Output.data(), (streamsize) m_Output.size());
+    m_Fs.flush();
+    m_Written.store(tail, memory_order_release);
+    return true;
+}
+
+/*! Background thread
  */
-void CLog::printError(string outString, CHeader::TRCode error_code) {
-    string error;
-
-    switch (error_code) {
-        case CHeader::FORMAT_ERROR:
-            error = "FORMAT_ERROR";
-            break;
-        case CHeader::SERVER_FAILURE:
-            error = "SERVER_FAILURE";
-            break;
-        case CHeader::NAME_ERROR:
-            error = "NAME_ERROR";
-            break;
-        case CHeader::NOT_IMPLEMENTED:
-            error = "NOT_IMPLEMENTED:";
-            break;
-        case CHeader::REFUSED:
-            error = "REFUSED";
-            break;
-        default:
-            error = "NO_ERROR";
-            break;
+void *CLog::writerThread(void *arg) {
+    CLog *log = (CLog *) arg;
+    unsigned long dropped = 0;
+    unsigned int sleep = 1000;
+
+    while (!log->m_Stop.load()) {
+        bool written = log->writeRecords();
+
+        // reports the records lost since the last time
+        if (log->getDropped() != dropped) {
+            dropped = log->getDropped();
+            log->m_Fs << "Log: " << dropped << " records dropped" << endl;
+        }
+        // nothing to do, the worker is not woken up to avoid
+        // any system call on its side: the longer it has been
+        // idle, the longer it sleeps
+        if (written) {
+            sleep = 1000;
+        } else {
+            usleep(sleep);
+            sleep = sleep < MAX_IDLE_SLEEP / 2 ? sleep * 2 : MAX_IDLE_SLEEP;
+        }
     }
-    m_Fs << outString << error << endl;
+    while (log->writeRecords());
+    return NULL;
 }
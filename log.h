@@ -8,6 +8,13 @@
 *  that can be chosen as a parameter of the program, otherwise
 *  a default file is used
 *
+*  The worker never writes to the file. Every print function only
+*  copies a compact binary record into a lock-free ring (one producer,
+*  the worker, and one consumer) and a background thread formats the
+*  records and writes them to the file in batches. If the ring is full
+*  the record is dropped and counted, the worker never waits for the
+*  disk.
+*
 *  \version 0.1
 *  \date    11-September-2006
 *  \author  Cristina Camacho Romaguera
@@ -21,6 +28,8 @@
 #include "header.h"
 #include <string>
 #include <fstream>
+#include <atomic>
+#include <pthread.h>
 
 /*! \class CLog
  *  \brief It prints logging information in a file
@@ -37,24 +46,81 @@ public:
      */
     CLog(char *outFile);
 
-    /*! Destructor
+    /*! Destructor. The records still queued are written
      */
     ~CLog();
 
     /*! Prints a string in the log file
      */
-    void printString(string outString);
+    void printString(const char *outString);
 
     /*! Prints a formatted string in the log file
      */
-    void printFormattedString(string &outString);
+    void printFormattedString(const unsigned char *buffer, unsigned long length);
 
     /*! Prints an error in the log file
      */
-    void printError(string outString, CHeader::TRCode error_code);
+    void printError(const char *outString, CHeader::TRCode error_code);
+
+    /*! Prints the host requested (QName in wire format) in the log file
+     */
+    void printHost(const unsigned char *qname, unsigned int length);
+
+    /*! Returns the number of records dropped because the ring was full
+     */
+    unsigned long getDropped();
+
+    /*! Waits until the records queued so far are written to the
+     *  file. Any thread can call it
+     */
+    void flush();
 
 private:
+    /*! Types of records inside the ring
+     */
+    enum TRecordType {
+        PADDING,     /**< skip until the end of the ring */
+        STRING,
+        FORMATTED,
+        ERROR,
+        HOST
+    };
+
+    /*! Header of every record, followed by the data
+     */
+    struct TRecord {
+        unsigned int m_Size;      /**< size of the record, header and padding included */
+        unsigned char m_Type;     /**< TRecordType */
+        unsigned char m_Code;     /**< error code for ERROR records */
+        unsigned short m_Length;  /**< length of the data */
+    };
+
+    /*! Copies a record inside the ring, or drops it if there is no room
+     */
+    void push(TRecordType type, unsigned char code, const void *data, unsigned long length);
+
+    /*! Formats and writes all the records queued. Returns false if
+     *  there was nothing to write
+     */
+    bool writeRecords();
+
+    /*! Background thread
+     */
+    static void *writerThread(void *arg);
+
+    static const unsigned long RING_SIZE = 1 << 20;   /**< Size of the ring, power of 2 */
+    static const unsigned long MAX_DATA = 4096;        /**< Max data of a record, the rest is cut */
+    static const unsigned int MAX_IDLE_SLEEP = 50000;  /**< Max us the idle writer sleeps between checks */
+
     ofstream m_Fs; /**< Log file used */
+    unsigned char *m_Ring;                 /**< Records not written yet */
+    atomic<unsigned long> m_Head;          /**< Next position to write, only moved by the worker */
+    atomic<unsigned long> m_Tail;          /**< Next position to read, only moved by the writer */
+    atomic<unsigned long> m_Written;       /**< Position written to the file, only moved by the writer */
+    atomic<unsigned long> m_Dropped;       /**< Number of records dropped */
+    atomic<bool> m_Stop;                   /**< Asks the writer to finish */
+    pthread_t m_Writer;                    /**< Writer thread */
+    string m_Output;                       /**< Text of the batch being written */
 };
 
 #endif
@@ -22,6 +22,23 @@
 *  (Ref: RFC 1035). All the management of this message is done here,
 *  including error handling.
 *
+*  The message is parsed directly over the reception buffer, checking
+*  the bounds of every field, and without copying any part of it.
+*  There is one CMessage per worker, reset before every query, so the
+*  processing of a query never allocates memory.
+*
+*  The records after the question are only parsed to find the OPT
+*  record (EDNS0, RFC 6891), which gives the UDP payload size of the
+*  client. The response carries an OPT record too, with the payload
+*  size of this server. A response that does not fit is sent without
+*  its answer and with the TC bit set, so the client asks again over
+*  TCP. The authority section is only optional information for the
+*  negative answers, it is dropped without setting TC.
+*
+*  The answer of a forwarded query comes from the cache (see CCache):
+*  all its records are written as they came, after the question, and
+*  the whole response is truncated if they do not fit.
+*
 *  \version 0.1
 *  \date    11-September-2006
 *  \author  Cristina Camacho Romaguera
@@ -31,7 +48,8 @@
 
 #include "message.h"
 #include <iostream>
-#include <string> 
+#include <string>
+#include <cstring>
 
 
 /*! Constructor
@@ -42,10 +60,15 @@ CMessage::CMessage(CLog &log)
           m_Answer(),
           m_Authority(),
           m_Additional(),
-          m_Host(),
-          m_AnswerString(),
-          m_AuthorityString(),
-          m_AdditionalString(),
+          m_QuestionLength(0),
+          m_HasAnswer(false),
+          m_HasAuthority(false),
+          m_AnswerRecords(0),
+          m_CachedArCount(0),
+          m_Rotate(false),
+          m_Rotation(0),
+          m_Edns(false),
+          m_PayloadSize(CAdditional::MIN_PAYLOAD_SIZE),
           m_Log(log) {
 }
 
@@ -54,93 +77,117 @@ CMessage::CMessage(CLog &log)
 CMessage::~CMessage() {
 }
 
-/*! Sets header section with all the values received 
+/*! Clears all the sections to process a new query
  */
-bool CMessage::setHeader(string &header) {
-    unsigned int qd_count;
-    bool error = false;
+void CMessage::reset() {
+    m_Header.reset();
+    m_Question.reset();
+    m_Answer.reset();
+    m_Authority.reset();
+    m_Additional.reset();
+    m_QuestionLength = 0;
+    m_HasAnswer = false;
+    m_HasAuthority = false;
+    m_AnswerRecords = 0;
+    m_CachedArCount = 0;
+    m_Edns = false;
+    m_PayloadSize = CAdditional::MIN_PAYLOAD_SIZE;
+}
+
+/*! Sets header section with all the values received.
+ *  The header is always 12 bytes long (RFC 1035).
+ */
+bool CMessage::setHeader(const unsigned char *header) {
     // more specific error
     CHeader::TRCode error_code;
 
-    // It is not necessary to clean up m_Header
-    // as it always will be 12 bytes and it will
-    // be overwritten everytime.
-
     // Id part is not modified so it is not necessary
     // to keep it inside header class
 
-    error_code = m_Header.setOpCodePart((unsigned char) header[2]);
+    error_code = m_Header.setOpCodePart(header[2]);
     if (error_code != (CHeader::NO_ERROR)) {
         m_Log.printError("setHeader: error to be returned - ", error_code);
         setErrorCode(error_code);
+        return true;
     }
     // set response code although later
     // it will be modified accordingly
-    m_Header.setRCode((unsigned char) header[3]);
-
-    string param = header.substr(4, 8);
-    qd_count = m_Header.setAllCounts(param);
+    m_Header.setRCode(header[3]);
 
-    error_code = m_Header.setOpCodePart((unsigned char) header[2]);
+    error_code = m_Header.setAllCounts(header + 4);
     if (error_code != (CHeader::NO_ERROR)) {
         m_Log.printError("setHeader: error to be returned - ", error_code);
         setErrorCode(error_code);
+        return true;
     }
-    return error;
+    return false;
 }
 
-/*! Gets header section to send a message
+/*! Gets header section to send a message. Only the bytes
+ *  after the ID are written.
  */
-void CMessage::getHeader(string &header) {
-    string buffer;
-
+void CMessage::getHeader(unsigned char *header) {
     // ID will be the same, but the rest of
     // the sections could be different
-    buffer = m_Header.getOpCodePart();
-    buffer += m_Header.getRCode();
-    buffer += m_Header.getAllCounts();
-    header.replace(2, 10, buffer);
+    header[2] = m_Header.getOpCodePart();
+    header[3] = m_Header.getRCodePart();
+    // The question is only echoed if it was right
+    m_Header.setQdCount(m_QuestionLength > 0 ? 1 : 0);
+    m_Header.getAllCounts(header + 4);
 }
 
-/*! Sets question section with all the values received
+/*! Sets question section with all the values received.
+ *  The question must stay inside the buffer until the
+ *  response has been built.
  */
-bool CMessage::setQuestion(string &question, unsigned long qLen) {
+bool CMessage::setQuestion(const unsigned char *question, unsigned long qLen) {
     unsigned long index = 0;
     unsigned int len = 0;
-    string qname, qtype, qclass;
     bool error = false;
 
-    // Get QName section and extract m_Host from it
-    // in order to look for IP address within Db.
-    index = question.size() - 4;
-    qname.erase(0, qname.size());
-    qname = question.substr(0, index - 1);
-
-    // Clean up m_Host.
-    m_Host.erase(0, m_Host.size());
-
-    // Build hostname from Qname field.
-    unsigned int i = 0;
-    while (i < qname.size()) {
-        len = (unsigned int) qname.at(i);
-        m_Host += qname.substr(i + 1, len);
-        i += (len + 1);
-        if (i < qname.size()) m_Host += ".";
+    m_QuestionLength = 0;
+
+    // Walk the QName labels, the Db looks for the IP address
+    // directly with the QName. Every label is checked against
+    // the size of the message.
+    while (1) {
+        if (index >= qLen) {
+            error = true;
+            break;
+        }
+        len = question[index];
+        if (len == 0) {
+            // Qname should end with a 0
+            index++;
+            break;
+        }
+        // Compression pointers are not expected inside the
+        // question of a query
+        if (len > MAX_LABEL_SIZE || index + 1 + len >= qLen ||
+            index + 1 + len >= MAX_NAME_SIZE) {
+            error = true;
+            break;
+        }
+        index += (len + 1);
+    }
+
+    // QType and QClass (2 bytes each) after QName
+    if (error || index + 4 > qLen) {
+        m_Log.printError("setQuestion: error to be returned - ", CHeader::FORMAT_ERROR);
+        setErrorCode(CHeader::FORMAT_ERROR);
+        return true;
     }
-    // Qname should end with a 0
-    qname.push_back(0);
 
-    m_Question.setQName(qname);
-    qtype = question.substr(index, 2);
-    qclass = question.substr(index, 2);
+    m_Question.setQName(question, (unsigned int) index);
+    m_QuestionLength = (unsigned int) index + 4;
 
-    error = m_Question.setQType(qtype);
+    error = m_Question.setQType((unsigned int) ((question[index] << 8) | question[index + 1]));
     if (error) {
         m_Log.printError("setQuestion: error to be returned - ", CHeader::NOT_IMPLEMENTED);
         setErrorCode(CHeader::NOT_IMPLEMENTED);
         return error;
     }
-    error = m_Question.setQClass(qclass);
+    error = m_Question.setQClass((unsigned int) ((question[index + 2] << 8) | question[index + 3]));
     if (error) {
         m_Log.printError("setQuestion: error to be returned - ", CHeader::NOT_IMPLEMENTED);
         setErrorCode(CHeader::NOT_IMPLEMENTED);
@@ -148,22 +195,163 @@ bool CMessage::setQuestion(string &question, unsigned long qLen) {
     return error;
 }
 
-/*! Returns the hostname
+/*! Parses the records after the question (the given buffer
+ *  starts after it), looking for the OPT record (EDNS0). It returns
+ *  true if they are not valid or the EDNS version is not supported
+ */
+bool CMessage::setAdditional(const unsigned char *records, unsigned long length) {
+    unsigned int first = m_Header.getQueryRecords();
+    unsigned int count = first + m_Header.getQueryArCount();
+    unsigned long index = 0;
+    unsigned int payloadSize = 0;
+    unsigned int version = 0;
+    bool dnssecOk = false;
+    bool found = false;
+    bool error = false;
+
+    // Every record is checked against the size of the message,
+    // only the OPT one is kept
+    for (unsigned int i = 0; i < count && !error; i++) {
+        unsigned long start = index;
+
+        // owner name, it can end with a compression pointer
+        while (1) {
+            if (index >= length) {
+                error = true;
+                break;
+            }
+            unsigned int len = records[index];
+            if (len == 0) {
+                index++;
+                break;
+            }
+            if ((len & 0xc0) == 0xc0) {
+                index += 2;
+                break;
+            }
+            if (len > MAX_LABEL_SIZE) {
+                error = true;
+                break;
+            }
+            index += len + 1;
+        }
+        // type, class, TTL and RdLength (10 bytes), then RData
+        if (error || index + 10 > length) {
+            error = true;
+            break;
+        }
+        unsigned int type = (unsigned int) ((records[index] << 8) | records[index + 1]);
+        unsigned int rdLength = (unsigned int) ((records[index + 8] << 8) | records[index + 9]);
+        if (index + 10 + rdLength > length) {
+            error = true;
+            break;
+        }
+
+        if (type == CResourceRecord::OPT) {
+            // only one, inside the additional section
+            // and owned by the root
+            if (found || i < first || index - start != 1) {
+                error = true;
+                break;
+            }
+            found = true;
+            payloadSize = (unsigned int) ((records[index + 2] << 8) | records[index + 3]);
+            version = records[index + 5];
+            dnssecOk = (records[index + 6] & 0x80) != 0;
+        }
+        index += 10 + rdLength;
+    }
+
+    if (error) {
+        m_Log.printError("setAdditional: error to be returned - ", CHeader::FORMAT_ERROR);
+        setErrorCode(CHeader::FORMAT_ERROR);
+        return true;
+    }
+    if (!found) return false;
+
+    // Below 512 bytes the payload size is not valid, 512 is used
+    m_Edns = true;
+    m_PayloadSize = payloadSize < CAdditional::MIN_PAYLOAD_SIZE ? CAdditional::MIN_PAYLOAD_SIZE : payloadSize;
+
+    if (version != 0) {
+        // Only version 0 exists, the response is BADVERS with
+        // the lower bits of the code in the header
+        m_Log.printError("setAdditional: error to be returned - ", CHeader::BAD_VERSION);
+        setErrorCode(CHeader::BAD_VERSION & 0x0f);
+        m_Additional.setOpt(EDNS_PAYLOAD_SIZE, CHeader::BAD_VERSION >> 4, dnssecOk);
+        return true;
+    }
+    m_Additional.setOpt(EDNS_PAYLOAD_SIZE, 0, dnssecOk);
+    return false;
+}
+
+/*! Returns the UDP payload size of the client, MIN_PAYLOAD_SIZE
+ *  if the query had no OPT record
+ */
+unsigned int CMessage::getPayloadSize() {
+    return m_PayloadSize;
+}
+
+/*! Gets the length of the question section to echo in the
+ *  response. It is 0 if the question could not be parsed.
+ */
+unsigned int CMessage::getQuestionLength() {
+    return m_QuestionLength;
+}
+
+/*! Returns the QName (wire format), NULL if it was not parsed
+ */
+const unsigned char *CMessage::getQName() {
+    return m_Question.getQName();
+}
+
+/*! Returns the length of the QName
+ */
+unsigned int CMessage::getQNameLength() {
+    return m_Question.getQNameLength();
+}
+
+/*! Returns the QType, 0 if it was not parsed
+ */
+unsigned int CMessage::getQType() {
+    return m_Question.getQType();
+}
+
+/*! Returns the QClass, 0 if it was not parsed
+ */
+unsigned int CMessage::getQClass() {
+    return m_Question.getQClass();
+}
+
+/*! Returns the response code
+ */
+unsigned char CMessage::getRCode() {
+    return m_Header.getRCode();
+}
+
+/*! Returns the whole response code (RFC 6891): the one of
+ *  the header plus the upper bits inside the OPT record
  */
-string &CMessage::getHost() {
-    return m_Host;
+unsigned int CMessage::getExtendedRCode() {
+    return (m_Additional.getExtendedRCode() << 4) | m_Header.getRCode();
 }
 
-/*! Sets the answer section with the found ip address
+/*! Sets the answer section with the resource records found
+ *  (wire format, see CDnsDb). If answer is NULL the host
+ *  does not exist. If count is 0 the host exists without
+ *  records of the type asked (NODATA).
  */
-bool CMessage::setAnswer(unsigned long addr) {
+bool CMessage::setAnswer(const unsigned char *answer, unsigned int length, unsigned int count) {
     bool error = false;
 
-    // Check if addr has been found
-    if (addr != 0) {
-        // Set AnCount bit to 1, meaning there will be one answer
-        m_Header.setAnCount(1);
-        m_Answer.setAnswerSection(m_Question.getQName(), m_Question.getQType(), m_Question.getQClass(), addr);
+    // Check if the host has been found
+    if (answer != NULL) {
+        // The answer section is ready, it can be
+        // empty (NODATA, the rcode is NO_ERROR)
+        m_Header.setAnCount(count);
+        m_Answer.setAnswerSection(answer, length, count, m_Rotate ? m_Rotation++ : 0);
+        m_AnswerRecords = count;
+        m_HasAnswer = true;
     } else {
         // This server is assumed as authoritative.
         // The address has not been found, meaning that the
@@ -175,28 +363,111 @@ bool CMessage::setAnswer(unsigned long addr) {
     return error;
 }
 
-/*! Gets the answer section 
+/*! Sets the authority section (wire format, see CDnsDb), only
+ *  used by negative answers. It must be called after setAnswer
+ */
+void CMessage::setAuthority(const unsigned char *authority, unsigned int length, unsigned int count) {
+    m_Header.setNsCount(count);
+    m_Authority.setAuthoritySection(authority, length);
+    m_HasAuthority = true;
+}
+
+/*! Sets the response with the records of a cached answer (see
+ *  CCache): answer, authority and additional sections, and the
+ *  response code of the upstream server
+ */
+void CMessage::setCachedAnswer(const CCache::TAnswer &answer) {
+    // the records are written as one block, never rotated:
+    // their names can point to the ones before them
+    m_Header.setRCode((unsigned char) answer.m_RCode);
+    m_Header.setAnCount(answer.m_AnCount);
+    m_Header.setNsCount(answer.m_NsCount);
+    m_CachedArCount = answer.m_ArCount;
+    m_Answer.setAnswerSection(answer.m_Records, answer.m_Length, 1, 0);
+    m_AnswerRecords = answer.m_AnCount + answer.m_NsCount + answer.m_ArCount;
+    m_HasAnswer = true;
+}
+
+/*! The query could not be answered (SERVFAIL), for instance
+ *  because no upstream server replied
+ */
+void CMessage::setServerFailure() {
+    m_Log.printError("setServerFailure: error to be returned - ", CHeader::SERVER_FAILURE);
+    setErrorCode(CHeader::SERVER_FAILURE);
+}
+
+/*! Sets the RA bit of the response (forwarding mode)
+ */
+void CMessage::setRecursionAvailable() {
+    m_Header.setRecursionAvailable();
+}
+
+/*! The resource records of every answer are rotated, each
+ *  response starts by the next one (round robin)
+ */
+void CMessage::setRotation(bool rotate) {
+    m_Rotate = rotate;
+}
+
+/*! Writes the answer section inside the buffer, returns its length.
+ *  If it does not fit, the response is truncated (TC bit)
  */
-string &CMessage::getAnswer() {
-    m_AnswerString = m_Answer.getAnswerSection();
+unsigned int CMessage::getAnswer(unsigned char *buffer, unsigned int size) {
+    unsigned int length;
+
+    if (!m_HasAnswer) return 0;
 
-    return m_AnswerString;
+    length = m_Answer.getAnswerSection(buffer, size);
+    if (length == 0 && m_AnswerRecords > 0) {
+        // The client asks again over TCP, nothing
+        // else is sent but the OPT record
+        m_Log.printString("getAnswer: response truncated");
+        m_Header.setTruncated();
+        m_Header.setAnCount(0);
+        m_Header.setNsCount(0);
+        m_CachedArCount = 0;
+        m_HasAnswer = false;
+        m_HasAuthority = false;
+    }
+    return length;
 }
 
-/*! Gets the authority section 
+/*! Writes the authority section inside the message at the given
+ *  offset, returns its length. Its names are compressed against the
+ *  QName. If it does not fit in size bytes, it is dropped
  */
-string &CMessage::getAuthority() {
-    //  m_AuthorityString = m_Authority.getInformation();
+unsigned int CMessage::getAuthority(unsigned char *message, unsigned int offset, unsigned int size) {
+    CNameCompressor names(message);
+    unsigned int length;
+
+    if (!m_HasAuthority) return 0;
 
-    return m_AuthorityString;
+    // The QName is the only name before the authority section,
+    // the answer section is empty in a negative answer
+    if (m_QuestionLength > 0) names.add(HEADER_SIZE);
+    length = m_Authority.getAuthoritySection(message, offset, size, names);
+    if (length == 0) {
+        m_Header.setNsCount(0);
+        m_HasAuthority = false;
+    }
+    return length;
 }
 
-/*! Gets the additional section
+/*! Writes the additional section inside the buffer, returns its length
  */
-string &CMessage::getAdditional() {
-    //  m_AdditionalString = m_Additional.getInformation();
+unsigned int CMessage::getAdditional(unsigned char *buffer, unsigned int size) {
+    unsigned int length;
+
+    length = m_Additional.getAdditionalSection(buffer, size);
+    m_Header.setArCount(m_CachedArCount + (length > 0 ? 1 : 0));
+    return length;
+}
 
-    return m_AdditionalString;
+/*! Returns the length of the additional section, the room
+ *  that must be kept for it after the other sections
+ */
+unsigned int CMessage::getAdditionalLength() {
+    return m_Additional.getLength();
 }
 
 /*! Sets Error Code for the response
@@ -206,4 +477,9 @@ void CMessage::setErrorCode(unsigned char code) {
     // AnCount will be 0 as if there's an error
     // no answer section should be returned.
     m_Header.setAnCount(0);
+    m_Header.setNsCount(0);
+    m_AnswerRecords = 0;
+    m_CachedArCount = 0;
+    m_HasAnswer = false;
+    m_HasAuthority = false;
 }
@@ -22,6 +22,23 @@
 *  (Ref: RFC 1035). All the management of this message is done here,
 *  including error handling.
 *
+*  The message is parsed directly over the reception buffer, checking
+*  the bounds of every field, and without copying any part of it.
+*  There is one CMessage per worker, reset before every query, so the
+*  processing of a query never allocates memory.
+*
+*  The records after the question are only parsed to find the OPT
+*  record (EDNS0, RFC 6891), which gives the UDP payload size of the
+*  client. The response carries an OPT record too, with the payload
+*  size of this server. A response that does not fit is sent without
+*  its answer and with the TC bit set, so the client asks again over
+*  TCP. The authority section is only optional information for the
+*  negative answers, it is dropped without setting TC.
+*
+*  The answer of a forwarded query comes from the cache (see CCache):
+*  all its records are written as they came, after the question, and
+*  the whole response is truncated if they do not fit.
+*
 *  \version 0.1
 *  \date    11-September-2006
 *  \author  Cristina Camacho Romaguera
@@ -35,6 +52,7 @@
 #include "header.h"
 #include "question.h"
 #include "answer.h"
+#include "cache.h"
 #include "log.h"
 
 /*! \class CMessage
@@ -58,41 +76,123 @@ public:
      */
     ~CMessage();
 
-    /*! Sets header section with all the values received
+    /*! Clears all the sections to process a new query
+     */
+    void reset();
+
+    /*! Sets header section with all the values received.
+     *  The header is always 12 bytes long (RFC 1035).
+     */
+    bool setHeader(const unsigned char *header);
+
+    /*! Gets header section to send a message. Only the bytes
+     *  after the ID are written.
+     */
+    void getHeader(unsigned char *header);
+
+    /*! Sets question section with all the values received.
+     *  The question must stay inside the buffer until the
+     *  response has been built.
+     */
+    bool setQuestion(const unsigned char *question, unsigned long qLen);
+
+    /*! Parses the records after the question (the given buffer
+     *  starts after it), looking for the OPT record (EDNS0). It returns
+     *  true if they are not valid or the EDNS version is not supported
+     */
+    bool setAdditional(const unsigned char *records, unsigned long length);
+
+    /*! Returns the UDP payload size of the client, MIN_PAYLOAD_SIZE
+     *  if the query had no OPT record
+     */
+    unsigned int getPayloadSize();
+
+    /*! Gets the length of the question section to echo in the
+     *  response. It is 0 if the question could not be parsed.
+     */
+    unsigned int getQuestionLength();
+
+    /*! Returns the QName (wire format), NULL if it was not parsed
+     */
+    const unsigned char *getQName();
+
+    /*! Returns the length of the QName
+     */
+    unsigned int getQNameLength();
+
+    /*! Returns the QType, 0 if it was not parsed
+     */
+    unsigned int getQType();
+
+    /*! Returns the QClass, 0 if it was not parsed
+     */
+    unsigned int getQClass();
+
+    /*! Returns the response code
+     */
+    unsigned char getRCode();
+
+    /*! Returns the whole response code (RFC 6891): the one of
+     *  the header plus the upper bits inside the OPT record
+     */
+    unsigned int getExtendedRCode();
+
+    /*! Sets the answer section with the resource records found
+     *  (wire format, see CDnsDb). If answer is NULL the host
+     *  does not exist. If count is 0 the host exists without
+     *  records of the type asked (NODATA).
+     */
+    bool setAnswer(const unsigned char *answer, unsigned int length, unsigned int count);
+
+    /*! Sets the authority section (wire format, see CDnsDb), only
+     *  used by negative answers. It must be called after setAnswer
      */
-    bool setHeader(string &header);
+    void setAuthority(const unsigned char *authority, unsigned int length, unsigned int count);
 
-    /*! Gets header section to send a message
+    /*! Sets the response with the records of a cached answer (see
+     *  CCache): answer, authority and additional sections, and the
+     *  response code of the upstream server
      */
-    void getHeader(string &header);
+    void setCachedAnswer(const CCache::TAnswer &answer);
 
-    /*! Sets question section with all the values received
+    /*! The query could not be answered (SERVFAIL), for instance
+     *  because no upstream server replied
      */
-    bool setQuestion(string &question, unsigned long qLen);
+    void setServerFailure();
 
-    /*! Gets question section to send a message
+    /*! Sets the RA bit of the response (forwarding mode)
      */
-    unsigned int getQuestion(string &question);
+    void setRecursionAvailable();
 
-    /*! Returns the hostname
+    /*! The resource records of every answer are rotated, each
+     *  response starts by the next one (round robin)
      */
-    string &getHost();
+    void setRotation(bool rotate);
 
-    /*! Sets the answer section with the found ip address
+    /*! Writes the answer section inside the buffer, returns its length.
+     *  If it does not fit, the response is truncated (TC bit)
      */
-    bool setAnswer(long unsigned addr);
+    unsigned int getAnswer(unsigned char *buffer, unsigned int size);
 
-    /*! Gets the answer section
+    /*! Writes the authority section inside the message at the given
+     *  offset, returns its length. Its names are compressed against the
+     *  QName. If it does not fit in size bytes, it is dropped
      */
-    string &getAnswer();
+    unsigned int getAuthority(unsigned char *message, unsigned int offset, unsigned int size);
 
-    /*! Gets the authority section
+    /*! Writes the additional section inside the buffer, returns its length
      */
-    string &getAuthority();
+    unsigned int getAdditional(unsigned char *buffer, unsigned int size);
 
-    /*! Gets the additional section
+    /*! Returns the length of the additional section, the room
+     *  that must be kept for it after the other sections
      */
-    string &getAdditional();
+    unsigned int getAdditionalLength();
+
+    static const unsigned int MAX_LABEL_SIZE = 63;  /**< Max size of a label (RFC 1035) */
+    static const unsigned int MAX_NAME_SIZE = 255;  /**< Max size of a domain name (RFC 1035) */
+    static const unsigned int HEADER_SIZE = 12;     /**< Size of the header, the question follows it (RFC 1035) */
+    static const unsigned int EDNS_PAYLOAD_SIZE = 4096; /**< UDP payload size of this server (EDNS0) */
 
 private:
     /*! Sets Error Code for the response
@@ -104,10 +204,15 @@ private:
     CAnswer m_Answer;           /**<  CAnswer class */
     CAuthority m_Authority;        /**<  CAuthority class */
     CAdditional m_Additional;       /**<  CAdditional class */
-    string m_Host;             /**<  Host requested within the query */
-    string m_AnswerString;     /**<  Answer string to deliver to CDns */
-    string m_AuthorityString;  /**<  Authority string to deliver to CDns */
-    string m_AdditionalString; /**<  Additional string to deliver to CDns */
+    unsigned int m_QuestionLength;  /**<  Length of the question section */
+    bool m_HasAnswer;               /**<  The answer section is filled */
+    bool m_HasAuthority;            /**<  The authority section is filled */
+    unsigned int m_AnswerRecords;   /**<  Records written by getAnswer (all of them for a cached answer) */
+    unsigned int m_CachedArCount;   /**<  Additional records of a cached answer, besides the OPT one */
+    bool m_Rotate;                  /**<  Rotate the resource records of the answers */
+    unsigned int m_Rotation;        /**<  Answers built, the first record of the next one */
+    bool m_Edns;                    /**<  The query had an OPT record */
+    unsigned int m_PayloadSize;     /**<  UDP payload size of the client */
     CLog &m_Log;              /**<  Log file class */
 };
 
@@ -0,0 +1,361 @@
+/*!
+*****************************************************************************
+*  \file metrics.cpp
+*
+*  \brief   Metrics of the dns server over HTTP (Prometheus text format)
+*
+*  The latencies are exported as histograms in seconds. Their buckets
+*  are the powers of 2 from 1 us to 1 s, every one of them is an exact
+*  limit between buckets of CHistogram, so the counts are not estimated.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#include "metrics.h"
+#include "header.h"
+#include "rr.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+
+using namespace std;
+
+/*! Names of the query types, the others are written as TYPE<n> (RFC 3597)
+ */
+static const char *typeName(unsigned int qtype, char *buffer, size_t size) {
+    switch (qtype) {
+        case CResourceRecord::A: return "A";
+        case CResourceRecord::NS: return "NS";
+        case CResourceRecord::CNAME: return "CNAME";
+        case CResourceRecord::SOA: return "SOA";
+        case CResourceRecord::PTR: return "PTR";
+        case CResourceRecord::MX: return "MX";
+        case CResourceRecord::TXT: return "TXT";
+        case CResourceRecord::AAAA: return "AAAA";
+        case CResourceRecord::AXFR: return "AXFR";
+        case 255: return "ANY";
+    }
+    if (qtype > CStats::MAX_QTYPE) return "OTHER";
+    snprintf(buffer, size, "TYPE%u", qtype);
+    return buffer;
+}
+
+/*! Names of the response codes, the others are written as RCODE<n>
+ */
+static const char *rcodeName(unsigned int rcode, char *buffer, size_t size) {
+    switch (rcode) {
+        case CHeader::NO_ERROR: return "NOERROR";
+        case CHeader::FORMAT_ERROR: return "FORMERR";
+        case CHeader::SERVER_FAILURE: return "SERVFAIL";
+        case CHeader::NAME_ERROR: return "NXDOMAIN";
+        case CHeader::NOT_IMPLEMENTED: return "NOTIMP";
+        case CHeader::REFUSED: return "REFUSED";
+        case CHeader::BAD_VERSION: return "BADVERS";
+    }
+    snprintf(buffer, size, "RCODE%u", rcode);
+    return buffer;
+}
+
+/*! Writes the header of a metric
+ */
+static void writeHelp(ostringstream &out, const char *name, const char *type, const char *help) {
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " " << type << "\n";
+}
+
+/*! Constructor
+ */
+CMetricsServer::CMetricsServer()
+        : m_Listen(-1),
+          m_Stats(),
+          m_Cache(NULL),
+          m_Forwarder(NULL) {
+}
+
+/*! Destructor
+ */
+CMetricsServer::~CMetricsServer() {
+    if (m_Listen >= 0) close(m_Listen);
+}
+
+/*! Adds the counters of a worker
+ */
+void CMetricsServer::addStats(const CStats *stats) {
+    m_Stats.push_back(stats);
+}
+
+/*! Exports the counters of the response cache too (forwarding mode)
+ */
+void CMetricsServer::setCache(const CCache *cache) {
+    m_Cache = cache;
+}
+
+/*! Exports the counters of the forwarder too (forwarding mode)
+ */
+void CMetricsServer::setForwarder(const CForwarder *forwarder) {
+    m_Forwarder = forwarder;
+}
+
+/*! Starts listening on the given port of the loopback address
+ */
+void CMetricsServer::openCommunication(unsigned short port) {
+    struct sockaddr_in server;
+    int on = 1;
+
+    m_Listen = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_Listen < 0) {
+        cerr << "Error opening metrics socket" << endl;
+        exit(0);
+    }
+    setsockopt(m_Listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    // only local clients, the metrics are not public
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons(port);
+
+    if (::bind(m_Listen, (struct sockaddr *) &server, sizeof(server)) < 0) {
+        cerr << "Error binding metrics socket" << endl;
+        exit(0);
+    }
+    if (listen(m_Listen, 16) < 0) {
+        cerr << "Error listening on metrics socket" << endl;
+        exit(0);
+    }
+}
+
+/*! Serves requests forever
+ */
+void CMetricsServer::run() {
+    while (1) {
+        int fd = accept(m_Listen, NULL, NULL);
+
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            cerr << "Error accepting on metrics socket" << endl;
+            exit(0);
+        }
+        serve(fd);
+        close(fd);
+    }
+}
+
+/*! Returns the metrics of all the workers in text format
+ */
+string CMetricsServer::getMetrics() const {
+    CStats *total = new CStats();
+    ostringstream out;
+    char buffer[32];
+    static const char *stages[CStats::STAGES] = {"parse", "lookup", "build", "total"};
+
+    for (unsigned int i = 0; i < m_Stats.size(); i++) {
+        total->add(*m_Stats[i]);
+    }
+
+    writeHelp(out, "dnsd_messages_total", "counter", "Messages received.");
+    out << "dnsd_messages_total " << total->getMessages() << "\n";
+
+    writeHelp(out, "dnsd_queries_total", "counter", "Queries parsed, by type.");
+    for (unsigned int i = 0; i <= CStats::OTHER_QTYPE; i++) {
+        uint64_t count = total->getQueries(i);
+        // the usual types are always there, so their rates can be computed
+        if (count > 0 || i == CResourceRecord::A || i == CResourceRecord::AAAA) {
+            out << "dnsd_queries_total{qtype=\"" << typeName(i, buffer, sizeof(buffer)) << "\"} " << count << "\n";
+        }
+    }
+
+    writeHelp(out, "dnsd_responses_total", "counter", "Responses, by response code.");
+    for (unsigned int i = 0; i < CStats::RCODES; i++) {
+        uint64_t count = total->getResponses(i);
+        if (count > 0 || i <= CHeader::REFUSED) {
+            out << "dnsd_responses_total{rcode=\"" << rcodeName(i, buffer, sizeof(buffer)) << "\"} " << count << "\n";
+        }
+    }
+
+    writeHelp(out, "dnsd_parse_errors_total", "counter", "Messages with a wrong header or question.");
+    out << "dnsd_parse_errors_total " << total->getParseErrors() << "\n";
+
+    writeHelp(out, "dnsd_dropped_total", "counter", "Messages dropped without a response.");
+    out << "dnsd_dropped_total " << total->getDrops() << "\n";
+
+    writeHelp(out, "dnsd_latency_seconds", "histogram", "Time of every stage of the processing of a message.");
+    for (unsigned int s = 0; s < CStats::STAGES; s++) {
+        const CHistogram &latency = total->getLatency((CStats::TStage) s);
+        uint64_t seen = 0;
+        unsigned int bucket = 0;
+
+        // every power of 2 is the first value of a bucket, the
+        // values below it are the ones of the previous buckets
+        for (unsigned int p = FIRST_BUCKET; p <= LAST_BUCKET; p++) {
+            unsigned int limit = CHistogram::getBucket(1ULL << p);
+            while (bucket < limit) {
+                seen += latency.getBucketCount(bucket++);
+            }
+            snprintf(buffer, sizeof(buffer), "%.10g", (double) (1ULL << p) / 1e9);
+            out << "dnsd_latency_seconds_bucket{stage=\"" << stages[s] << "\",le=\"" << buffer << "\"} "
+                << seen << "\n";
+        }
+        // the count is read once, so +Inf is never below the other buckets
+        while (bucket < CHistogram::BUCKETS) {
+            seen += latency.getBucketCount(bucket++);
+        }
+        snprintf(buffer, sizeof(buffer), "%.9g", (double) latency.getSum() / 1e9);
+        out << "dnsd_latency_seconds_bucket{stage=\"" << stages[s] << "\",le=\"+Inf\"} " << seen << "\n"
+            << "dnsd_latency_seconds_sum{stage=\"" << stages[s] << "\"} " << buffer << "\n"
+            << "dnsd_latency_seconds_count{stage=\"" << stages[s] << "\"} " << seen << "\n";
+    }
+
+    if (m_Cache != NULL) {
+        CCache::TCounters counters;
+
+        m_Cache->getCounters(counters);
+        writeHelp(out, "dnsd_cache_hits_total", "counter", "Lookups answered by the response cache.");
+        out << "dnsd_cache_hits_total " << counters.m_Hits << "\n";
+        writeHelp(out, "dnsd_cache_misses_total", "counter", "Lookups not found in the response cache or expired.");
+        out << "dnsd_cache_misses_total " << counters.m_Misses << "\n";
+        writeHelp(out, "dnsd_cache_inserts_total", "counter", "Responses inserted in the cache.");
+        out << "dnsd_cache_inserts_total " << counters.m_Inserts << "\n";
+        writeHelp(out, "dnsd_cache_evictions_total", "counter", "Entries evicted to make room.");
+        out << "dnsd_cache_evictions_total " << counters.m_Evictions << "\n";
+        writeHelp(out, "dnsd_cache_prefetches_total", "counter", "Hits in the last part of the TTL that refreshed the entry.");
+        out << "dnsd_cache_prefetches_total " << counters.m_Prefetches << "\n";
+        writeHelp(out, "dnsd_cache_stale_hits_total", "counter", "Lookups answered with an expired entry (serve-stale).");
+        out << "dnsd_cache_stale_hits_total " << counters.m_StaleHits << "\n";
+        writeHelp(out, "dnsd_cache_entries", "gauge", "Entries in the response cache.");
+        out << "dnsd_cache_entries " << counters.m_Entries << "\n";
+        writeHelp(out, "dnsd_cache_bytes", "gauge", "Memory used by the entries of the response cache.");
+        out << "dnsd_cache_bytes " << counters.m_Bytes << "\n";
+    }
+
+    if (m_Forwarder != NULL) {
+        CForwarder::TCounters counters;
+
+        m_Forwarder->getCounters(counters);
+        writeHelp(out, "dnsd_forwarded_total", "counter", "Queries not cached, handed to the forwarder.");
+        out << "dnsd_forwarded_total " << counters.m_Forwarded << "\n";
+        writeHelp(out, "dnsd_forward_coalesced_total", "counter",
+                  "Forwarded queries that waited for the same question already in flight.");
+        out << "dnsd_forward_coalesced_total " << counters.m_Coalesced << "\n";
+        writeHelp(out, "dnsd_forward_refreshes_total", "counter", "Queries forwarded without a client, to refresh the cache.");
+        out << "dnsd_forward_refreshes_total " << counters.m_Refreshes << "\n";
+        writeHelp(out, "dnsd_forward_hedged_total", "counter",
+                  "Upstream queries sent to a second upstream after the hedging delay.");
+        out << "dnsd_forward_hedged_total " << counters.m_Hedged << "\n";
+        writeHelp(out, "dnsd_forward_hedge_wins_total", "counter", "Responses received first from the second upstream.");
+        out << "dnsd_forward_hedge_wins_total " << counters.m_HedgeWins << "\n";
+        writeHelp(out, "dnsd_forward_failures_total", "counter", "Forwarded queries answered with SERVFAIL.");
+        out << "dnsd_forward_failures_total " << counters.m_Failures << "\n";
+
+        vector<CForwarder::TUpstreamCounters> upstreams(m_Forwarder->getUpstreams());
+        for (unsigned int i = 0; i < upstreams.size(); i++) m_Forwarder->getUpstreamCounters(i, upstreams[i]);
+        writeHelp(out, "dnsd_upstream_queries_total", "counter", "Queries sent to an upstream server.");
+        for (unsigned int i = 0; i < upstreams.size(); i++) {
+            out << "dnsd_upstream_queries_total{upstream=\"" << upstreams[i].m_Name << "\"} " << upstreams[i].m_Sent
+                << "\n";
+        }
+        writeHelp(out, "dnsd_upstream_responses_total", "counter", "Valid responses of an upstream server.");
+        for (unsigned int i = 0; i < upstreams.size(); i++) {
+            out << "dnsd_upstream_responses_total{upstream=\"" << upstreams[i].m_Name << "\"} "
+                << upstreams[i].m_Responses << "\n";
+        }
+        writeHelp(out, "dnsd_upstream_timeouts_total", "counter", "Upstream queries without response in time.");
+        for (unsigned int i = 0; i < upstreams.size(); i++) {
+            out << "dnsd_upstream_timeouts_total{upstream=\"" << upstreams[i].m_Name << "\"} "
+                << upstreams[i].m_Timeouts << "\n";
+        }
+        writeHelp(out, "dnsd_upstream_errors_total", "counter", "Upstream responses that are errors or not valid.");
+        for (unsigned int i = 0; i < upstreams.size(); i++) {
+            out << "dnsd_upstream_errors_total{upstream=\"" << upstreams[i].m_Name << "\"} " << upstreams[i].m_Errors
+                << "\n";
+        }
+        writeHelp(out, "dnsd_upstream_srtt_seconds", "gauge", "Smoothed round trip time of an upstream server.");
+        for (unsigned int i = 0; i < upstreams.size(); i++) {
+            snprintf(buffer, sizeof(buffer), "%.6f", upstreams[i].m_Srtt / 1e6);
+            out << "dnsd_upstream_srtt_seconds{upstream=\"" << upstreams[i].m_Name << "\"} " << buffer << "\n";
+        }
+        writeHelp(out, "dnsd_upstream_up", "gauge", "1 if the upstream server is not left aside after its failures.");
+        for (unsigned int i = 0; i < upstreams.size(); i++) {
+            out << "dnsd_upstream_up{upstream=\"" << upstreams[i].m_Name << "\"} " << (upstreams[i].m_Up ? 1 : 0)
+                << "\n";
+        }
+    }
+
+    delete total;
+    return out.str();
+}
+
+/*! Reads a request and sends the response
+ */
+void CMetricsServer::serve(int fd) {
+    struct timeval timeout;
+    char request[MAX_REQUEST + 1];
+    unsigned long length = 0;
+    string body;
+    const char *status;
+    ostringstream response;
+
+    timeout.tv_sec = TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // only the request line is used, the rest is read until
+    // the end of the headers so the client is not reset
+    while (length < MAX_REQUEST) {
+        ssize_t n = recv(fd, request + length, MAX_REQUEST - length, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        length += (unsigned long) n;
+        request[length] = 0;
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) break;
+    }
+    request[length] = 0;
+    if (strchr(request, '\n') == NULL) return;
+
+    if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET /metrics?", 13) == 0) {
+        status = "200 OK";
+        body = getMetrics();
+    } else if (strncmp(request, "GET ", 4) == 0) {
+        status = "404 Not Found";
+        body = "Not found, the metrics are at /metrics\n";
+    } else {
+        status = "405 Method Not Allowed";
+        body = "Only GET is allowed\n";
+    }
+
+    response << "HTTP/1.0 " << status << "\r\n"
+             << "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << body;
+    string text = response.str();
+    sendAll(fd, text.c_str(), text.size());
+}
+
+/*! Sends all the bytes of a buffer. It returns true if there is an error
+ */
+bool CMetricsServer::sendAll(int fd, const char *buffer, unsigned long length) {
+    while (length > 0) {
+        ssize_t n = send(fd, buffer, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return true;
+        buffer += n;
+        length -= (unsigned long) n;
+    }
+    return false;
+}
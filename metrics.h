@@ -0,0 +1,97 @@
+/*!
+*****************************************************************************
+*  \file metrics.h
+*
+*  \brief   Metrics of the dns server over HTTP (Prometheus text format)
+*
+*  A small HTTP listener, bound to the loopback address only, answers
+*  "GET /metrics" with the counters of all the workers added together:
+*  messages received, queries by type, responses by code, parse errors,
+*  messages dropped and the latency histograms of every stage.
+*
+*  The counters are read on every request, the workers never wait for
+*  it (see CStats). The requests are served one at a time by a thread
+*  of its own, with a timeout, so a slow client only delays the metrics.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include "stats.h"
+#include "cache.h"
+#include "forwarder.h"
+
+#include <string>
+#include <vector>
+
+/*! \class CMetricsServer
+ *  \brief It exports the counters of the workers
+ *
+ *   CMetricsServer keeps the counters of every worker, and on every
+ *   request it adds them together and writes them in the Prometheus
+ *   text format (version 0.0.4).
+ *
+ */
+using namespace std;
+
+class CMetricsServer {
+public:
+    /*! Constructor
+     */
+    CMetricsServer();
+
+    /*! Destructor
+     */
+    ~CMetricsServer();
+
+    /*! Adds the counters of a worker
+     */
+    void addStats(const CStats *stats);
+
+    /*! Exports the counters of the response cache too (forwarding mode)
+     */
+    void setCache(const CCache *cache);
+
+    /*! Exports the counters of the forwarder too (forwarding mode)
+     */
+    void setForwarder(const CForwarder *forwarder);
+
+    /*! Starts listening on the given port of the loopback address
+     */
+    void openCommunication(unsigned short port);
+
+    /*! Serves requests forever
+     */
+    void run();
+
+    /*! Returns the metrics of all the workers in text format
+     */
+    string getMetrics() const;
+
+private:
+    /*! Reads a request and sends the response
+     */
+    void serve(int fd);
+
+    /*! Sends all the bytes of a buffer. It returns true if there is an error
+     */
+    static bool sendAll(int fd, const char *buffer, unsigned long length);
+
+    static const unsigned int MAX_REQUEST = 4096;  /**< Bytes read of a request */
+    static const unsigned int TIMEOUT = 2;         /**< Seconds to read or write a request */
+    static const unsigned int FIRST_BUCKET = 10;   /**< Latency buckets from 2^10 ns (1 us) */
+    static const unsigned int LAST_BUCKET = 30;    /**< to 2^30 ns (1 s) */
+
+    int m_Listen;                   /**< Listening socket */
+    vector<const CStats *> m_Stats; /**< Counters of the workers */
+    const CCache *m_Cache;          /**< Response cache, NULL if there is none */
+    const CForwarder *m_Forwarder;  /**< Forwarder, NULL if there is none */
+};
+
+#endif
@@ -0,0 +1,495 @@
+/*!
+*****************************************************************************
+*  \file microBench.cpp
+*
+*  \brief   Microbenchmarks of the dns server (dnsd-microbench)
+*
+*  It measures in isolation the cost of the stages of the processing of
+*  a query over synthetic data, so that regressions can be found before
+*  they reach the server.
+*
+*  parse:  CMessage::setHeader, setQuestion and setAdditional over a
+*          corpus of synthetic queries (names in mixed case, with and
+*          without an OPT record).
+*
+*  lookup: CDnsDb::getAddress (wire format QName) against a std::map
+*          keyed by strcmp on dotted names (the structure used before
+*          the hash table), for host tables of several sizes (10k to 10M
+*          names by default, or the sizes given as arguments). Half of
+*          the lookups are misses.
+*
+*  build:  CDns::buildMessage alone, for one query already parsed and
+*          looked up: a positive answer, one with 8 records, a negative
+*          answer with its SOA and an answer with an OPT record. The
+*          response is kept instead of sent, but it is logged as usual.
+*
+*  full:   CDns::processMessage (parse, lookup and build) over the
+*          corpus, half of the queries are misses, without and with
+*          the time of the stages (timed, as with the metrics enabled).
+*
+*  Every result is given per operation: the time, the allocations
+*  (operator new, counted only in the thread of the benchmark) and the
+*  instructions executed in user space (perf_event_open), "n/a" when
+*  the system does not allow to count them.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#include "dns.h"
+#include "dnsDb.h"
+#include "dnsDbManager.h"
+#include "log.h"
+#include "message.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <map>
+#include <new>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+using namespace std;
+
+static const unsigned int HEADER_SIZE = 12;  /**< Size of the header of a message */
+static const unsigned int PACKET_SIZE = 512; /**< Room for every query of a corpus */
+static const unsigned int CORPUS_SIZE = 4096; /**< Queries of a corpus, they are reused */
+static const unsigned int HOSTS = 1000;      /**< Names of the database of CDns */
+static const unsigned int MANY = 8;          /**< Addresses of the name with several records */
+
+static __thread unsigned long allocations = 0; /**< operator new calls of this thread */
+static int instructionsFd = -1;                /**< Instructions counter, -1 if not available */
+
+/*! Counts the allocations of the thread
+ */
+void *operator new(size_t size) {
+    void *p;
+
+    allocations++;
+    p = malloc(size == 0 ? 1 : size);
+    if (p == NULL) throw bad_alloc();
+    return p;
+}
+
+/*! Frees the memory of operator new
+ */
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+/*! Values at the start of a measure
+ */
+struct TMeasure {
+    double m_Time;                 /**< Monotonic time in ns */
+    unsigned long m_Allocations;   /**< Allocations of the thread */
+    uint64_t m_Instructions;       /**< Instructions in user space */
+};
+
+/*! Comparison used by the old database
+ */
+class less_string {
+public:
+    bool operator()(const char *s1, const char *s2) const {
+        return strcmp(s1, s2) < 0;
+    }
+};
+
+/*! Monotonic time in ns
+ */
+static double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*! Opens the instructions counter of the thread (user space only).
+ *  Without it (no hardware counters, or perf_event_paranoid) the
+ *  instructions are not reported
+ */
+static void openInstructions() {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    instructionsFd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*! Returns the instructions executed by the thread, 0 without counter
+ */
+static uint64_t instructions() {
+    uint64_t count = 0;
+
+    if (instructionsFd >= 0 && read(instructionsFd, &count, sizeof(count)) != sizeof(count)) count = 0;
+    return count;
+}
+
+/*! Starts a measure
+ */
+static void start(TMeasure &measure) {
+    measure.m_Allocations = allocations;
+    measure.m_Instructions = instructions();
+    measure.m_Time = now();
+}
+
+/*! Ends a measure and prints its result line
+ */
+static void stop(const TMeasure &measure, const char *stage, const char *variant, unsigned long size,
+                 unsigned long ops) {
+    double ns = now() - measure.m_Time;
+    uint64_t count = instructions() - measure.m_Instructions;
+    unsigned long allocs = allocations - measure.m_Allocations;
+
+    cout << left << setw(10) << stage << setw(12) << variant << right << setw(10) << size
+         << fixed << setprecision(1) << setw(12) << ns / ops << " ns/op"
+         << setprecision(2) << setw(10) << (double) allocs / ops << " allocs/op";
+    if (instructionsFd >= 0) {
+        cout << setprecision(0) << setw(10) << (double) count / ops << " instr/op" << endl;
+    } else {
+        cout << setw(10) << "n/a" << " instr/op" << endl;
+    }
+}
+
+/*! Builds the synthetic names, with a shape similar to real host names
+ */
+static void buildNames(unsigned long count, const char *prefix, vector<char> &arena, vector<unsigned long> &names) {
+    char buffer[64];
+
+    arena.clear();
+    names.clear();
+    for (unsigned long i = 0; i < count; i++) {
+        int length = snprintf(buffer, sizeof(buffer), "%s%lu.zone%lu.example.com", prefix, i, i % 997);
+        names.push_back(arena.size());
+        arena.insert(arena.end(), buffer, buffer + length + 1);
+    }
+}
+
+/*! Converts the names to wire format, in another arena. There is
+ *  one offset more than names, so the length of every name is known
+ */
+static void toWire(const vector<char> &arena, const vector<unsigned long> &names,
+                   vector<unsigned char> &wireArena, vector<unsigned long> &wireNames) {
+    unsigned char wire[CDnsDb::MAX_NAME_SIZE];
+
+    wireArena.clear();
+    wireNames.clear();
+    for (unsigned long i = 0; i < names.size(); i++) {
+        unsigned int length = CDnsDb::toWire(&arena[names[i]], wire);
+        wireNames.push_back(wireArena.size());
+        wireArena.insert(wireArena.end(), wire, wire + length);
+    }
+    wireNames.push_back(wireArena.size());
+}
+
+/*! Builds a query (RD set) for a name, with the letters of the
+ *  name in mixed case, and an OPT record (payload 4096, DO set)
+ *  if edns is set. It returns its length
+ */
+static unsigned int buildQuery(const char *name, unsigned int qtype, bool edns, unsigned int id,
+                               unsigned char *packet) {
+    static const unsigned char opt[11] = {0, 0, 41, 0x10, 0x00, 0, 0, 0x80, 0, 0, 0};
+    unsigned int length;
+
+    memset(packet, 0, HEADER_SIZE);
+    packet[0] = (unsigned char) (id >> 8);
+    packet[1] = (unsigned char) id;
+    packet[2] = 0x01;
+    packet[5] = 1;
+    packet[11] = edns ? 1 : 0;
+
+    length = CDnsDb::toWire(name, packet + HEADER_SIZE);
+    for (unsigned int i = 0; i < length; i++) {
+        unsigned char &c = packet[HEADER_SIZE + i];
+        if (c >= 'a' && c <= 'z' && ((i + id) & 1)) c = (unsigned char) (c - 'a' + 'A');
+    }
+    length += HEADER_SIZE;
+
+    packet[length++] = (unsigned char) (qtype >> 8);
+    packet[length++] = (unsigned char) qtype;
+    packet[length++] = 0;
+    packet[length++] = 1;
+    if (edns) {
+        memcpy(packet + length, opt, sizeof(opt));
+        length += sizeof(opt);
+    }
+    return length;
+}
+
+/*! Builds a corpus of queries, every one of them in its own slot
+ *  of PACKET_SIZE bytes. Half of the names are misses if misses is
+ *  set, and one every edns queries has an OPT record (0 none)
+ */
+static void buildCorpus(bool misses, unsigned int edns, vector<unsigned char> &packets, vector<unsigned int> &lengths) {
+    vector<char> hosts, others;
+    vector<unsigned long> hostNames, otherNames;
+
+    buildNames(HOSTS, "host", hosts, hostNames);
+    buildNames(HOSTS, "miss", others, otherNames);
+
+    packets.assign(CORPUS_SIZE * PACKET_SIZE, 0);
+    lengths.resize(CORPUS_SIZE);
+    srand(12345);
+    for (unsigned int i = 0; i < CORPUS_SIZE; i++) {
+        unsigned long r = (unsigned long) rand() % HOSTS;
+        const char *name = (misses && (i & 1)) ? &others[otherNames[r]] : &hosts[hostNames[r]];
+        lengths[i] = buildQuery(name, 1, edns > 0 && i % edns == 0, i, &packets[i * PACKET_SIZE]);
+    }
+}
+
+/*! Writes the hosts file of the CDns benchmarks: HOSTS names with
+ *  one address, one name with MANY addresses and a SOA
+ */
+static bool writeHosts(const char *file) {
+    ofstream out(file);
+
+    out << "$TTL 300" << endl;
+    out << "$SOA example.com ns1.example.com hostmaster.example.com 1 3600 600 86400 300" << endl;
+    for (unsigned int i = 0; i < HOSTS; i++) {
+        out << "10." << i / 65536 << "." << (i / 256) % 256 << "." << i % 256
+            << " host" << i << ".zone" << i % 997 << ".example.com" << endl;
+    }
+    for (unsigned int i = 0; i < MANY; i++) {
+        out << "192.0.2." << i + 1 << " many.example.com" << endl;
+    }
+    return !out;
+}
+
+/*! Parse benchmark: header alone, header and question, and the
+ *  three of them with an OPT record in every query
+ */
+static void benchParse(unsigned long ops) {
+    char logFile[] = "/dev/null";
+    CLog log(logFile);
+    CMessage message(log);
+    vector<unsigned char> packets, ednsPackets;
+    vector<unsigned int> lengths, ednsLengths;
+    unsigned long errors = 0;
+    TMeasure measure;
+
+    buildCorpus(false, 0, packets, lengths);
+    buildCorpus(false, 1, ednsPackets, ednsLengths);
+
+    start(measure);
+    for (unsigned long i = 0; i < ops; i++) {
+        const unsigned char *packet = &packets[(i % CORPUS_SIZE) * PACKET_SIZE];
+        message.reset();
+        errors += message.setHeader(packet);
+    }
+    stop(measure, "parse", "header", CORPUS_SIZE, ops);
+
+    start(measure);
+    for (unsigned long i = 0; i < ops; i++) {
+        const unsigned char *packet = &packets[(i % CORPUS_SIZE) * PACKET_SIZE];
+        unsigned int length = lengths[i % CORPUS_SIZE];
+        message.reset();
+        errors += message.setHeader(packet);
+        errors += message.setQuestion(packet + HEADER_SIZE, length - HEADER_SIZE);
+    }
+    stop(measure, "parse", "question", CORPUS_SIZE, ops);
+
+    start(measure);
+    for (unsigned long i = 0; i < ops; i++) {
+        const unsigned char *packet = &ednsPackets[(i % CORPUS_SIZE) * PACKET_SIZE];
+        unsigned int length = ednsLengths[i % CORPUS_SIZE];
+        unsigned int offset;
+        message.reset();
+        errors += message.setHeader(packet);
+        errors += message.setQuestion(packet + HEADER_SIZE, length - HEADER_SIZE);
+        offset = HEADER_SIZE + message.getQuestionLength();
+        errors += message.setAdditional(packet + offset, length - offset);
+    }
+    stop(measure, "parse", "edns", CORPUS_SIZE, ops);
+
+    if (errors > 0) cerr << "parse: " << errors << " errors" << endl;
+}
+
+/*! Build benchmark of one query: it is processed once and then
+ *  only the response is built again and again
+ */
+static void benchBuildQuery(CDns &dns, const char *variant, const char *name, bool edns, unsigned long ops) {
+    vector<unsigned char> buffer(CDns::MAX_STREAM_SIZE);
+    struct sockaddr_in6 client;
+    unsigned int length;
+    TMeasure measure;
+
+    memset(&client, 0, sizeof(client));
+    client.sin6_family = AF_INET6;
+    client.sin6_addr = in6addr_loopback;
+
+    length = buildQuery(name, 1, edns, 1, &buffer[0]);
+    if (dns.processMessage(&buffer[0], length, client, 0) == 0) {
+        cerr << "build: no response for " << name << endl;
+        return;
+    }
+
+    start(measure);
+    for (unsigned long i = 0; i < ops; i++) {
+        dns.buildMessage(&buffer[0]);
+    }
+    stop(measure, "build", variant, 1, ops);
+}
+
+/*! Build and full benchmarks, with a CDns over a database of
+ *  HOSTS names read from a temporary hosts file
+ */
+static void benchDns(unsigned long ops) {
+    char hostsFile[] = "/tmp/dnsd-microbench.XXXXXX";
+    char logFile[] = "/dev/null";
+    vector<unsigned char> packets;
+    vector<unsigned int> lengths;
+    vector<unsigned char> buffer(CDns::MAX_STREAM_SIZE);
+    struct sockaddr_in6 client;
+    unsigned long responses = 0;
+    TMeasure measure;
+    int fd;
+
+    fd = mkstemp(hostsFile);
+    if (fd < 0) {
+        cerr << "Error creating " << hostsFile << endl;
+        return;
+    }
+    close(fd);
+    if (writeHosts(hostsFile)) {
+        cerr << "Error writing " << hostsFile << endl;
+        unlink(hostsFile);
+        return;
+    }
+
+    CDnsDbManager dnsDb(hostsFile, 1);
+    bool error = dnsDb.open();
+    unlink(hostsFile);
+    if (error) {
+        cerr << "Error reading " << hostsFile << endl;
+        return;
+    }
+    CDns dns(logFile, dnsDb, 1);
+    dns.setCapture(true);
+
+    benchBuildQuery(dns, "answer", "host1.zone1.example.com", false, ops);
+    benchBuildQuery(dns, "many", "many.example.com", false, ops);
+    benchBuildQuery(dns, "nxdomain", "nothere.example.com", false, ops);
+    benchBuildQuery(dns, "edns", "host1.zone1.example.com", true, ops);
+
+    // one every 4 queries has an OPT record
+    buildCorpus(true, 4, packets, lengths);
+    memset(&client, 0, sizeof(client));
+    client.sin6_family = AF_INET6;
+    client.sin6_addr = in6addr_loopback;
+
+    // without and with the time of the stages (metrics enabled)
+    for (unsigned int timing = 0; timing < 2; timing++) {
+        dns.setTiming(timing == 1);
+        start(measure);
+        for (unsigned long i = 0; i < ops; i++) {
+            unsigned int length = lengths[i % CORPUS_SIZE];
+            memcpy(&buffer[0], &packets[(i % CORPUS_SIZE) * PACKET_SIZE], length);
+            responses += dns.processMessage(&buffer[0], length, client, 0) > 0;
+        }
+        stop(measure, "full", timing == 1 ? "timed" : "mixed", HOSTS, ops);
+    }
+
+    if (responses != 2 * ops) cerr << "full: " << 2 * ops - responses << " queries without response" << endl;
+}
+
+/*! Lookup benchmark for a table of the given size
+ */
+static void benchLookup(unsigned long size, unsigned long ops) {
+    vector<char> hosts, misses;
+    vector<unsigned long> hostNames, missNames;
+    vector<const char *> queries(ops);
+    vector<unsigned char> wireHosts, wireMisses;
+    vector<unsigned long> wireHostNames, wireMissNames;
+    vector<const unsigned char *> wireQueries(ops);
+    vector<unsigned int> wireLengths(ops);
+    unsigned long found = 0;
+    TMeasure measure;
+
+    buildNames(size, "host", hosts, hostNames);
+    buildNames(size, "miss", misses, missNames);
+    toWire(hosts, hostNames, wireHosts, wireHostNames);
+    toWire(misses, missNames, wireMisses, wireMissNames);
+
+    // random order, half of them are not in the table
+    srand(12345);
+    for (unsigned long i = 0; i < ops; i++) {
+        unsigned long r = (unsigned long) rand() % size;
+        if (i & 1) {
+            queries[i] = &misses[missNames[r]];
+            wireQueries[i] = &wireMisses[wireMissNames[r]];
+            wireLengths[i] = (unsigned int) (wireMissNames[r + 1] - wireMissNames[r]);
+        } else {
+            queries[i] = &hosts[hostNames[r]];
+            wireQueries[i] = &wireHosts[wireHostNames[r]];
+            wireLengths[i] = (unsigned int) (wireHostNames[r + 1] - wireHostNames[r]);
+        }
+    }
+
+    {
+        map<const char *, unsigned long int, less_string> db;
+        for (unsigned long i = 0; i < size; i++) {
+            db[&hosts[hostNames[i]]] = i + 1;
+        }
+        start(measure);
+        for (unsigned long i = 0; i < ops; i++) {
+            map<const char *, unsigned long int, less_string>::const_iterator it = db.find(queries[i]);
+            if (it != db.end()) found += it->second;
+        }
+        stop(measure, "lookup", "std::map", size, ops);
+    }
+
+    {
+        CDnsDb db;
+        for (unsigned long i = 0; i < size; i++) {
+            uint32_t address = (uint32_t) (i + 1);
+            db.addHost(&hosts[hostNames[i]], (const unsigned char *) &address, 4, 0);
+        }
+        db.prepareAnswers();
+        start(measure);
+        for (unsigned long i = 0; i < ops; i++) {
+            found += db.getAddress(wireQueries[i], wireLengths[i]);
+        }
+        stop(measure, "lookup", "CDnsDb", size, ops);
+    }
+
+    // keeps the compiler from removing the loops
+    if (found == 1) cout << endl;
+}
+
+int main(int argc, char **argv) {
+    unsigned long ops = 1000000;
+    vector<unsigned long> sizes;
+
+    for (int i = 1; i < argc; i++) {
+        sizes.push_back(strtoul(argv[i], NULL, 10));
+    }
+    if (sizes.empty()) {
+        sizes.push_back(10000);
+        sizes.push_back(1000000);
+        sizes.push_back(10000000);
+    }
+
+    openInstructions();
+    benchParse(ops);
+    for (unsigned long i = 0; i < sizes.size(); i++) {
+        if (sizes[i] > 0) benchLookup(sizes[i], ops);
+    }
+    benchDns(ops);
+    return 0;
+}
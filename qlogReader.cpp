@@ -0,0 +1,167 @@
+/*!
+*****************************************************************************
+*  \file qlogReader.cpp
+*
+*  \brief   Reader of the binary query log (dnsd-qlog)
+*
+*  It maps the ring file written by dnsd (option "-q") read-only and
+*  prints the records from the oldest to the newest one, one line per
+*  query. Records being written, or overwritten while reading, are
+*  skipped.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#include "queryLog.h"
+#include "rr.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+/*! Prints the usage and leaves
+ */
+static void usage() {
+    cerr << "Usage: dnsd-qlog [-n <last_records>] <query_log_file>" << endl;
+    exit(1);
+}
+
+/*! Returns the name of a QType
+ */
+static const char *typeName(unsigned int qtype, char *buffer, size_t size) {
+    switch (qtype) {
+        case 0: return "-";
+        case CResourceRecord::A: return "A";
+        case CResourceRecord::NS: return "NS";
+        case CResourceRecord::CNAME: return "CNAME";
+        case CResourceRecord::SOA: return "SOA";
+        case CResourceRecord::PTR: return "PTR";
+        case CResourceRecord::MX: return "MX";
+        case CResourceRecord::TXT: return "TXT";
+        case CResourceRecord::AAAA: return "AAAA";
+        case CResourceRecord::ALL: return "ANY";
+        default:
+            snprintf(buffer, size, "TYPE%u", qtype);
+            return buffer;
+    }
+}
+
+/*! Returns the name of a response code
+ */
+static const char *rcodeName(unsigned int rcode) {
+    static const char *names[] = {"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"};
+
+    if (rcode < 6) return names[rcode];
+    // extended code of the OPT record (RFC 6891)
+    return rcode == 16 ? "BADVERS" : "RCODE?";
+}
+
+/*! Converts a QName in wire format to the dotted format
+ */
+static void printName(const CQueryLog::TRecord &record, char *buffer) {
+    unsigned int length = record.m_QNameLength;
+    unsigned int i = 0, out = 0;
+
+    if (length > CQueryLog::MAX_QNAME_SIZE) length = CQueryLog::MAX_QNAME_SIZE;
+    if (length == 0) {
+        strcpy(buffer, "-");
+        return;
+    }
+    while (i < length && record.m_QName[i] != 0) {
+        unsigned int len = record.m_QName[i++];
+        if (out > 0) buffer[out++] = '.';
+        for (unsigned int j = 0; j < len && i < length; j++) {
+            buffer[out++] = (char) record.m_QName[i++];
+        }
+    }
+    if (out == 0) buffer[out++] = '.';
+    // the name was cut when it was logged
+    if (record.m_QNameLength > CQueryLog::MAX_QNAME_SIZE) {
+        memcpy(buffer + out, "...", 3);
+        out += 3;
+    }
+    buffer[out] = 0;
+}
+
+int main(int argc, char **argv) {
+    unsigned long last = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n':
+                last = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind + 1 != argc) usage();
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (unsigned long) st.st_size < CQueryLog::HEADER_SIZE) {
+        cerr << "Error opening " << argv[optind] << endl;
+        return 1;
+    }
+    unsigned char *map = (unsigned char *) mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        cerr << "Error mapping " << argv[optind] << endl;
+        return 1;
+    }
+
+    const CQueryLog::TFileHeader *header = (const CQueryLog::TFileHeader *) map;
+    if (memcmp(header->m_Magic, "DNSQLOG", 8) != 0 || header->m_Version != CQueryLog::VERSION ||
+        header->m_RecordSize != sizeof(CQueryLog::TRecord) || header->m_Capacity == 0 ||
+        header->m_Capacity > ((unsigned long) st.st_size - CQueryLog::HEADER_SIZE) / sizeof(CQueryLog::TRecord)) {
+        cerr << argv[optind] << " is not a query log file" << endl;
+        return 1;
+    }
+    const CQueryLog::TRecord *records = (const CQueryLog::TRecord *) (map + CQueryLog::HEADER_SIZE);
+
+    uint64_t next = __atomic_load_n(&header->m_Next, __ATOMIC_ACQUIRE);
+    uint64_t first = next > header->m_Capacity ? next - header->m_Capacity : 0;
+    if (last > 0 && next - first > last) first = next - last;
+
+    for (uint64_t sequence = first; sequence < next; sequence++) {
+        const CQueryLog::TRecord *slot = &records[sequence % header->m_Capacity];
+        CQueryLog::TRecord record;
+
+        if (__atomic_load_n(&slot->m_Sequence, __ATOMIC_ACQUIRE) != sequence + 1) continue;
+        memcpy(&record, slot, sizeof(record));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        // overwritten while it was copied
+        if (__atomic_load_n(&slot->m_Sequence, __ATOMIC_RELAXED) != sequence + 1) continue;
+
+        char when[32], address[INET6_ADDRSTRLEN], name[4 * CQueryLog::MAX_QNAME_SIZE + 8], type[16];
+        time_t seconds = (time_t) (record.m_Timestamp / 1000000000ULL);
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+        inet_ntop(record.m_Family == AF_INET6 ? AF_INET6 : AF_INET, record.m_Address, address, sizeof(address));
+        printName(record, name);
+
+        printf("%s.%06luZ %s#%u %s %s %s %u/%u bytes %.1fus\n",
+               when, (unsigned long) (record.m_Timestamp % 1000000000ULL) / 1000,
+               address, record.m_Port, name, typeName(record.m_QType, type, sizeof(type)),
+               record.m_ResponseLength ? rcodeName(record.m_RCode) : "DROPPED",
+               record.m_QueryLength, record.m_ResponseLength, record.m_Latency / 1000.0);
+    }
+    munmap(map, (size_t) st.st_size);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*!
+*****************************************************************************
+*  \file queryLog.cpp
+*
+*  \brief   Binary query log kept inside a memory-mapped ring file
+*
+*  Instead of the text log, every query can be stored as a fixed-size
+*  binary record (time, client, qname, qtype, rcode, latency and sizes)
+*  inside a file of fixed size that is mapped in memory. The file is a
+*  ring: when it is full the oldest records are overwritten. The records
+*  are only copied to memory, the kernel writes them back to disk.
+*
+*  The file is shared by all the workers, every one of them reserves a
+*  slot with an atomic increment of the sequence kept in the header of
+*  the file. The tool dnsd-qlog decodes the file.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#include "queryLog.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+/*! Constructor
+ */
+CQueryLog::CQueryLog()
+        : m_Fd(-1),
+          m_Map(NULL),
+          m_MapSize(0),
+          m_Header(NULL),
+          m_Records(NULL) {
+}
+
+/*! Destructor
+ */
+CQueryLog::~CQueryLog() {
+    if (m_Map != NULL) munmap(m_Map, m_MapSize);
+    if (m_Fd >= 0) close(m_Fd);
+}
+
+/*! Opens the ring file with room for the given number of records.
+ *  It returns true if there is an error
+ */
+bool CQueryLog::open(const char *file, unsigned long records) {
+    struct stat st;
+    bool reuse;
+
+    if (records == 0) return true;
+
+    m_Fd = ::open(file, O_RDWR | O_CREAT, 0644);
+    if (m_Fd < 0) return true;
+
+    m_MapSize = HEADER_SIZE + records * sizeof(TRecord);
+    if (fstat(m_Fd, &st) < 0) return true;
+    // the file keeps its history if it has the same format
+    reuse = ((unsigned long) st.st_size == m_MapSize);
+    if (!reuse && ftruncate(m_Fd, (off_t) m_MapSize) < 0) return true;
+
+    m_Map = (unsigned char *) mmap(NULL, m_MapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_Fd, 0);
+    if (m_Map == MAP_FAILED) {
+        m_Map = NULL;
+        return true;
+    }
+    m_Header = (TFileHeader *) m_Map;
+    m_Records = (TRecord *) (m_Map + HEADER_SIZE);
+
+    if (reuse && memcmp(m_Header->m_Magic, "DNSQLOG", 8) == 0 &&
+        m_Header->m_Version == VERSION &&
+        m_Header->m_RecordSize == sizeof(TRecord) &&
+        m_Header->m_Capacity == records) {
+        return false;
+    }
+
+    // new (or incompatible) file
+    memset(m_Map, 0, m_MapSize);
+    memcpy(m_Header->m_Magic, "DNSQLOG", 8);
+    m_Header->m_Version = VERSION;
+    m_Header->m_RecordSize = sizeof(TRecord);
+    m_Header->m_Capacity = records;
+    m_Header->m_Next = 0;
+    return false;
+}
+
+/*! Stores a new record. Any worker can call it at the same time.
+ *  The client can be an ipv4 or ipv6 address, ipv4 clients of an
+ *  ipv6 socket (mapped addresses) are stored as ipv4 ones.
+ */
+void CQueryLog::add(uint64_t timestamp, uint32_t latency, const struct sockaddr *client,
+                    const unsigned char *qname, unsigned int qnameLength, unsigned int qtype,
+                    unsigned int rcode, unsigned int queryLength, unsigned int responseLength) {
+    uint64_t sequence = __atomic_fetch_add(&m_Header->m_Next, 1, __ATOMIC_RELAXED);
+    TRecord *record = &m_Records[sequence % m_Header->m_Capacity];
+
+    // readers skip the record while it is being written
+    __atomic_store_n(&record->m_Sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->m_Timestamp = timestamp;
+    record->m_Latency = latency;
+    record->m_QueryLength = (uint16_t) queryLength;
+    record->m_ResponseLength = (uint16_t) responseLength;
+    record->m_QType = (uint16_t) qtype;
+    record->m_RCode = (uint8_t) rcode;
+    record->m_QNameLength = (uint8_t) qnameLength;
+    record->m_Reserved = 0;
+    memset(record->m_Address, 0, sizeof(record->m_Address));
+    if (client->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *client6 = (const struct sockaddr_in6 *) client;
+        record->m_Port = ntohs(client6->sin6_port);
+        if (IN6_IS_ADDR_V4MAPPED(&client6->sin6_addr)) {
+            record->m_Family = AF_INET;
+            memcpy(record->m_Address, &client6->sin6_addr.s6_addr[12], 4);
+        } else {
+            record->m_Family = AF_INET6;
+            memcpy(record->m_Address, &client6->sin6_addr, 16);
+        }
+    } else {
+        const struct sockaddr_in *client4 = (const struct sockaddr_in *) client;
+        record->m_Port = ntohs(client4->sin_port);
+        record->m_Family = AF_INET;
+        memcpy(record->m_Address, &client4->sin_addr, 4);
+    }
+    memcpy(record->m_QName, qname, qnameLength < MAX_QNAME_SIZE ? qnameLength : MAX_QNAME_SIZE);
+
+    __atomic_store_n(&record->m_Sequence, sequence + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,102 @@
+/*!
+*****************************************************************************
+*  \file queryLog.h
+*
+*  \brief   Binary query log kept inside a memory-mapped ring file
+*
+*  Instead of the text log, every query can be stored as a fixed-size
+*  binary record (time, client, qname, qtype, rcode, latency and sizes)
+*  inside a file of fixed size that is mapped in memory. The file is a
+*  ring: when it is full the oldest records are overwritten. The records
+*  are only copied to memory, the kernel writes them back to disk.
+*
+*  The file is shared by all the workers, every one of them reserves a
+*  slot with an atomic increment of the sequence kept in the header of
+*  the file. The tool dnsd-qlog decodes the file.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#ifndef _QUERY_LOG_H
+#define _QUERY_LOG_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+/*! \class CQueryLog
+ *  \brief It keeps the binary query log
+ *
+ *   CQueryLog opens (or creates) the ring file and maps it in memory.
+ *   An existing file with the same format and size is reused, so the
+ *   history is kept between restarts.
+ *
+ */
+class CQueryLog {
+public:
+    static const unsigned int MAX_QNAME_SIZE = 80; /**< Bytes of the QName kept, the rest is cut */
+
+    /*! Header of the file, it fills the first page
+     */
+    struct TFileHeader {
+        char m_Magic[8];          /**< "DNSQLOG" */
+        uint32_t m_Version;       /**< format of the records */
+        uint32_t m_RecordSize;    /**< sizeof(TRecord) */
+        uint64_t m_Capacity;      /**< number of records of the ring */
+        uint64_t m_Next;          /**< sequence of the next record, atomically incremented */
+    };
+
+    /*! Record of a query. All the fields are kept in host order
+     */
+    struct TRecord {
+        uint64_t m_Sequence;        /**< sequence + 1, written the last one. 0 while it is being written */
+        uint64_t m_Timestamp;       /**< reception time, ns since the epoch */
+        uint32_t m_Latency;         /**< ns from the reception to the response */
+        uint16_t m_QueryLength;     /**< bytes received */
+        uint16_t m_ResponseLength;  /**< bytes sent, 0 if the query was discarded */
+        uint16_t m_QType;           /**< QType, 0 if the question was not parsed */
+        uint8_t m_RCode;            /**< response code, with the extended bits of the OPT record */
+        uint8_t m_Family;           /**< AF_INET or AF_INET6 */
+        uint16_t m_Port;            /**< port of the client */
+        uint8_t m_QNameLength;      /**< length of the QName (wire format), maybe bigger than the data kept */
+        uint8_t m_Reserved;
+        uint8_t m_Address[16];      /**< address of the client */
+        uint8_t m_QName[MAX_QNAME_SIZE]; /**< QName (wire format) */
+    };
+
+    static const uint32_t VERSION = 1;           /**< Version of the format */
+    static const unsigned long HEADER_SIZE = 4096; /**< Space reserved for the header */
+
+    /*! Constructor
+     */
+    CQueryLog();
+
+    /*! Destructor
+     */
+    ~CQueryLog();
+
+    /*! Opens the ring file with room for the given number of records.
+     *  It returns true if there is an error
+     */
+    bool open(const char *file, unsigned long records);
+
+    /*! Stores a new record. Any worker can call it at the same time.
+     *  The client can be an ipv4 or ipv6 address, ipv4 clients of an
+     *  ipv6 socket (mapped addresses) are stored as ipv4 ones.
+     */
+    void add(uint64_t timestamp, uint32_t latency, const struct sockaddr *client,
+             const unsigned char *qname, unsigned int qnameLength, unsigned int qtype,
+             unsigned int rcode, unsigned int queryLength, unsigned int responseLength);
+
+private:
+    int m_Fd;                  /**< File descriptor of the ring file */
+    unsigned char *m_Map;      /**< Memory where the file is mapped */
+    unsigned long m_MapSize;   /**< Size of the mapping */
+    TFileHeader *m_Header;     /**< Header inside the mapping */
+    TRecord *m_Records;        /**< Records inside the mapping */
+};
+
+#endif
@@ -24,6 +24,10 @@
 *  Currently only one question section is considered but
 *  the data structure is prepared for future improvements.
 *
+*  The QName is not copied: CQuestion keeps a pointer to it inside
+*  the buffer of the message received, which must stay alive while
+*  the query is being processed.
+*
 *  \version 0.1
 *  \date    11-September-2006
 *  \author  Cristina Camacho Romaguera
@@ -39,9 +43,10 @@
 /*! Constructor
  */
 CQuestion::CQuestion()
-        : m_QName(),
-          m_QType(),
-          m_QClass() {
+        : m_QName(NULL),
+          m_QNameLength(0),
+          m_QType(0),
+          m_QClass(0) {
 }
 
 /*! Destructor
@@ -49,52 +54,68 @@ CQuestion::CQuestion()
 CQuestion::~CQuestion() {
 }
 
-void CQuestion::setQName(string &buffer) {
-    m_QName.erase(0, m_QName.size());
+/*! Clears all the fields to process a new query
+ */
+void CQuestion::reset() {
+    m_QName = NULL;
+    m_QNameLength = 0;
+    m_QType = 0;
+    m_QClass = 0;
+}
+
+/*! Keeps the QName (wire format, ending with the 0 label)
+ *  found inside the message received
+ */
+void CQuestion::setQName(const unsigned char *buffer, unsigned int length) {
     m_QName = buffer;
+    m_QNameLength = length;
 }
 
-string &CQuestion::getQName() {
+const unsigned char *CQuestion::getQName() {
     return m_QName;
 }
 
-bool CQuestion::setQType(string &qType) {
-    char value;
+unsigned int CQuestion::getQNameLength() {
+    return m_QNameLength;
+}
+
+bool CQuestion::setQType(unsigned int qType) {
     bool error = false;
 
     m_QType = qType;
 
-    value = (qType[0] << 8) + qType[1];
-    // Check that the value is correct
-    switch ((CResourceRecord::TQType) value) {
-        case (CResourceRecord::A):
-        case (CResourceRecord::ALL):
-            // Accepted
-            break;
-        default:
+    // Check that the value is correct. Any type of record
+    // can be asked for, the zone transfers are not supported
+    switch ((CResourceRecord::TQType) qType) {
+        case (CResourceRecord::IXFR):
+        case (CResourceRecord::AXFR):
+        case (CResourceRecord::MAILB):
+        case (CResourceRecord::MAILA):
             // Not implemented
             error = true;
             break;
+        default:
+            // Accepted
+            break;
     }
     return error;
 }
 
-string &CQuestion::getQType() {
+unsigned int CQuestion::getQType() {
     return m_QType;
 }
 
-bool CQuestion::setQClass(string &qClass) {
-    unsigned int value;
+bool CQuestion::setQClass(unsigned int qClass) {
     bool error = false;
 
     m_QClass = qClass;
 
-    value = (unsigned int) ((qClass[0] << 8) + qClass[1]);
     // Check that the value is correct, IN & ANY accepted
-    error = ((CResourceRecord::TQClass) value == CResourceRecord::CH);
+    error = ((CResourceRecord::TQClass) qClass != CResourceRecord::IN &&
+             (CResourceRecord::TQClass) qClass != CResourceRecord::ANY);
     return error;
 }
 
-string &CQuestion::getQClass() {
+unsigned int CQuestion::getQClass() {
     return m_QClass;
 }
@@ -24,6 +24,10 @@
 *  Currently only one question section is considered but
 *  the data structure is prepared for future improvements.
 *
+*  The QName is not copied: CQuestion keeps a pointer to it inside
+*  the buffer of the message received, which must stay alive while
+*  the query is being processed.
+*
 *  \version 0.1
 *  \date    11-September-2006
 *  \author  Cristina Camacho Romaguera
@@ -56,22 +60,32 @@ public:
      */
     ~CQuestion();
 
-    void setQName(string &buffer);
+    /*! Clears all the fields to process a new query
+     */
+    void reset();
+
+    /*! Keeps the QName (wire format, ending with the 0 label)
+     *  found inside the message received
+     */
+    void setQName(const unsigned char *buffer, unsigned int length);
+
+    const unsigned char *getQName();
 
-    string &getQName();
+    unsigned int getQNameLength();
 
-    bool setQType(string &qType);
+    bool setQType(unsigned int qType);
 
-    string &getQType();
+    unsigned int getQType();
 
-    bool setQClass(string &qClass);
+    bool setQClass(unsigned int qClass);
 
-    string &getQClass();
+    unsigned int getQClass();
 
 private:
-    string m_QName;  /**< defines QName field */
-    string m_QType;  /**< defines QType field */
-    string m_QClass; /**< defines QClass field */
+    const unsigned char *m_QName;  /**< defines QName field, points to the message received */
+    unsigned int m_QNameLength;    /**< length of QName field, including the 0 label */
+    unsigned int m_QType;          /**< defines QType field */
+    unsigned int m_QClass;         /**< defines QClass field */
 };
 
 #endif
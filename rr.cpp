@@ -29,6 +29,14 @@
 *
 *  (Ref: RFC 1035). And all this information is handled here.
 *
+*  The fields are kept as numbers and the NAME is not copied (it points
+*  to the QName of the message received). The record is only converted
+*  to wire format when it is written inside the response buffer.
+*
+*  The names of a response can be compressed (RFC 1035, 4.1.4): a name,
+*  or the end of it, that is already inside the message is replaced by
+*  a pointer to it (2 bytes), see CNameCompressor.
+*
 *  \version 0.1
 *  \date    11-September-2006
 *  \author  Cristina Camacho Romaguera
@@ -39,13 +47,17 @@
 #include "rr.h"
 #include <iostream>
 
+#include <cstring>
+#include <cctype>
+
 // constructor
 CResourceRecord::CResourceRecord()
-        : m_Name(),
-          m_Type(),
-          m_Class(),
-          m_TTL(),
-          m_RdLength(),
+        : m_Name(NULL),
+          m_NameLength(0),
+          m_Type(0),
+          m_Class(0),
+          m_TTL(0),
+          m_RdLength(0),
           m_RData() {
 }
 
@@ -53,62 +65,172 @@ CResourceRecord::CResourceRecord()
 CResourceRecord::~CResourceRecord() {
 }
 
-void CResourceRecord::setName(string &buffer) {
+void CResourceRecord::reset() {
+    m_Name = NULL;
+    m_NameLength = 0;
+    m_Type = 0;
+    m_Class = 0;
+    m_TTL = 0;
+    m_RdLength = 0;
+}
+
+void CResourceRecord::setName(const unsigned char *buffer, unsigned int length) {
     // variable size
-    m_Name.erase(0, m_Name.size());
     m_Name = buffer;
+    m_NameLength = length;
 }
 
-string &CResourceRecord::getName() {
+const unsigned char *CResourceRecord::getName() {
     return m_Name;
 }
 
-void CResourceRecord::setType(string &rType) {
+unsigned int CResourceRecord::getNameLength() {
+    return m_NameLength;
+}
+
+void CResourceRecord::setType(unsigned int rType) {
     // fixed size (2 bytes)
     m_Type = rType;
 }
 
-string &CResourceRecord::getType() {
+unsigned int CResourceRecord::getType() {
     return m_Type;
 }
 
-void CResourceRecord::setClass(string &rClass) {
+void CResourceRecord::setClass(unsigned int rClass) {
     // fixed size (2 bytes)
     m_Class = rClass;
 }
 
-string &CResourceRecord::getClass() {
+unsigned int CResourceRecord::getClass() {
     return m_Class;
 }
 
 void CResourceRecord::setTTL(unsigned int ttl) {
     // fixed size (4 bytes)
-    m_TTL = (ttl >> 24) & 0xff;
-    m_TTL += (ttl >> 16) & 0xff;
-    m_TTL += (ttl >> 8) & 0xff;
-    m_TTL += ttl & 0xff;
+    m_TTL = ttl;
 }
 
-string &CResourceRecord::getTTL() {
+unsigned int CResourceRecord::getTTL() {
     return m_TTL;
 }
 
 void CResourceRecord::setRdLength(unsigned int rdLength) {
     // fixed size (2 bytes)
-    m_RdLength = (rdLength >> 8) & 0xff;
-    m_RdLength += rdLength & 0xff;
+    m_RdLength = rdLength;
 }
 
-string &CResourceRecord::getRdLength() {
+unsigned int CResourceRecord::getRdLength() {
     return m_RdLength;
 }
 
-void CResourceRecord::setRData(string &rData) {
-    //  m_RData.erase(0, m_RData.size());
-    // fixed size (4 bytes)
-    m_RData = rData;
+void CResourceRecord::setRData(const unsigned char *rData, unsigned int length) {
+    // variable size (4 bytes for an address)
+    if (length > MAX_RDATA_SIZE) length = MAX_RDATA_SIZE;
+    memcpy(m_RData, rData, length);
 }
 
-string &CResourceRecord::getRData() {
+const unsigned char *CResourceRecord::getRData() {
     return m_RData;
 }
+
+/*! Writes the resource record in wire format inside the buffer.
+ *  It returns the number of bytes written or 0 if it does not fit.
+ */
+unsigned int CResourceRecord::write(unsigned char *buffer, unsigned int size) {
+    unsigned int length = m_NameLength + 10 + m_RdLength;
+
+    if (length > size || m_RdLength > MAX_RDATA_SIZE) return 0;
+
+    memcpy(buffer, m_Name, m_NameLength);
+    buffer += m_NameLength;
+    buffer[0] = (unsigned char) ((m_Type >> 8) & 0xff);
+    buffer[1] = (unsigned char) (m_Type & 0xff);
+    buffer[2] = (unsigned char) ((m_Class >> 8) & 0xff);
+    buffer[3] = (unsigned char) (m_Class & 0xff);
+    buffer[4] = (unsigned char) ((m_TTL >> 24) & 0xff);
+    buffer[5] = (unsigned char) ((m_TTL >> 16) & 0xff);
+    buffer[6] = (unsigned char) ((m_TTL >> 8) & 0xff);
+    buffer[7] = (unsigned char) (m_TTL & 0xff);
+    buffer[8] = (unsigned char) ((m_RdLength >> 8) & 0xff);
+    buffer[9] = (unsigned char) (m_RdLength & 0xff);
+    memcpy(buffer + 10, m_RData, m_RdLength);
+
+    return length;
+}
+
+/*! Constructor. The message starts at the given buffer
+ */
+CNameCompressor::CNameCompressor(unsigned char *message)
+        : m_Message(message),
+          m_Count(0) {
+}
+
+/*! Remembers a name (wire format) already written
+ *  inside the message at the given offset
+ */
+void CNameCompressor::add(unsigned int offset) {
+    // every label starts a suffix, until the root
+    // or a pointer to another name already known
+    while (m_Message[offset] != 0 && (m_Message[offset] & POINTER) != POINTER) {
+        if (offset > MAX_OFFSET || m_Count == MAX_SUFFIXES) return;
+        m_Suffixes[m_Count++] = offset;
+        offset += m_Message[offset] + 1;
+    }
+}
+
+/*! Writes a name (wire format, uncompressed) inside the message
+ *  at the given offset, compressed against the names already
+ *  written. It returns the number of bytes written or 0 if it
+ *  does not fit in size bytes
+ */
+unsigned int CNameCompressor::write(unsigned int offset, unsigned int size, const unsigned char *name) {
+    unsigned char *buffer = m_Message + offset;
+    unsigned int index = 0;
+
+    // the longest suffix already written is the first one found
+    while (name[index] != 0) {
+        for (unsigned int i = 0; i < m_Count; i++) {
+            if (matches(m_Suffixes[i], name + index)) {
+                if (index + 2 > size) return 0;
+                memcpy(buffer, name, index);
+                buffer[index] = (unsigned char) (POINTER | (m_Suffixes[i] >> 8));
+                buffer[index + 1] = (unsigned char) (m_Suffixes[i] & 0xff);
+                add(offset);
+                return index + 2;
+            }
+        }
+        index += name[index] + 1;
+    }
+
+    // not found, the whole name is written
+    if (index + 1 > size) return 0;
+    memcpy(buffer, name, index + 1);
+    add(offset);
+    return index + 1;
+}
+
+/*! Compares the name inside the message at offset with the
+ *  given one (wire format, uncompressed), without case
+ */
+bool CNameCompressor::matches(unsigned int offset, const unsigned char *name) {
+    // the pointers of a message always go backwards, but
+    // the number of jumps is limited anyway
+    for (unsigned int jumps = 0; jumps < MAX_SUFFIXES; ) {
+        unsigned int length = m_Message[offset];
+
+        if ((length & POINTER) == POINTER) {
+            offset = ((length & ~POINTER) << 8) | m_Message[offset + 1];
+            jumps++;
+            continue;
+        }
+        if (length != *name) return false;
+        if (length == 0) return true;
+        for (unsigned int i = 1; i <= length; i++) {
+            if (tolower(m_Message[offset + i]) != tolower(name[i])) return false;
+        }
+        offset += length + 1;
+        name += length + 1;
+    }
+    return false;
+}
@@ -29,6 +29,14 @@
 *
 *  (Ref: RFC 1035). And all this information is handled here.
 *
+*  The fields are kept as numbers and the NAME is not copied (it points
+*  to the QName of the message received). The record is only converted
+*  to wire format when it is written inside the response buffer.
+*
+*  The names of a response can be compressed (RFC 1035, 4.1.4): a name,
+*  or the end of it, that is already inside the message is replaced by
+*  a pointer to it (2 bytes), see CNameCompressor.
+*
 *  \version 0.1
 *  \date    11-September-2006
 *  \author  Cristina Camacho Romaguera
@@ -58,37 +66,48 @@ public:
     // destructor
     ~CResourceRecord();
 
-    void setName(string &buffer);
+    void reset();
+
+    void setName(const unsigned char *buffer, unsigned int length);
 
-    string &getName();
+    const unsigned char *getName();
 
-    void setType(string &rType);
+    unsigned int getNameLength();
 
-    string &getType();
+    void setType(unsigned int rType);
 
-    void setClass(string &rClass);
+    unsigned int getType();
 
-    string &getClass();
+    void setClass(unsigned int rClass);
+
+    unsigned int getClass();
 
     void setTTL(unsigned int ttl);
 
-    string &getTTL();
+    unsigned int getTTL();
 
     void setRdLength(unsigned int rdLength);
 
-    string &getRdLength();
+    unsigned int getRdLength();
+
+    void setRData(const unsigned char *rData, unsigned int length);
 
-    void setRData(string &rData);
+    const unsigned char *getRData();
 
-    string &getRData();
+    /*! Writes the resource record in wire format inside the buffer.
+     *  It returns the number of bytes written or 0 if it does not fit.
+     */
+    unsigned int write(unsigned char *buffer, unsigned int size);
 
     /* I will only create the superset QType and QClass and I will use it
        also for Type and Class resource record fields, as I am controlling
        the response it shouldn't be any incompatibility.
     */
     /* These types are defined in RFC 1035 */
-    /* This program does not support ipv6, which is defined in RFC 3596:
+    /* AAAA (ipv6 addresses) is defined in RFC 3596:
      * https://www.ietf.org/rfc/rfc3596.txt */
+    /* OPT (EDNS0) is defined in RFC 6891:
+     * https://www.ietf.org/rfc/rfc6891.txt */
     enum TQType {
         A = 1,   /**< a host address */
         NS = 2,
@@ -106,6 +125,9 @@ public:
         MINFO = 14,
         MX = 15,
         TXT = 16,
+        AAAA = 28,  /**< a host ipv6 address (RFC 3596) */
+        OPT = 41,   /**< EDNS0 pseudo record (RFC 6891) */
+        IXFR = 251,
         AXFR = 252,
         MAILB = 253,
         MAILA = 254,
@@ -118,13 +140,63 @@ public:
         ANY = 255    /**< any class */
     };
 
+    static const unsigned int MAX_NAME_SIZE = 255;  /**< Max size of a domain name (RFC 1035) */
+    static const unsigned int MAX_RDATA_SIZE = 2 * 255 + 20; /**< Biggest record supported: SOA (two names
+                                                                  and five 32-bit fields) */
+
+private:
+    const unsigned char *m_Name;            /**< defines Name field (wire format) */
+    unsigned int m_NameLength;              /**< length of Name field */
+    unsigned int m_Type;                    /**< defines Type field */
+    unsigned int m_Class;                   /**< defines Class field */
+    unsigned int m_TTL;                     /**< defines TTL field */
+    unsigned int m_RdLength;                /**< defines RdLength field */
+    unsigned char m_RData[MAX_RDATA_SIZE];  /**< defines RData field */
+};
+
+/*! \class CNameCompressor
+ *  \brief It writes compressed names inside a message
+ *
+ *   CNameCompressor keeps the offsets of the names already written
+ *   inside the message (every one of their labels is the beginning of
+ *   a suffix). A new name is written up to the first suffix found among
+ *   them, followed by a pointer to it. The names are compared without
+ *   case, following the pointers inside the message.
+ *
+ */
+class CNameCompressor {
+public:
+
+    /*! Constructor. The message starts at the given buffer
+     */
+    CNameCompressor(unsigned char *message);
+
+    /*! Remembers a name (wire format) already written
+     *  inside the message at the given offset
+     */
+    void add(unsigned int offset);
+
+    /*! Writes a name (wire format, uncompressed) inside the message
+     *  at the given offset, compressed against the names already
+     *  written. It returns the number of bytes written or 0 if it
+     *  does not fit in size bytes
+     */
+    unsigned int write(unsigned int offset, unsigned int size, const unsigned char *name);
+
+    static const unsigned int POINTER = 0xc0;       /**< Upper bits of a pointer */
+    static const unsigned int MAX_OFFSET = 0x3fff;  /**< Max offset of a pointer (14 bits) */
+
 private:
-    string m_Name;     /**< defines Name field */
-    string m_Type;     /**< defines Type field */
-    string m_Class;    /**< defines Class field */
-    string m_TTL;      /**< defines TTL field */
-    string m_RdLength; /**< defines RdLength field */
-    string m_RData;    /**< defines RData field */
+    /*! Compares the name inside the message at offset with the
+     *  given one (wire format, uncompressed), without case
+     */
+    bool matches(unsigned int offset, const unsigned char *name);
+
+    static const unsigned int MAX_SUFFIXES = 64;    /**< Suffixes remembered per message */
+
+    unsigned char *m_Message;               /**< Beginning of the message */
+    unsigned int m_Suffixes[MAX_SUFFIXES];  /**< Offsets of the suffixes already written */
+    unsigned int m_Count;                   /**< Number of suffixes */
 };
 
 #endif
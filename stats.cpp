@@ -0,0 +1,141 @@
+/*!
+*****************************************************************************
+*  \file stats.cpp
+*
+*  \brief   Counters and latencies of a dns worker
+*
+*  Only the worker writes its counters, so they are never shared and no
+*  locked instruction is needed. They are atomic, so other threads can
+*  add them together while the worker counts.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#include "stats.h"
+
+#include <ctime>
+
+/*! Constructor
+ */
+CStats::CStats()
+        : m_Messages(0),
+          m_ParseErrors(0),
+          m_Drops(0) {
+    for (unsigned int i = 0; i <= OTHER_QTYPE; i++) {
+        m_Queries[i].store(0, memory_order_relaxed);
+    }
+    for (unsigned int i = 0; i < RCODES; i++) {
+        m_Responses[i].store(0, memory_order_relaxed);
+    }
+}
+
+/*! Counts a message received
+ */
+void CStats::countMessage() {
+    add(m_Messages, 1);
+}
+
+/*! Counts a query whose question has been parsed
+ */
+void CStats::countQuery(unsigned int qtype) {
+    add(m_Queries[qtype > MAX_QTYPE ? OTHER_QTYPE : qtype], 1);
+}
+
+/*! Counts a response, by its response code (with the
+ *  upper bits of EDNS0, RFC 6891)
+ */
+void CStats::countResponse(unsigned int rcode) {
+    add(m_Responses[rcode < RCODES ? rcode : RCODES - 1], 1);
+}
+
+/*! Counts a message whose header or question is wrong
+ */
+void CStats::countParseError() {
+    add(m_ParseErrors, 1);
+}
+
+/*! Counts a message dropped without a response
+ */
+void CStats::countDrop() {
+    add(m_Drops, 1);
+}
+
+/*! Counts the time (ns) of a stage
+ */
+void CStats::recordLatency(TStage stage, uint64_t ns) {
+    m_Latency[stage].record(ns);
+}
+
+/*! Adds the counters of another worker
+ */
+void CStats::add(const CStats &other) {
+    add(m_Messages, other.getMessages());
+    for (unsigned int i = 0; i <= OTHER_QTYPE; i++) {
+        add(m_Queries[i], other.getQueries(i));
+    }
+    for (unsigned int i = 0; i < RCODES; i++) {
+        add(m_Responses[i], other.getResponses(i));
+    }
+    add(m_ParseErrors, other.getParseErrors());
+    add(m_Drops, other.getDrops());
+    for (unsigned int i = 0; i < STAGES; i++) {
+        m_Latency[i].add(other.m_Latency[i]);
+    }
+}
+
+/*! Returns the number of messages received
+ */
+uint64_t CStats::getMessages() const {
+    return m_Messages.load(memory_order_relaxed);
+}
+
+/*! Returns the number of queries of a type, types
+ *  above MAX_QTYPE are counted together in OTHER_QTYPE
+ */
+uint64_t CStats::getQueries(unsigned int qtype) const {
+    return m_Queries[qtype > MAX_QTYPE ? OTHER_QTYPE : qtype].load(memory_order_relaxed);
+}
+
+/*! Returns the number of responses with a code, codes
+ *  of RCODES or above are counted in the last one
+ */
+uint64_t CStats::getResponses(unsigned int rcode) const {
+    return m_Responses[rcode < RCODES ? rcode : RCODES - 1].load(memory_order_relaxed);
+}
+
+/*! Returns the number of parse errors
+ */
+uint64_t CStats::getParseErrors() const {
+    return m_ParseErrors.load(memory_order_relaxed);
+}
+
+/*! Returns the number of messages dropped
+ */
+uint64_t CStats::getDrops() const {
+    return m_Drops.load(memory_order_relaxed);
+}
+
+/*! Returns the latencies of a stage
+ */
+const CHistogram &CStats::getLatency(TStage stage) const {
+    return m_Latency[stage];
+}
+
+/*! Current time in ns (monotonic)
+ */
+uint64_t CStats::now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/*! Adds to a counter with only one writer, without a locked instruction
+ */
+void CStats::add(atomic<uint64_t> &counter, uint64_t value) {
+    counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
@@ -0,0 +1,133 @@
+/*!
+*****************************************************************************
+*  \file stats.h
+*
+*  \brief   Counters and latencies of a dns worker
+*
+*  Every worker (CDns) has its own counters: messages received, queries
+*  by type, responses by code, parse errors and messages dropped without
+*  a response, and a latency histogram (see CHistogram) per stage of the
+*  processing: parse, lookup, build and the whole of it, from the
+*  reception until the response is ready to send.
+*
+*  Only the worker writes its counters, so they are never shared and no
+*  locked instruction is needed. They are atomic, so other threads can
+*  add them together while the worker counts (see CMetricsServer).
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include "histogram.h"
+
+#include <atomic>
+#include <stdint.h>
+
+/*! \class CStats
+ *  \brief It counts the messages of a worker
+ *
+ *   CStats keeps the counters of one worker. The counters of several
+ *   workers are read by adding them to another CStats object.
+ *
+ */
+using namespace std;
+
+class CStats {
+public:
+    /*! Stages of the processing of a message
+     */
+    enum TStage {
+        PARSE,    /**< header, question and OPT record */
+        LOOKUP,   /**< database */
+        BUILD,    /**< response, until it is ready to send */
+        TOTAL,    /**< from the reception until the response is ready */
+        STAGES
+    };
+
+    /*! Constructor
+     */
+    CStats();
+
+    /*! Counts a message received
+     */
+    void countMessage();
+
+    /*! Counts a query whose question has been parsed
+     */
+    void countQuery(unsigned int qtype);
+
+    /*! Counts a response, by its response code (with the
+     *  upper bits of EDNS0, RFC 6891)
+     */
+    void countResponse(unsigned int rcode);
+
+    /*! Counts a message whose header or question is wrong
+     */
+    void countParseError();
+
+    /*! Counts a message dropped without a response
+     */
+    void countDrop();
+
+    /*! Counts the time (ns) of a stage
+     */
+    void recordLatency(TStage stage, uint64_t ns);
+
+    /*! Adds the counters of another worker
+     */
+    void add(const CStats &other);
+
+    /*! Returns the number of messages received
+     */
+    uint64_t getMessages() const;
+
+    /*! Returns the number of queries of a type, types
+     *  above MAX_QTYPE are counted together in OTHER_QTYPE
+     */
+    uint64_t getQueries(unsigned int qtype) const;
+
+    /*! Returns the number of responses with a code, codes
+     *  of RCODES or above are counted in the last one
+     */
+    uint64_t getResponses(unsigned int rcode) const;
+
+    /*! Returns the number of parse errors
+     */
+    uint64_t getParseErrors() const;
+
+    /*! Returns the number of messages dropped
+     */
+    uint64_t getDrops() const;
+
+    /*! Returns the latencies of a stage
+     */
+    const CHistogram &getLatency(TStage stage) const;
+
+    /*! Current time in ns (monotonic)
+     */
+    static uint64_t now();
+
+    static const unsigned int MAX_QTYPE = 255;      /**< Last type with a counter of its own */
+    static const unsigned int OTHER_QTYPE = MAX_QTYPE + 1; /**< Counter of the bigger types */
+    static const unsigned int RCODES = 32;          /**< Response codes with a counter */
+
+private:
+    /*! Adds to a counter with only one writer, without a locked instruction
+     */
+    static void add(atomic<uint64_t> &counter, uint64_t value);
+
+    atomic<uint64_t> m_Messages;                /**< Messages received */
+    atomic<uint64_t> m_Queries[OTHER_QTYPE + 1]; /**< Queries by type */
+    atomic<uint64_t> m_Responses[RCODES];       /**< Responses by code */
+    atomic<uint64_t> m_ParseErrors;             /**< Messages with a wrong header or question */
+    atomic<uint64_t> m_Drops;                   /**< Messages without response */
+    CHistogram m_Latency[STAGES];               /**< Latencies by stage (ns) */
+};
+
+#endif
@@ -0,0 +1,558 @@
+/*!
+*****************************************************************************
+*  \file tcpServer.cpp
+*
+*  \brief   Dns server over TCP (RFC 7766)
+*
+*  Every message over TCP is preceded by its length (2 bytes in network
+*  order). A client can send several queries without waiting for the
+*  responses (pipelining) and keep the connection open to reuse it.
+*
+*  All the connections are handled by one thread with a non-blocking
+*  epoll loop. The messages of a connection are processed as soon as
+*  they are complete and the responses are queued in the connection,
+*  they are sent when the socket can take them. A client that does not
+*  read its responses only stops its own connection: it is not read
+*  again until the responses queued are sent.
+*
+*  The connections are kept in a list ordered by their last activity,
+*  so the idle ones are always at the beginning.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#include "tcpServer.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+
+using namespace std;
+
+/*! Constructor. The database is shared with the UDP workers
+ */
+CTcpServer::CTcpServer(char *outFile, CDnsDbManager &dnsDb, unsigned int maxConnections,
+                       unsigned int idleTimeout)
+        : m_Dns(outFile, dnsDb, 1),
+          m_Listen(-1),
+          m_Epoll(-1),
+          m_MaxConnections(maxConnections > 0 ? maxConnections : 1),
+          m_IdleTimeout(idleTimeout > 0 ? idleTimeout : 1),
+          m_Connections(0),
+          m_Oldest(NULL),
+          m_Newest(NULL),
+          m_Buffer(CDns::MAX_STREAM_SIZE),
+          m_NextId(1),
+          m_Ids(),
+          m_Event(-1),
+          m_Delivered(),
+          m_Taken() {
+    pthread_mutex_init(&m_Lock, NULL);
+    m_Dns.setTcpServer(this);
+}
+
+/*! Destructor
+ */
+CTcpServer::~CTcpServer() {
+    while (m_Oldest != NULL) {
+        TConnection *connection = m_Oldest;
+
+        closeConnection(connection);
+        delete connection;
+    }
+    if (m_Listen >= 0) close(m_Listen);
+    if (m_Epoll >= 0) close(m_Epoll);
+    if (m_Event >= 0) close(m_Event);
+    pthread_mutex_destroy(&m_Lock);
+}
+
+/*! Starts listening on the given port (CDns::DNS_PORT usually). The
+ *  socket is dual stack (ipv6 and ipv4 mapped addresses) unless the
+ *  system has no ipv6.
+ */
+void CTcpServer::openCommunication(unsigned short port) {
+    struct sockaddr_in6 server;
+    socklen_t length = sizeof(struct sockaddr_in6);
+    int off = 0;
+    int on = 1;
+
+    m_Listen = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (m_Listen >= 0 && setsockopt(m_Listen, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) < 0) {
+        close(m_Listen);
+        m_Listen = -1;
+    }
+    if (m_Listen < 0) {
+        // no ipv6 support
+        m_Listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        length = sizeof(struct sockaddr_in);
+    }
+    if (m_Listen < 0) {
+        cerr << "Error opening TCP socket" << endl;
+        exit(0);
+    }
+    setsockopt(m_Listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&server, 0, sizeof(server));
+    if (length == sizeof(struct sockaddr_in6)) {
+        server.sin6_family = AF_INET6;
+        server.sin6_addr = in6addr_any;
+        server.sin6_port = htons(port);
+    } else {
+        struct sockaddr_in *server4 = (struct sockaddr_in *) &server;
+        server4->sin_family = AF_INET;
+        server4->sin_addr.s_addr = htonl(INADDR_ANY);
+        server4->sin_port = htons(port);
+    }
+
+    if (::bind(m_Listen, (struct sockaddr *) &server, length) < 0) {
+        cerr << "Error binding TCP socket" << endl;
+        exit(0);
+    }
+    if (listen(m_Listen, SOMAXCONN) < 0) {
+        cerr << "Error listening on TCP socket" << endl;
+        exit(0);
+    }
+
+    m_Epoll = epoll_create1(0);
+    if (m_Epoll < 0) {
+        cerr << "Error creating epoll descriptor" << endl;
+        exit(0);
+    }
+
+    // the listening socket is the only one without connection
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Listen, &event) < 0) {
+        cerr << "Error adding TCP socket to epoll" << endl;
+        exit(0);
+    }
+
+    // the responses of the forwarder, marked by the eventfd itself
+    m_Event = eventfd(0, EFD_NONBLOCK);
+    if (m_Event < 0) {
+        cerr << "Error creating TCP eventfd" << endl;
+        exit(0);
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = &m_Event;
+    if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Event, &event) < 0) {
+        cerr << "Error adding TCP eventfd to epoll" << endl;
+        exit(0);
+    }
+}
+
+/*! Every query is stored in the binary query log, shared
+ *  with other workers. It can be NULL
+ */
+void CTcpServer::setQueryLog(CQueryLog *queryLog) {
+    m_Dns.setQueryLog(queryLog);
+}
+
+/*! The addresses of every answer are rotated (round robin)
+ */
+void CTcpServer::setRotation(bool rotate) {
+    m_Dns.setRotation(rotate);
+}
+
+/*! Returns the counters of the TCP messages
+ */
+CStats &CTcpServer::getStats() {
+    return m_Dns.getStats();
+}
+
+/*! The time of every stage is measured too, see CDns
+ */
+void CTcpServer::setTiming(bool timing) {
+    m_Dns.setTiming(timing);
+}
+
+/*! Waits until the log records queued so far are written.
+ *  Any thread can call it
+ */
+void CTcpServer::flushLog() {
+    m_Dns.flushLog();
+}
+
+/*! The names not found in the database are answered from the
+ *  cache or forwarded to the upstream servers
+ */
+void CTcpServer::setForwarding(CForwarder *forwarder, CCache *cache) {
+    m_Dns.setForwarding(forwarder, cache);
+}
+
+/*! Queues the response of a forwarded query for its connection
+ *  (length 0 if there is none). It can be called from any thread
+ */
+void CTcpServer::deliver(uint64_t connection, const unsigned char *response, unsigned long length) {
+    unsigned char prefix[10];
+    bool wake;
+
+    // identifier of the connection and length of the response
+    for (unsigned int i = 0; i < 8; i++) {
+        prefix[i] = (unsigned char) (connection >> (56 - 8 * i));
+    }
+    prefix[8] = (unsigned char) (length >> 8);
+    prefix[9] = (unsigned char) length;
+
+    pthread_mutex_lock(&m_Lock);
+    wake = m_Delivered.empty();
+    m_Delivered.insert(m_Delivered.end(), prefix, prefix + sizeof(prefix));
+    m_Delivered.insert(m_Delivered.end(), response, response + length);
+    pthread_mutex_unlock(&m_Lock);
+
+    if (wake) {
+        uint64_t one = 1;
+        if (write(m_Event, &one, sizeof(one)) < 0) {
+            // the counter is already at its max, it will be read
+        }
+    }
+}
+
+/*! Serves connections forever
+ */
+void CTcpServer::run() {
+    static const int MAX_EVENTS = 64;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        // wakes up at least once per second to close the idle connections
+        int n = epoll_wait(m_Epoll, events, MAX_EVENTS, 1000);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            cerr << "Error waiting on epoll descriptor" << endl;
+            exit(0);
+        }
+
+        bool delivered = false;
+        for (int i = 0; i < n; i++) {
+            TConnection *connection = (TConnection *) events[i].data.ptr;
+
+            if (connection == NULL) {
+                acceptConnections();
+                continue;
+            }
+            if (events[i].data.ptr == &m_Event) {
+                // after the other events, it can close any connection
+                delivered = true;
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                closeConnection(connection);
+            } else {
+                if (events[i].events & EPOLLOUT) writeConnection(connection);
+                if (connection->m_Fd >= 0 && (events[i].events & EPOLLIN)) readConnection(connection);
+            }
+            // the connection has been closed
+            if (connection->m_Fd < 0) delete connection;
+        }
+        if (delivered) takeDeliveries();
+        expireConnections();
+    }
+}
+
+/*! Accepts all the connections waiting
+ */
+void CTcpServer::acceptConnections() {
+    while (1) {
+        struct sockaddr_in6 client;
+        socklen_t length = sizeof(client);
+
+        memset(&client, 0, sizeof(client));
+        int fd = accept4(m_Listen, (struct sockaddr *) &client, &length, SOCK_NONBLOCK);
+        if (fd < 0) {
+            // EAGAIN: no more connections waiting. Any other error
+            // belongs to that connection, not to the listener
+            return;
+        }
+
+        // too many connections, the new one is closed at once
+        if (m_Connections >= m_MaxConnections) {
+            close(fd);
+            continue;
+        }
+
+        // the responses are already sent in as few calls as possible,
+        // they must not wait for the acknowledgement of the previous ones
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        TConnection *connection = new TConnection();
+        connection->m_Fd = fd;
+        connection->m_Id = m_NextId++;
+        connection->m_ClientAddr = client;
+        connection->m_Sent = 0;
+        connection->m_Closing = false;
+        connection->m_Waiting = 0;
+        connection->m_Events = EPOLLIN;
+        connection->m_LastActivity = now();
+        connection->m_Prev = NULL;
+        connection->m_Next = NULL;
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = connection;
+        if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            delete connection;
+            continue;
+        }
+
+        // the newest one is the most recently active
+        connection->m_Prev = m_Newest;
+        if (m_Newest != NULL) {
+            m_Newest->m_Next = connection;
+        } else {
+            m_Oldest = connection;
+        }
+        m_Newest = connection;
+        m_Connections++;
+        m_Ids[connection->m_Id] = connection;
+    }
+}
+
+/*! Reads from a connection and processes all the complete messages.
+ *  If the connection is closed, its descriptor is set to -1 and the
+ *  caller frees it
+ */
+void CTcpServer::readConnection(TConnection *connection) {
+    unsigned char buffer[READ_SIZE];
+
+    // reads until there is nothing else, or until too many
+    // responses are waiting for the client to read them
+    while (!connection->m_Closing && connection->m_Output.size() - connection->m_Sent < MAX_PENDING) {
+        ssize_t n = recv(connection->m_Fd, buffer, sizeof(buffer), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            closeConnection(connection);
+            return;
+        }
+        if (n == 0) {
+            // the client does not send more queries, the
+            // connection is closed once the responses are sent
+            connection->m_Closing = true;
+            break;
+        }
+        connection->m_Input.insert(connection->m_Input.end(), buffer, buffer + n);
+        touch(connection);
+        processMessages(connection);
+        if (connection->m_Fd < 0) return;
+    }
+
+    writeConnection(connection);
+}
+
+/*! Processes the complete messages received by a connection
+ */
+void CTcpServer::processMessages(TConnection *connection) {
+    vector<unsigned char> &input = connection->m_Input;
+    unsigned long offset = 0;
+
+    while (input.size() - offset >= 2) {
+        unsigned long length = (input[offset] << 8) | input[offset + 1];
+
+        // the queries are small, a longer message is not a dns query
+        if (length > CDns::MAX_MESSAGE_SIZE) {
+            m_Dns.getStats().countDrop();
+            closeConnection(connection);
+            return;
+        }
+        if (input.size() - offset - 2 < length) break;
+
+        // the response is built over the query
+        memcpy(&m_Buffer[0], &input[offset + 2], length);
+        offset += 2 + length;
+
+        unsigned long responseLength = m_Dns.processMessage(&m_Buffer[0], length, connection->m_ClientAddr,
+                                                            connection->m_Id);
+        if (responseLength == 0) {
+            // the response of a forwarded query comes later
+            if (m_Dns.isForwarded()) connection->m_Waiting++;
+            continue;
+        }
+        queueResponse(connection, &m_Buffer[0], responseLength);
+    }
+    input.erase(input.begin(), input.begin() + offset);
+}
+
+/*! Appends the responses delivered by the forwarder to their
+ *  connections
+ */
+void CTcpServer::takeDeliveries() {
+    unsigned long offset = 0;
+    uint64_t count;
+
+    if (read(m_Event, &count, sizeof(count)) < 0) {
+        // nothing delivered, it was already taken
+    }
+
+    pthread_mutex_lock(&m_Lock);
+    m_Taken.swap(m_Delivered);
+    pthread_mutex_unlock(&m_Lock);
+
+    while (offset < m_Taken.size()) {
+        uint64_t id = 0;
+        for (unsigned int i = 0; i < 8; i++) {
+            id = (id << 8) | m_Taken[offset + i];
+        }
+        unsigned long length = (m_Taken[offset + 8] << 8) | m_Taken[offset + 9];
+        const unsigned char *response = &m_Taken[offset + 10];
+        offset += 10 + length;
+
+        // the connection may have been closed meanwhile
+        unordered_map<uint64_t, TConnection *>::iterator it = m_Ids.find(id);
+        if (it == m_Ids.end()) continue;
+        TConnection *connection = it->second;
+
+        connection->m_Waiting--;
+        if (length > 0) queueResponse(connection, response, length);
+        writeConnection(connection);
+        if (connection->m_Fd < 0) delete connection;
+    }
+    m_Taken.clear();
+}
+
+/*! Appends a response to the output of a connection, with its length
+ */
+void CTcpServer::queueResponse(TConnection *connection, const unsigned char *response, unsigned long length) {
+    unsigned char prefix[2];
+
+    prefix[0] = (unsigned char) (length >> 8);
+    prefix[1] = (unsigned char) length;
+    connection->m_Output.insert(connection->m_Output.end(), prefix, prefix + 2);
+    connection->m_Output.insert(connection->m_Output.end(), response, response + length);
+}
+
+/*! Sends the responses queued of a connection. If the connection
+ *  is closed, its descriptor is set to -1 and the caller frees it
+ */
+void CTcpServer::writeConnection(TConnection *connection) {
+    vector<unsigned char> &output = connection->m_Output;
+
+    while (connection->m_Sent < output.size()) {
+        ssize_t n = send(connection->m_Fd, &output[connection->m_Sent], output.size() - connection->m_Sent,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            closeConnection(connection);
+            return;
+        }
+        connection->m_Sent += n;
+        touch(connection);
+    }
+
+    if (connection->m_Sent == output.size()) {
+        output.clear();
+        connection->m_Sent = 0;
+        if (connection->m_Closing && connection->m_Waiting == 0) {
+            closeConnection(connection);
+            return;
+        }
+    }
+    updateEvents(connection);
+}
+
+/*! Registers the events a connection is waiting for: it is
+ *  read while there is room for the responses, and written
+ *  while there are responses queued
+ */
+void CTcpServer::updateEvents(TConnection *connection) {
+    unsigned long pending = connection->m_Output.size() - connection->m_Sent;
+    unsigned int events = 0;
+
+    if (!connection->m_Closing && pending < MAX_PENDING) events |= EPOLLIN;
+    if (pending > 0) events |= EPOLLOUT;
+    if (events == connection->m_Events) return;
+
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = connection;
+    if (epoll_ctl(m_Epoll, EPOLL_CTL_MOD, connection->m_Fd, &event) < 0) {
+        closeConnection(connection);
+        return;
+    }
+    connection->m_Events = events;
+}
+
+/*! Closes a connection. Its descriptor is set to -1, the
+ *  caller frees it
+ */
+void CTcpServer::closeConnection(TConnection *connection) {
+    if (connection->m_Fd < 0) return;
+
+    // closing the descriptor also removes it from epoll
+    close(connection->m_Fd);
+    connection->m_Fd = -1;
+    m_Ids.erase(connection->m_Id);
+
+    if (connection->m_Prev != NULL) {
+        connection->m_Prev->m_Next = connection->m_Next;
+    } else {
+        m_Oldest = connection->m_Next;
+    }
+    if (connection->m_Next != NULL) {
+        connection->m_Next->m_Prev = connection->m_Prev;
+    } else {
+        m_Newest = connection->m_Prev;
+    }
+    connection->m_Prev = NULL;
+    connection->m_Next = NULL;
+    m_Connections--;
+}
+
+/*! Closes the connections without activity for too long
+ */
+void CTcpServer::expireConnections() {
+    time_t limit = now() - m_IdleTimeout;
+
+    while (m_Oldest != NULL && m_Oldest->m_LastActivity <= limit) {
+        TConnection *connection = m_Oldest;
+
+        closeConnection(connection);
+        delete connection;
+    }
+}
+
+/*! The connection has been active, it goes to the end of the list
+ */
+void CTcpServer::touch(TConnection *connection) {
+    connection->m_LastActivity = now();
+    if (connection == m_Newest) return;
+
+    // takes it out of the list
+    if (connection->m_Prev != NULL) {
+        connection->m_Prev->m_Next = connection->m_Next;
+    } else {
+        m_Oldest = connection->m_Next;
+    }
+    connection->m_Next->m_Prev = connection->m_Prev;
+
+    // and puts it at the end
+    connection->m_Prev = m_Newest;
+    connection->m_Next = NULL;
+    m_Newest->m_Next = connection;
+    m_Newest = connection;
+}
+
+/*! Current time in seconds (monotonic)
+ */
+time_t CTcpServer::now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
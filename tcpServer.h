@@ -0,0 +1,198 @@
+/*!
+*****************************************************************************
+*  \file tcpServer.h
+*
+*  \brief   Dns server over TCP (RFC 7766)
+*
+*  Every message over TCP is preceded by its length (2 bytes in network
+*  order). A client can send several queries without waiting for the
+*  responses (pipelining) and keep the connection open to reuse it.
+*
+*  All the connections are handled by one thread with a non-blocking
+*  epoll loop, so the UDP workers are never blocked by a slow client and
+*  no thread is created per connection. The messages are processed by a
+*  CDns object of its own, through the same parse, lookup and build path
+*  as the UDP queries.
+*
+*  Every connection is closed after some time without activity, and the
+*  number of connections is limited: new ones are closed at once while
+*  the limit is reached.
+*
+*  The queries handed to the forwarder (see CForwarder) are answered
+*  later, from its thread, through deliver(): the responses are queued
+*  and the epoll loop is woken up by an eventfd to append them to their
+*  connections. A connection closed by the client is kept open until the
+*  responses it waits for are sent.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#ifndef _TCP_SERVER_H
+#define _TCP_SERVER_H
+
+#include "dns.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include <ctime>
+
+/*! \class CTcpServer
+ *  \brief It takes care of the dns queries over TCP
+ *
+ *   CTcpServer accepts the connections, reads the messages of every
+ *   connection as soon as they are complete, passes them to its CDns
+ *   object and queues the responses until the connection can take them.
+ *
+ */
+using namespace std;
+
+class CTcpServer {
+public:
+    /*! Constructor. The database is shared with the UDP workers
+     */
+    CTcpServer(char *outFile, CDnsDbManager &dnsDb, unsigned int maxConnections, unsigned int idleTimeout);
+
+    /*! Destructor
+     */
+    ~CTcpServer();
+
+    /*! Starts listening on the given port (CDns::DNS_PORT usually). The
+     *  socket is dual stack (ipv6 and ipv4 mapped addresses) unless the
+     *  system has no ipv6.
+     */
+    void openCommunication(unsigned short port);
+
+    /*! Every query is stored in the binary query log, shared
+     *  with other workers. It can be NULL
+     */
+    void setQueryLog(CQueryLog *queryLog);
+
+    /*! The addresses of every answer are rotated (round robin)
+     */
+    void setRotation(bool rotate);
+
+    /*! Returns the counters of the TCP messages
+     */
+    CStats &getStats();
+
+    /*! The time of every stage is measured too, see CDns
+     */
+    void setTiming(bool timing);
+
+    /*! Waits until the log records queued so far are written.
+     *  Any thread can call it
+     */
+    void flushLog();
+
+    /*! The names not found in the database are answered from the
+     *  cache or forwarded to the upstream servers
+     */
+    void setForwarding(CForwarder *forwarder, CCache *cache);
+
+    /*! Queues the response of a forwarded query for its connection
+     *  (length 0 if there is none). It can be called from any thread
+     */
+    void deliver(uint64_t connection, const unsigned char *response, unsigned long length);
+
+    /*! Serves connections forever
+     */
+    void run();
+
+private:
+    /*! State of a connection
+     */
+    struct TConnection {
+        int m_Fd;                          /**< Socket of the connection */
+        uint64_t m_Id;                     /**< Identifier of the connection, never reused */
+        struct sockaddr_in6 m_ClientAddr;  /**< Address of the client */
+        vector<unsigned char> m_Input;     /**< Bytes received, not processed yet */
+        vector<unsigned char> m_Output;    /**< Responses not sent yet, with their lengths */
+        unsigned long m_Sent;              /**< Bytes of m_Output already sent */
+        bool m_Closing;                    /**< The client will not send more queries */
+        unsigned int m_Waiting;            /**< Forwarded queries without response yet */
+        unsigned int m_Events;             /**< Events registered in epoll */
+        time_t m_LastActivity;             /**< Last time something was received or sent */
+        TConnection *m_Prev;               /**< Previous connection, less recently active */
+        TConnection *m_Next;               /**< Next connection, more recently active */
+    };
+
+    /*! Accepts all the connections waiting
+     */
+    void acceptConnections();
+
+    /*! Reads from a connection and processes all the complete messages.
+     *  If the connection is closed, its descriptor is set to -1 and the
+     *  caller frees it
+     */
+    void readConnection(TConnection *connection);
+
+    /*! Processes the complete messages received by a connection
+     */
+    void processMessages(TConnection *connection);
+
+    /*! Sends the responses queued of a connection. If the connection
+     *  is closed, its descriptor is set to -1 and the caller frees it
+     */
+    void writeConnection(TConnection *connection);
+
+    /*! Registers the events a connection is waiting for: it is
+     *  read while there is room for the responses, and written
+     *  while there are responses queued
+     */
+    void updateEvents(TConnection *connection);
+
+    /*! Appends the responses delivered by the forwarder to their
+     *  connections
+     */
+    void takeDeliveries();
+
+    /*! Appends a response to the output of a connection, with its length
+     */
+    static void queueResponse(TConnection *connection, const unsigned char *response, unsigned long length);
+
+    /*! Closes a connection. Its descriptor is set to -1, the
+     *  caller frees it
+     */
+    void closeConnection(TConnection *connection);
+
+    /*! Closes the connections without activity for too long
+     */
+    void expireConnections();
+
+    /*! The connection has been active, it goes to the end of the list
+     */
+    void touch(TConnection *connection);
+
+    /*! Current time in seconds (monotonic)
+     */
+    static time_t now();
+
+    static const unsigned int MAX_PENDING = 65536; /**< Bytes of responses queued before stop reading */
+    static const unsigned int READ_SIZE = 16384;   /**< Bytes read per call */
+
+    CDns m_Dns;                    /**< Processing of the messages */
+    int m_Listen;                  /**< Listening socket */
+    int m_Epoll;                   /**< Epoll descriptor */
+    unsigned int m_MaxConnections; /**< Max number of connections at the same time */
+    unsigned int m_IdleTimeout;    /**< Seconds a connection can be idle */
+    unsigned int m_Connections;    /**< Number of connections */
+    TConnection *m_Oldest;         /**< Least recently active connection */
+    TConnection *m_Newest;         /**< Most recently active connection */
+    vector<unsigned char> m_Buffer; /**< Message being processed, the response is built on it */
+    uint64_t m_NextId;             /**< Identifier of the next connection */
+    unordered_map<uint64_t, TConnection *> m_Ids; /**< Open connections by identifier */
+    int m_Event;                   /**< Eventfd written when there are responses delivered */
+    pthread_mutex_t m_Lock;        /**< Lock of the responses delivered */
+    vector<unsigned char> m_Delivered; /**< Responses delivered: connection, length and bytes */
+    vector<unsigned char> m_Taken; /**< Responses delivered taken by the epoll loop */
+};
+
+#endif
@@ -0,0 +1,410 @@
+/*!
+*****************************************************************************
+*  \file workerPool.cpp
+*
+*  \brief   Pool of dns workers
+*
+*  It loads the database once and starts several CDns workers, each one
+*  in its own thread and with its own socket bound to the DNS port with
+*  SO_REUSEPORT. The kernel spreads the queries among the sockets, so the
+*  load scales with the number of cores. The database is read-only once
+*  loaded and it is shared by all the workers. It is reloaded in the
+*  background on SIGHUP (see CDnsDbManager).
+*
+*  The queries over TCP are served by one more thread with its own
+*  epoll loop (see CTcpServer), so they never block the UDP workers.
+*
+*  With upstream servers, the names that are not in the database are
+*  answered from a response cache shared by all the workers, and the
+*  misses are forwarded by one more thread (see CForwarder). The cache
+*  can be saved to a snapshot file, by one more thread, periodically and
+*  on SIGTERM or SIGINT before leaving, and it is loaded when it starts.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#include "workerPool.h"
+
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <csignal>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+
+/*! Constructor
+ */
+CWorkerPool::CWorkerPool(string &logFile, unsigned int workers, unsigned int batchSize)
+        : m_LogFile(logFile),
+          m_Workers(workers),
+          m_BatchSize(batchSize),
+          m_QueryLogFile(),
+          m_QueryLogRecords(0),
+          m_QueryLog(),
+          m_Watch(false),
+          m_Rotate(false),
+          m_DnsDb("ip_hosts", workers + 2),
+          m_Dns(),
+          m_Port(CDns::DNS_PORT),
+          m_TcpConnections(1024),
+          m_TcpIdleTimeout(10),
+          m_Tcp(NULL),
+          m_MetricsPort(0),
+          m_Metrics(NULL),
+          m_Upstreams(),
+          m_CacheSize(0),
+          m_HedgeDelay(0),
+          m_Prefetch(0),
+          m_ServeStale(0),
+          m_SnapshotFile(),
+          m_SnapshotInterval(0),
+          m_Cache(NULL),
+          m_Forwarder(NULL) {
+}
+
+/*! Destructor
+ */
+CWorkerPool::~CWorkerPool() {
+    for (unsigned int i = 0; i < m_Dns.size(); i++) {
+        delete m_Dns[i];
+    }
+    delete m_Tcp;
+    delete m_Metrics;
+    delete m_Forwarder;
+    delete m_Cache;
+}
+
+/*! Enables the binary query log (ring file with room
+ *  for the given number of records)
+ */
+void CWorkerPool::setQueryLog(string &queryLogFile, unsigned long records) {
+    m_QueryLogFile = queryLogFile;
+    m_QueryLogRecords = records;
+}
+
+/*! Changes the hosts file (text or image built
+ *  by dnsd-compile), "ip_hosts" by default
+ */
+void CWorkerPool::setDatabase(string &dbFile) {
+    m_DnsDb.setFile(dbFile);
+}
+
+/*! The database is also reloaded when the file
+ *  changes, not only on SIGHUP
+ */
+void CWorkerPool::setWatch(bool watch) {
+    m_Watch = watch;
+}
+
+/*! The addresses of every answer are rotated (round robin)
+ */
+void CWorkerPool::setRotation(bool rotate) {
+    m_Rotate = rotate;
+}
+
+/*! Changes the port of UDP and TCP, DNS_PORT by default
+ */
+void CWorkerPool::setPort(unsigned short port) {
+    m_Port = port;
+}
+
+/*! Limits of the TCP connections: max number of them at the same
+ *  time and seconds a connection can be idle
+ */
+void CWorkerPool::setTcpLimits(unsigned int maxConnections, unsigned int idleTimeout) {
+    m_TcpConnections = maxConnections;
+    m_TcpIdleTimeout = idleTimeout;
+}
+
+/*! Exports the metrics over HTTP on the given port of
+ *  the loopback address, 0 (by default) disables them
+ */
+void CWorkerPool::setMetricsPort(unsigned short port) {
+    m_MetricsPort = port;
+}
+
+/*! Forwards the names not in the database to the given upstream
+ *  servers (comma separated "address[@port]"), with a response
+ *  cache of cacheSize bytes. It returns true if an address is
+ *  not valid
+ */
+bool CWorkerPool::setForwarding(const string &upstreams, unsigned long cacheSize) {
+    string::size_type start = 0;
+
+    m_Upstreams.clear();
+    while (start <= upstreams.size()) {
+        string::size_type end = upstreams.find(',', start);
+        if (end == string::npos) end = upstreams.size();
+        if (end == start) return true;
+        m_Upstreams.push_back(upstreams.substr(start, end - start));
+        start = end + 1;
+    }
+    m_CacheSize = cacheSize;
+    return false;
+}
+
+/*! A forwarded query without response after delay ms is sent
+ *  to a second upstream too. 0 (by default) disables it
+ */
+void CWorkerPool::setHedgeDelay(unsigned int delay) {
+    m_HedgeDelay = delay;
+}
+
+/*! The cached answers hit in the last percent of their TTL are
+ *  refreshed, and the expired ones are served for staleSeconds more
+ *  while they are refreshed. 0 disables them (by default)
+ */
+void CWorkerPool::setCacheRefresh(unsigned int prefetch, unsigned int staleSeconds) {
+    m_Prefetch = prefetch;
+    m_ServeStale = staleSeconds;
+}
+
+/*! The response cache is loaded from the given snapshot file when
+ *  it starts, and saved to it every interval seconds (0 never) and
+ *  on SIGTERM or SIGINT, before leaving
+ */
+void CWorkerPool::setCacheSnapshot(const string &file, unsigned int interval) {
+    m_SnapshotFile = file;
+    m_SnapshotInterval = interval;
+}
+
+/*! Loads the database and opens the sockets of all the workers
+ */
+void CWorkerPool::open() {
+    // SIGHUP is only received by the reloader, every thread
+    // created from now on inherits the mask
+    CDnsDbManager::blockSignals();
+    if (!m_Upstreams.empty() && !m_SnapshotFile.empty()) {
+        // the cache is saved before leaving, by the snapshot thread
+        sigset_t mask;
+
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTERM);
+        sigaddset(&mask, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    }
+
+    // Prepare Dns db class to process file
+    bool error = m_DnsDb.open();
+    if (error) {
+        cerr << "Error reading <" << m_DnsDb.getFile() << "> config file. It does not exist" << endl;
+        exit(0);
+    }
+
+    if (!m_QueryLogFile.empty()) {
+        error = m_QueryLog.open(m_QueryLogFile.c_str(), m_QueryLogRecords);
+        if (error) {
+            cerr << "Error opening <" << m_QueryLogFile << "> query log file" << endl;
+            exit(0);
+        }
+    }
+
+    if (!m_Upstreams.empty()) {
+        // the forwarder has its own log file
+        string forwarderLogFile(m_LogFile + ".fwd");
+        m_Cache = new CCache(m_CacheSize);
+        m_Cache->setPrefetch(m_Prefetch);
+        m_Cache->setServeStale(m_ServeStale);
+        if (!m_SnapshotFile.empty() && m_Cache->load(m_SnapshotFile.c_str())) {
+            cerr << "Error reading <" << m_SnapshotFile << "> cache snapshot, starting with an empty cache" << endl;
+        }
+        m_Forwarder = new CForwarder((char *) forwarderLogFile.c_str(), m_DnsDb, *m_Cache);
+        for (unsigned int i = 0; i < m_Upstreams.size(); i++) {
+            if (m_Forwarder->addUpstream(m_Upstreams[i].c_str())) {
+                cerr << "Error: <" << m_Upstreams[i] << "> is not a valid upstream server" << endl;
+                exit(0);
+            }
+        }
+        if (!m_QueryLogFile.empty()) m_Forwarder->setQueryLog(&m_QueryLog);
+        m_Forwarder->setTiming(m_MetricsPort != 0);
+        m_Forwarder->setHedgeDelay(m_HedgeDelay);
+        m_Forwarder->open();
+    }
+
+    for (unsigned int i = 0; i < m_Workers; i++) {
+        string logFile(m_LogFile);
+
+        // every worker has its own log file
+        if (m_Workers > 1) {
+            ostringstream s;
+            s << "." << i;
+            logFile += s.str();
+        }
+        CDns *dns = new CDns((char *) logFile.c_str(), m_DnsDb, m_BatchSize);
+        if (!m_QueryLogFile.empty()) dns->setQueryLog(&m_QueryLog);
+        dns->setRotation(m_Rotate);
+        dns->setTiming(m_MetricsPort != 0);
+        if (m_Forwarder != NULL) dns->setForwarding(m_Forwarder, m_Cache);
+        dns->openCommunication(m_Workers > 1, m_Port);
+        m_Dns.push_back(dns);
+    }
+
+    // the TCP server has its own log file
+    string tcpLogFile(m_LogFile + ".tcp");
+    m_Tcp = new CTcpServer((char *) tcpLogFile.c_str(), m_DnsDb, m_TcpConnections, m_TcpIdleTimeout);
+    if (!m_QueryLogFile.empty()) m_Tcp->setQueryLog(&m_QueryLog);
+    m_Tcp->setRotation(m_Rotate);
+    m_Tcp->setTiming(m_MetricsPort != 0);
+    if (m_Forwarder != NULL) m_Tcp->setForwarding(m_Forwarder, m_Cache);
+    m_Tcp->openCommunication(m_Port);
+
+    if (m_MetricsPort != 0) {
+        m_Metrics = new CMetricsServer();
+        for (unsigned int i = 0; i < m_Dns.size(); i++) {
+            m_Metrics->addStats(&m_Dns[i]->getStats());
+        }
+        m_Metrics->addStats(&m_Tcp->getStats());
+        if (m_Forwarder != NULL) {
+            m_Metrics->addStats(&m_Forwarder->getStats());
+            m_Metrics->setCache(m_Cache);
+            m_Metrics->setForwarder(m_Forwarder);
+        }
+        m_Metrics->openCommunication(m_MetricsPort);
+    }
+    m_DnsDb.startReloader(m_Watch);
+}
+
+/*! Serves requests forever. The first worker runs in the
+ *  calling thread, the TCP server in a thread of its own.
+ */
+void CWorkerPool::run() {
+    pthread_t tcp;
+
+    if (pthread_create(&tcp, NULL, tcpThread, m_Tcp) != 0) {
+        cerr << "Error creating TCP thread" << endl;
+        exit(0);
+    }
+    pthread_detach(tcp);
+
+    if (m_Forwarder != NULL) {
+        pthread_t forwarder;
+
+        if (pthread_create(&forwarder, NULL, forwarderThread, m_Forwarder) != 0) {
+            cerr << "Error creating forwarder thread" << endl;
+            exit(0);
+        }
+        pthread_detach(forwarder);
+    }
+
+    if (m_Cache != NULL && !m_SnapshotFile.empty()) {
+        pthread_t snapshot;
+
+        if (pthread_create(&snapshot, NULL, snapshotThread, this) != 0) {
+            cerr << "Error creating snapshot thread" << endl;
+            exit(0);
+        }
+        pthread_detach(snapshot);
+    }
+
+    if (m_Metrics != NULL) {
+        pthread_t metrics;
+
+        if (pthread_create(&metrics, NULL, metricsThread, m_Metrics) != 0) {
+            cerr << "Error creating metrics thread" << endl;
+            exit(0);
+        }
+        pthread_detach(metrics);
+    }
+
+    for (unsigned int i = 1; i < m_Dns.size(); i++) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, workerThread, m_Dns[i]) != 0) {
+            cerr << "Error creating worker thread" << endl;
+            exit(0);
+        }
+        pthread_detach(thread);
+    }
+    m_Dns[0]->run();
+}
+
+/*! Thread entry point of a worker
+ */
+void *CWorkerPool::workerThread(void *arg) {
+    CDns *dns = (CDns *) arg;
+
+    dns->run();
+    return NULL;
+}
+
+/*! Thread entry point of the TCP server
+ */
+void *CWorkerPool::tcpThread(void *arg) {
+    CTcpServer *tcp = (CTcpServer *) arg;
+
+    tcp->run();
+    return NULL;
+}
+
+/*! Thread entry point of the metrics listener
+ */
+void *CWorkerPool::metricsThread(void *arg) {
+    CMetricsServer *metrics = (CMetricsServer *) arg;
+
+    metrics->run();
+    return NULL;
+}
+
+/*! Waits until the text logs of all the threads are written
+ */
+void CWorkerPool::flushLogs() {
+    for (unsigned int i = 0; i < m_Dns.size(); i++) {
+        m_Dns[i]->flushLog();
+    }
+    if (m_Tcp != NULL) m_Tcp->flushLog();
+    if (m_Forwarder != NULL) m_Forwarder->flushLog();
+}
+
+/*! Thread entry point of the forwarder
+ */
+void *CWorkerPool::forwarderThread(void *arg) {
+    CForwarder *forwarder = (CForwarder *) arg;
+
+    forwarder->run();
+    return NULL;
+}
+
+/*! Thread entry point of the cache snapshots, the argument is the pool
+ */
+void *CWorkerPool::snapshotThread(void *arg) {
+    CWorkerPool *pool = (CWorkerPool *) arg;
+    struct pollfd fds[1];
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    fds[0].fd = signalfd(-1, &mask, 0);
+    fds[0].events = POLLIN;
+    if (fds[0].fd < 0) {
+        cerr << "Error creating signalfd for SIGTERM" << endl;
+        exit(0);
+    }
+
+    while (1) {
+        int n = poll(fds, 1, pool->m_SnapshotInterval > 0 ? (int) pool->m_SnapshotInterval * 1000 : -1);
+        if (n < 0) continue;
+
+        // the workers go on while it is written
+        if (pool->m_Cache->save(pool->m_SnapshotFile.c_str())) {
+            cerr << "Error writing <" << pool->m_SnapshotFile << "> cache snapshot" << endl;
+        }
+        if (n > 0) {
+            struct signalfd_siginfo info;
+            if (read(fds[0].fd, &info, sizeof(info)) < 0) {
+                // leaving anyway
+            }
+            // the other threads are still serving: no destructor
+            // runs under them, only their logs are written first
+            pool->flushLogs();
+            _exit(0);
+        }
+    }
+    return NULL;
+}
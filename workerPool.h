@@ -0,0 +1,187 @@
+/*!
+*****************************************************************************
+*  \file workerPool.h
+*
+*  \brief   Pool of dns workers
+*
+*  It loads the database once and starts several CDns workers, each one
+*  in its own thread and with its own socket bound to the DNS port with
+*  SO_REUSEPORT. The kernel spreads the queries among the sockets, so the
+*  load scales with the number of cores. The database is read-only once
+*  loaded and it is shared by all the workers. It is reloaded in the
+*  background on SIGHUP (see CDnsDbManager).
+*
+*  The queries over TCP are served by one more thread with its own
+*  epoll loop (see CTcpServer), so they never block the UDP workers.
+*
+*  The counters of all the workers can be exported over HTTP by one
+*  more thread (see CMetricsServer).
+*
+*  With upstream servers, the names that are not in the database are
+*  answered from a response cache shared by all the workers, and the
+*  misses are forwarded by one more thread (see CForwarder). The cache
+*  can be saved to a snapshot file, by one more thread, periodically and
+*  on SIGTERM or SIGINT before leaving, and it is loaded when it starts.
+*
+*  \version 0.1
+*  \date    17-October-2026
+*  \author  Cristina Camacho Romaguera
+*
+*****************************************************************************
+*/
+
+#ifndef _WORKER_POOL_H
+#define _WORKER_POOL_H
+
+#include "dns.h"
+#include "tcpServer.h"
+#include "metrics.h"
+#include "cache.h"
+#include "forwarder.h"
+#include "dnsDbManager.h"
+#include "queryLog.h"
+
+#include <string>
+#include <vector>
+
+/*! \class CWorkerPool
+ *  \brief It starts and keeps the dns workers
+ *
+ *   CWorkerPool creates one CDns object per thread. With only one
+ *   worker, it behaves as the original single thread server (no
+ *   SO_REUSEPORT and the log file given by the user). With more
+ *   workers, every worker writes to its own log file, named after
+ *   the given one plus the number of the worker.
+ *
+ */
+using namespace std;
+
+class CWorkerPool {
+public:
+    /*! Constructor
+     */
+    CWorkerPool(string &logFile, unsigned int workers, unsigned int batchSize);
+
+    /*! Enables the binary query log (ring file with room
+     *  for the given number of records)
+     */
+    void setQueryLog(string &queryLogFile, unsigned long records);
+
+    /*! Changes the hosts file (text or image built
+     *  by dnsd-compile), "ip_hosts" by default
+     */
+    void setDatabase(string &dbFile);
+
+    /*! The database is also reloaded when the file
+     *  changes, not only on SIGHUP
+     */
+    void setWatch(bool watch);
+
+    /*! The addresses of every answer are rotated (round robin)
+     */
+    void setRotation(bool rotate);
+
+    /*! Changes the port of UDP and TCP, DNS_PORT by default
+     */
+    void setPort(unsigned short port);
+
+    /*! Limits of the TCP connections: max number of them at the same
+     *  time and seconds a connection can be idle
+     */
+    void setTcpLimits(unsigned int maxConnections, unsigned int idleTimeout);
+
+    /*! Exports the metrics over HTTP on the given port of
+     *  the loopback address, 0 (by default) disables them
+     */
+    void setMetricsPort(unsigned short port);
+
+    /*! Forwards the names not in the database to the given upstream
+     *  servers (comma separated "address[@port]"), with a response
+     *  cache of cacheSize bytes. It returns true if an address is
+     *  not valid
+     */
+    bool setForwarding(const string &upstreams, unsigned long cacheSize);
+
+    /*! A forwarded query without response after delay ms is sent
+     *  to a second upstream too. 0 (by default) disables it
+     */
+    void setHedgeDelay(unsigned int delay);
+
+    /*! The cached answers hit in the last percent of their TTL are
+     *  refreshed, and the expired ones are served for staleSeconds more
+     *  while they are refreshed. 0 disables them (by default)
+     */
+    void setCacheRefresh(unsigned int prefetch, unsigned int staleSeconds);
+
+    /*! The response cache is loaded from the given snapshot file when
+     *  it starts, and saved to it every interval seconds (0 never) and
+     *  on SIGTERM or SIGINT, before leaving
+     */
+    void setCacheSnapshot(const string &file, unsigned int interval);
+
+    /*! Destructor
+     */
+    ~CWorkerPool();
+
+    /*! Loads the database and opens the sockets of all the workers
+     */
+    void open();
+
+    /*! Serves requests forever. The first worker runs in the
+     *  calling thread, the TCP server in a thread of its own.
+     */
+    void run();
+
+private:
+    /*! Thread entry point of a worker
+     */
+    static void *workerThread(void *arg);
+
+    /*! Thread entry point of the TCP server
+     */
+    static void *tcpThread(void *arg);
+
+    /*! Thread entry point of the metrics listener
+     */
+    static void *metricsThread(void *arg);
+
+    /*! Thread entry point of the forwarder
+     */
+    static void *forwarderThread(void *arg);
+
+    /*! Thread entry point of the cache snapshots, the argument is the pool
+     */
+    static void *snapshotThread(void *arg);
+
+    /*! Waits until the text logs of all the threads are written
+     */
+    void flushLogs();
+
+    string m_LogFile;          /**<  Log file given by the user */
+    unsigned int m_Workers;    /**<  Number of workers */
+    unsigned int m_BatchSize;  /**<  Max number of messages read per call */
+    string m_QueryLogFile;     /**<  Binary query log file, empty if disabled */
+    unsigned long m_QueryLogRecords; /**<  Size of the binary query log */
+    CQueryLog m_QueryLog;      /**<  Binary query log, shared by all the workers */
+    bool m_Watch;              /**<  Reload the database when the file changes */
+    bool m_Rotate;             /**<  Rotate the addresses of the answers */
+    CDnsDbManager m_DnsDb;     /**<  Current database, shared by all the workers */
+    vector<CDns *> m_Dns;      /**<  Workers */
+    unsigned short m_Port;     /**<  Port of UDP and TCP */
+    unsigned int m_TcpConnections; /**<  Max number of TCP connections */
+    unsigned int m_TcpIdleTimeout; /**<  Seconds a TCP connection can be idle */
+    CTcpServer *m_Tcp;         /**<  TCP server */
+    unsigned short m_MetricsPort; /**<  Port of the metrics, 0 if disabled */
+    CMetricsServer *m_Metrics; /**<  Metrics listener, NULL if disabled */
+    vector<string> m_Upstreams; /**<  Upstream servers, empty if forwarding is disabled */
+    unsigned long m_CacheSize; /**<  Bytes of the response cache */
+    unsigned int m_HedgeDelay; /**<  Ms before a second upstream is asked, 0 never */
+    unsigned int m_Prefetch;   /**<  Last percent of the TTL that refreshes a cached answer, 0 never */
+    unsigned int m_ServeStale; /**<  Seconds an expired answer is served while it is refreshed */
+    string m_SnapshotFile;     /**<  Snapshot of the response cache, empty if disabled */
+    unsigned int m_SnapshotInterval; /**<  Seconds between snapshots, 0 only on exit */
+    CCache *m_Cache;           /**<  Response cache, NULL if forwarding is disabled */
+    CForwarder *m_Forwarder;   /**<  Forwarder, NULL if forwarding is disabled */
+};
+
+#endif